@@ -19,6 +19,29 @@
  * - UDP device announcement system
  * - Persistent configuration storage
  * - Advanced firmware management and partition handling
+ * - RSSI-aware background roaming between access points
+ * - Layered WiFi reconnect with session resume and stale tally display
+ * - Closed-loop WiFi TX power control (RSSI, heartbeat loss, retries)
+ * - Zero-config server discovery via mDNS (_obs-tally._tcp, role=server)
+ * - Allocation-free heartbeats from preformatted, in-place patched requests
+ * - Cached DNS/mDNS resolution with negative caching and background refresh
+ * - Keep-alive push listener for server tally updates (port 81)
+ * - Zero-copy UDP ingest via lwIP receive callbacks and per-subsystem queues
+ * - DSCP/WMM marking: EF for tally traffic and acks, CS1 for bulk transfers
+ * - Redundant tally delivery (push + multicast) with sequence de-duplication
+ * - Long-poll tally subscription for networks that block inbound connections
+ * - MQTT transport: per-source tally topics, retained snapshot, presence with last will
+ * - Transport capability negotiation at registration, with clock sync
+ * - Transport latency benchmark with per-transport histograms, loss and jitter
+ * - Direct OBS WebSocket v5 mode: tally computed on the device, no server hop
+ * - TSL UMD 3.1/5.0 listener (UDP and TCP) for hardware switchers and multiviewers
+ * - Scene-graph tally: OBS scene events applied on the device, nested scenes and groups
+ * - Feed merging: server, OBS direct and TSL combined by program-wins or priority rules
+ * - Optional HMAC-SHA256 (128-bit) authentication of server frames with replay checks
+ * - Fleet provisioning: per-MAC config rows by multicast, applied live and acknowledged
+ * - Non-blocking config portal with cached scans and background rejoin of the saved network
+ * - Live dashboard: static page (ETag-cached) fed by a Server-Sent Events delta stream
+ * - Versioned JSON status snapshots with ETag/If-None-Match revalidation
  * 
  * Hardware: M5StickC PLUS
  * 
@@ -31,6 +54,7 @@
  *    - ArduinoJson by Benoit Blanchon (v7.0.3+)
  *    - WiFiManager by tzapu (v2.0.17+)
  *    - NTPClient by Fabrice Weinberg (v3.2.1+)
+ *    - PubSubClient by Nick O'Leary (v2.8+)
  * 5. Upload this firmware
  * 6. Monitor Serial at 115200 baud for first boot
  * 7. Connect to "OBS-Tally-XXXX" WiFi network for setup
@@ -48,8 +72,20 @@
 #include <ESPmDNS.h>
 #include <WiFiUdp.h>
 #include <NTPClient.h>
+#include <PubSubClient.h>
+#include <mbedtls/md.h>
+#include <mbedtls/base64.h>
 #include <Update.h>
 #include <ArduinoOTA.h>
+#include <esp_heap_caps.h>
+#include <esp_wifi.h>
+#include <lwip/udp.h>
+#include <lwip/igmp.h>
+#include <lwip/sockets.h>
+#include <lwip/priv/tcpip_priv.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
 
 
 
@@ -66,6 +102,7 @@
 // Server and networking configuration  
 #define DEFAULT_SERVER_URL "http://192.168.0.91:3005"
 #define CONFIG_PORTAL_TIMEOUT 300
+#define CONFIG_PORTAL_PASSWORD "obstally123"  // Simple password to prevent accidental connections
 #define HEARTBEAT_INTERVAL 30000
 #define RECONNECT_INTERVAL 5000
 #define HEALTH_CHECK_INTERVAL 60000
@@ -158,6 +195,525 @@ bool discoveryUDPInitialized = false;
 unsigned long lastAnnouncementTime = 0;
 #define ANNOUNCEMENT_INTERVAL 60000  // Send announcement every minute
 #define UDP_DISCOVERY_PORT 3006      // Port for UDP discovery
+#define DISCOVERY_MAX_PACKET 256     // Larger packets are not discovery requests
+#define DISCOVERY_REPLY_SPREAD 500   // Replies are spread randomly over this window (ms)
+#define DISCOVERY_RECENT_IDS 8       // Request ids remembered for duplicate suppression
+#define DISCOVERY_ID_LEN 32          // Fits the ISO timestamp older servers send instead
+#define ANNOUNCE_MIN_INTERVAL 1000   // Announcements closer together than this are dropped
+#define ANNOUNCE_BUFFER_SIZE 320
+
+// Presence: pre-serialised announcement, rebuilt only when a field changes
+char announcementCache[ANNOUNCE_BUFFER_SIZE];
+size_t announcementLength = 0;
+String announcedName = "";
+IPAddress announcedIP;
+String announcedSource = "";
+String announcedServerIP = "";
+IPAddress announceServerAddr;          // Parsed once, not on every send
+bool announceServerValid = false;
+unsigned long lastAnnounceSent = 0;
+unsigned long announcementsSent = 0;
+unsigned long announcementsSuppressed = 0;
+unsigned long announcementRebuilds = 0;
+
+// Discovery responder state
+char recentRequestIds[DISCOVERY_RECENT_IDS][DISCOVERY_ID_LEN];
+int recentRequestIndex = 0;
+bool discoveryReplyPending = false;
+IPAddress discoveryReplyIP;
+uint16_t discoveryReplyPort = 0;
+char discoveryReplyId[DISCOVERY_ID_LEN] = "";
+bool discoveryReplyLegacy = false;     // Plain-text probe: answer in the old tally_device format
+unsigned long discoveryReplyAt = 0;
+unsigned long discoveryPacketsReceived = 0;
+unsigned long discoveryPacketsDropped = 0;
+unsigned long discoveryDuplicates = 0;
+unsigned long discoveryRepliesSent = 0;
+
+// mDNS server discovery
+#define MDNS_SERVICE "obs-tally"
+#define MDNS_CACHE_TTL 300000        // Browse results are trusted for 5 minutes
+#define MDNS_RETRY_INTERVAL 30000    // Browse again after this long if nothing was found
+#define MAX_MDNS_SERVERS 3
+
+struct DiscoveredServer {
+    IPAddress ip;
+    uint16_t port;
+};
+
+DiscoveredServer mdnsServers[MAX_MDNS_SERVERS];
+int mdnsServerCount = 0;
+unsigned long lastMdnsBrowse = 0;
+unsigned long mdnsBrowses = 0;
+volatile bool mdnsBrowsePending = false;  // Browse queued or running in the lookup task
+volatile bool mdnsBrowseDone = false;     // Results published, not yet acted on
+bool serverManual = false;                // Server was set by a user; discovery leaves it alone
+
+// Background lookups. Browses, DNS refreshes and scene graph loads block
+// for seconds on a miss, so they run in their own task and publish results
+// under lookupLock
+#define LOOKUP_TASK_STACK 4096
+#define LOOKUP_QUEUE_LENGTH 4
+
+enum LookupJob : uint8_t {
+    LOOKUP_BROWSE,
+    LOOKUP_RESOLVE,
+    LOOKUP_SCENE_GRAPH
+};
+
+QueueHandle_t lookupQueue = NULL;
+portMUX_TYPE lookupLock = portMUX_INITIALIZER_UNLOCKED;
+unsigned long serverSwitches = 0;
+unsigned long bootToRegister = 0;
+
+// DSCP marking. EF maps to the WMM voice queue, CS1 to background
+#define DSCP_MARKING true
+#define DSCP_TALLY 46                // EF: push channel, UDP tally, discovery replies and acks
+#define DSCP_BULK 8                  // CS1: OTA, web UI
+#define DSCP_DEFAULT 0               // Best effort: heartbeats, the fallback tally path
+
+// UDP ingest: an lwIP receive callback classifies datagrams and queues
+// the pbufs for the subsystem that owns them
+#define UDP_INGEST_QUEUE_LEN 16
+#define UDP_TALLY_MAX_FRAME 1024
+
+struct UdpFrame {
+    struct pbuf* p;                  // Freed by the receiving subsystem
+    uint32_t addr;                   // Sender, network byte order
+    uint16_t port;
+};
+
+struct UdpIngestCall {
+    struct tcpip_api_call_data call;
+    uint16_t port;
+    uint32_t group;                    // Multicast group to join, 0 for none
+    udp_recv_fn recv;
+    struct udp_pcb* pcb;
+};
+
+struct UdpSendCall {
+    struct tcpip_api_call_data call;
+    struct udp_pcb* pcb;
+    uint32_t addr;                     // Network byte order
+    uint16_t port;
+    const uint8_t* data;
+    size_t length;
+};
+
+struct udp_pcb* udpIngestPcb = NULL;
+struct udp_pcb* tallyMulticastPcb = NULL;
+QueueHandle_t discoveryQueue = NULL;
+QueueHandle_t tallyQueue = NULL;
+TaskHandle_t udpIngestWakeTask = NULL; // Loop task, woken when a frame is queued
+volatile unsigned long udpFramesReceived = 0;
+volatile unsigned long udpFramesRejected = 0;
+volatile unsigned long udpQueueOverflows = 0;
+unsigned long udpMaxBurst = 0;
+unsigned long udpTallyFrames = 0;
+char tallyIdNeedle[48] = "";         // "deviceId":"<id>" as the server serialises it
+
+// Redundant tally delivery. Updates carry a per-device sequence number and
+// the server's epoch; the first copy is applied and later copies dropped
+#define TALLY_MULTICAST_GROUP 239, 255, 30, 6
+#define TALLY_MULTICAST_PORT 3007
+#define TALLY_PATH_PUSH 0            // HTTP push (port 80 or the push listener)
+#define TALLY_PATH_UDP 1             // Multicast or unicast UDP frame
+#define TALLY_PATH_POLL 2            // Long-poll subscription response
+#define TALLY_PATH_MQTT 3            // Broker message on the source or snapshot topic
+#define TALLY_PATH_COUNT 4
+
+uint32_t tallyEpoch = 0;
+uint32_t lastTallySeq = 0;
+uint8_t lastTallyPaths = 0;          // Bit per path that delivered lastTallySeq
+bool lastTallyRedundant = false;
+unsigned long tallyPathWins[TALLY_PATH_COUNT] = {0, 0, 0, 0};
+unsigned long tallyDuplicates = 0;
+unsigned long tallyStaleUpdates = 0;
+unsigned long redundancySaves = 0;
+unsigned long tallySeqGaps = 0;
+
+// Persistent push listener
+#define PUSH_PORT 81
+#define PUSH_MAX_CLIENTS 2           // Connection cap; the oldest idle one is replaced
+#define PUSH_IDLE_TIMEOUT 30000      // Close connections idle for 30 seconds
+#define PUSH_MAX_BODY 1024
+
+struct PushConnection {
+    WiFiClient client;
+    unsigned long lastActivity;
+    unsigned long requests;
+};
+
+WiFiServer pushServer(PUSH_PORT);
+PushConnection pushClients[PUSH_MAX_CLIENTS];
+bool pushServerRunning = false;
+char pushBody[PUSH_MAX_BODY + 1];
+unsigned long pushAccepted = 0;
+unsigned long pushRejected = 0;
+unsigned long pushIdleCloses = 0;
+unsigned long pushRequests = 0;
+unsigned long pushReusedRequests = 0;
+unsigned long pushLastLatencyUs = 0;
+unsigned long pushMaxLatencyUs = 0;
+float pushAvgLatencyUs = 0;
+
+// Long-poll subscription. The device holds a request open on the server,
+// which answers as soon as there is a newer update; used where the server
+// cannot open connections to the device (guest or client-isolated WLANs)
+#define SUBSCRIBE_HOLD_TIMEOUT 35000 // Server answers 204 after 25 s
+#define SUBSCRIBE_RETRY_INTERVAL 5000
+#define SUBSCRIBE_BUFFER_SIZE 1536   // Headers plus a PUSH_MAX_BODY update
+#define SUBSCRIBE_POLL_WAIT 20       // Loop sleep while a request is held
+
+WiFiClient subClient;
+char subResponse[SUBSCRIBE_BUFFER_SIZE + 1];
+size_t subReceived = 0;
+bool subscribeMode = false;          // Stored setting, off by default
+bool subArmed = false;
+bool subReused = false;              // Request went out on a kept-alive connection
+unsigned long subArmedAt = 0;
+unsigned long subRetryAt = 0;
+unsigned long subscribeConnections = 0;
+unsigned long subscribeUpdates = 0;
+unsigned long subscribeTimeouts = 0;
+unsigned long subscribeErrors = 0;
+unsigned long subscribeLastWaitMs = 0;
+
+// MQTT transport. Devices subscribe to their source's retained tally topic
+// and the retained snapshot (used until the source topic has been seen);
+// they publish presence (last will: offline), telemetry and a tally ack
+#define MQTT_TOPIC_PREFIX "obs-tally"
+#define MQTT_DEFAULT_PORT 1883
+#define MQTT_BUFFER_SIZE 1280        // Largest tally or snapshot message
+#define MQTT_KEEPALIVE 15            // Seconds; the broker sends the will after 1.5x
+#define MQTT_RECONNECT_INTERVAL 5000
+#define MQTT_TELEMETRY_INTERVAL 30000
+
+WiFiClient mqttNet;
+PubSubClient mqttClient(mqttNet);
+String mqttBroker = "";              // Host name or IP, empty disables MQTT
+uint16_t mqttPort = MQTT_DEFAULT_PORT;
+uint8_t mqttQos = 1;                 // Subscription QoS; PubSubClient publishes at QoS 0
+String mqttSubscribedSource = "";
+bool mqttSnapshotPending = false;
+unsigned long lastMqttAttempt = 0;
+unsigned long lastMqttTelemetry = 0;
+unsigned long mqttConnects = 0;
+unsigned long mqttFailures = 0;
+unsigned long mqttMessages = 0;
+unsigned long mqttLastApplyUs = 0;   // Receive to display for the last tally message
+
+// Transport negotiated at registration; empty with servers that predate it
+String negotiatedTransport = "";
+bool negotiatedRedundant = false;
+uint16_t negotiatedMaxFrame = PUSH_MAX_BODY;
+String mqttServerBroker = "";        // Broker offered by the server
+bool clockSynced = false;
+int64_t serverClockOffset = 0;       // Server epoch ms minus local millis()
+unsigned long lastDeliveryMs = 0;    // Server send to apply, for updates carrying "ts"
+unsigned long maxDeliveryMs = 0;
+
+// Transport benchmark. Probes carry the server time and are measured against
+// the synchronised clock; fixed buckets keep histograms comparable across
+// devices and venues
+#define BENCH_TRANSPORTS 4
+#define BENCH_BUCKETS 10
+#define CLOCK_SYNC_SAMPLES 5
+
+struct BenchStats {
+    uint32_t received;
+    uint32_t measured;               // Received with a synced clock; only these have latencies
+    int32_t minMs;
+    int32_t maxMs;
+    int64_t sumMs;
+    int32_t lastMs;
+    uint32_t jitterSumMs;            // Sum of |difference| between consecutive latencies
+    uint32_t histogram[BENCH_BUCKETS];
+};
+
+const char* const benchTransportNames[BENCH_TRANSPORTS] = {"http", "socket", "udp", "multicast"};
+const uint16_t benchBucketLimits[BENCH_BUCKETS - 1] = {1, 2, 5, 10, 20, 50, 100, 200, 500};  // ms; last bucket is open
+BenchStats benchStats[BENCH_TRANSPORTS];
+uint32_t benchRun = 0;
+uint32_t benchCount = 0;
+bool benchSyncPending = false;
+unsigned long benchStaleProbes = 0;  // Probes from another run
+unsigned long clockSyncRttMs = 0;
+
+// Direct OBS WebSocket (v5) mode. The device follows OBS itself and works
+// out the tally for assignedSource from the program and preview scene item
+// lists; server tally is ignored while the OBS session is identified and
+// applied again if it drops
+#define TALLY_MODE_SERVER "server"
+#define TALLY_MODE_OBS "obs"
+#define OBS_DEFAULT_PORT 4455
+#define OBS_RPC_VERSION 1
+#define OBS_EVENT_SUBSCRIPTIONS (4 | 64 | 128 | 1024)  // Scenes, Outputs, SceneItems, Ui
+#define OBS_RECONNECT_INTERVAL 5000
+#define OBS_HANDSHAKE_TIMEOUT 3000
+#define OBS_FRAME_TIMEOUT 500        // A started frame must complete within this
+#define OBS_MAX_FRAME 16384          // Buffered frames; larger text frames are parsed from the socket
+#define OBS_REQUEST_TIMEOUT 2000     // An unanswered item list is asked for again
+#define OBS_REQUEST_RETRIES 2        // Then the session is dropped and server tally applies
+#define OBS_NEST_DEPTH 8             // Nested scenes and groups followed, as on the server
+#define OBS_WALK_SCENES 8            // Item lists read per program or preview walk
+#define OBS_PING_INTERVAL 10000
+#define OBS_IDLE_TIMEOUT 25000       // Nothing received, not even a pong: the session is dead
+#define OBS_UPGRADE_BUFFER 512
+
+WiFiClient obsClient;
+String tallyMode = TALLY_MODE_SERVER;
+String obsHost = "";
+uint16_t obsPort = OBS_DEFAULT_PORT;
+String obsPassword = "";
+char obsUpgrade[OBS_UPGRADE_BUFFER + 1];
+size_t obsUpgradeReceived = 0;
+bool obsUpgrading = false;
+bool obsIdentified = false;
+unsigned long obsConnectedAt = 0;
+unsigned long lastObsAttempt = 0;
+unsigned long lastObsFrame = 0;
+unsigned long lastObsPing = 0;
+String obsProgramScene = "";
+String obsPreviewScene = "";
+String obsTrackedSource = "";        // assignedSource the item lists were checked for
+bool obsInProgram = false;
+bool obsInPreview = false;
+uint32_t obsRequestCounter = 0;
+uint32_t obsProgramRequest = 0;      // Outstanding item list request per scene, 0 when answered
+uint32_t obsPreviewRequest = 0;
+String obsWalkScenes[2][OBS_WALK_SCENES];  // Lists read by the current walk, [0] program, [1] preview
+uint8_t obsWalkCount[2] = {0, 0};
+uint8_t obsWalkPending[2] = {0, 0};
+bool obsWalkFound[2] = {false, false};
+unsigned long obsItemsRequestedAt = 0;
+uint8_t obsItemsRetries = 0;
+unsigned long obsFrameStartUs = 0;
+unsigned long obsConnects = 0;
+unsigned long obsFailures = 0;
+unsigned long obsEvents = 0;
+unsigned long obsSkippedFrames = 0;
+unsigned long obsStreamedFrames = 0;
+unsigned long obsRequestTimeouts = 0;
+unsigned long obsLastApplyUs = 0;    // Event frame to display for the last tally change
+
+// TSL UMD listener for hardware switchers and multiviewers. Datagrams are
+// parsed in the lwIP thread where they lie and only this display's tally
+// is queued; TCP carries TSL 5.0 in DLE/STX framing or TSL 3.1 messages
+// back to back
+#define TALLY_MODE_TSL "tsl"
+#define TSL_DEFAULT_PORT 40001
+#define TSL_V31_LENGTH 18            // 0x80 + address, control, 16 characters
+#define TSL_MAX_PACKET 1024
+#define TSL_PROGRAM 0x01
+#define TSL_PREVIEW 0x02
+#define TSL_NO_MATCH -1              // Valid packet without a message for this display
+#define TSL_MALFORMED -2
+#define TSL_DLE 0xFE
+#define TSL_STX 0x02
+
+struct TslTally {
+    uint8_t tally;                     // TSL_PROGRAM | TSL_PREVIEW
+    uint32_t receivedUs;
+};
+
+uint16_t tslPort = TSL_DEFAULT_PORT;
+uint16_t tslIndex = 0;               // 3.1 address (0-126) or 5.0 index of this display
+volatile bool tslEnabled = false;    // Read by the lwIP thread
+struct udp_pcb* tslPcb = NULL;
+QueueHandle_t tslQueue = NULL;
+WiFiServer tslServer(TSL_DEFAULT_PORT);
+WiFiClient tslClient;
+bool tslListening = false;
+uint8_t tslRx[TSL_MAX_PACKET];
+size_t tslRxLength = 0;
+uint8_t tslRxVersion = 0;            // 3 or 5 while a TCP message is read, 0 between
+bool tslRxEscape = false;            // Previous TCP byte was DLE
+bool tslSeen = false;                // A message for this display has arrived
+uint8_t tslTally = 0;
+volatile unsigned long tslPackets = 0;
+volatile unsigned long tslMatched = 0;
+volatile unsigned long tslMalformed = 0;
+unsigned long tslTcpPackets = 0;
+unsigned long tslLastApplyUs = 0;    // Receipt to display for the last tally change
+
+// Feed merging: the server, OBS direct and TSL each report a tally for this
+// device and the display shows the combination. "any" shows program if any
+// feed has it, else preview if any has it, from running counts; "priority"
+// shows the first active feed in feedPriority. Each feed numbers its own
+// state changes
+#define TALLY_MODE_MERGE "merge"
+#define MERGE_RULE_ANY "any"
+#define MERGE_RULE_PRIORITY "priority"
+#define FEED_SERVER 0
+#define FEED_OBS 1
+#define FEED_TSL 2
+#define FEED_COUNT 3
+#define TSL_FEED_TIMEOUT 30000       // UDP TSL silence after which the feed is dropped
+
+struct FeedState {
+    bool active;
+    bool program;
+    bool preview;
+    uint32_t seq;                      // State changes reported by this feed
+    unsigned long updatedAt;
+    unsigned long changes;             // Display changes this feed caused
+};
+
+const char* const feedNames[FEED_COUNT] = {"server", "obs", "tsl"};
+FeedState feeds[FEED_COUNT];
+uint8_t feedOrder[FEED_COUNT] = {FEED_SERVER, FEED_OBS, FEED_TSL};
+uint8_t feedProgramCount = 0;        // Active feeds reporting program
+uint8_t feedPreviewCount = 0;
+String mergeRule = MERGE_RULE_ANY;
+String feedPriority = "server,obs,tsl";
+
+// Frame authentication. With a key set, every tally, scene and config frame
+// from the server must end in ,"mac":"<32 hex>"}, the HMAC-SHA256 of the
+// frame without that field truncated to 128 bits. The key schedule (hash
+// state after the inner and outer pad blocks) is computed once, so a frame
+// costs two context copies, its own blocks and one more
+#define FRAME_MAC_TRAILER 42         // ,"mac":" + 32 hex digits + "}
+#define FRAME_MAC_BYTES 16
+#define FRAME_MAX_AGE 30000          // First numbered frame since boot and unnumbered frames, by server timestamp
+
+String frameKey = "";
+bool frameKeyReady = false;
+mbedtls_md_context_t frameMacInner;  // After the key XOR ipad block
+mbedtls_md_context_t frameMacOuter;  // After the key XOR opad block
+mbedtls_md_context_t frameMacWork;
+unsigned long frameMacVerified = 0;
+unsigned long frameMacRejected = 0;  // Missing or wrong MAC
+unsigned long frameReplays = 0;
+unsigned long frameMacLastUs = 0;
+unsigned long frameMacMaxUs = 0;
+
+// Fleet provisioning. The server multicasts (and broadcasts on the discovery
+// port) tables of per-MAC config rows; frames without this device's MAC are
+// skipped inside the pbuf. The row is applied without a restart and
+// acknowledged to the sender, again for each repeat of the same id, which
+// the server sends until every device has answered
+char provisionNeedle[24] = "";       // "AA:BB:CC:DD:EE:FF":
+uint32_t provisionEpoch = 0;         // Kept in Preferences, so a reboot does not reopen replays
+uint32_t provisionId = 0;            // Last applied
+String provisionChanged = "";        // Fields it changed, repeated in every ack
+unsigned long provisionsApplied = 0;
+unsigned long provisionRepeats = 0;
+unsigned long provisionRejected = 0;
+
+// Scene-graph tally. The device holds the part of OBS's scene graph that can
+// reach its source, as edges from a scene or group to one of its items, and
+// applies the small ops the server broadcasts to all devices (cut, item
+// enabled, added, removed). Ops are numbered; a gap means a reload
+#define SCENE_GRAPH_MAX_EDGES 32
+#define SCENE_GRAPH_MAX_DEPTH 8      // Nested scenes and groups followed
+#define SCENE_GRAPH_RETRY 2000       // Between failed snapshot requests
+#define SCENE_GRAPH_HELD_OPS 4       // Ops kept while a snapshot is in flight
+
+struct SceneEdge {
+    String parent;                     // Scene or group
+    int id;                            // Scene item id within parent
+    String child;                      // Source, scene or group the item shows
+    bool enabled;
+};
+
+SceneEdge sceneEdges[SCENE_GRAPH_MAX_EDGES];
+int sceneEdgeCount = 0;
+bool sceneGraphNegotiated = false;
+bool sceneGraphValid = false;
+bool sceneGraphSyncPending = false;
+unsigned long sceneGraphRetryAt = 0;
+uint32_t sceneGraphGeneration = 0;   // Bumped by each sync request; older snapshots are dropped
+uint32_t sceneGraphFetchGeneration = 0;
+volatile bool sceneGraphFetchPending = false;  // Snapshot request queued or running in the lookup task
+volatile bool sceneGraphFetchDone = false;     // Response published, not yet applied
+String sceneGraphFetchUrl = "";      // Written by the loop only while no request is pending
+String sceneGraphFetchBody = "";     // Written by the lookup task only while one is
+int sceneGraphFetchCode = 0;
+JsonDocument sceneGraphHeld[SCENE_GRAPH_HELD_OPS];
+int sceneGraphHeldCount = 0;
+String sceneGraphSource = "";
+String sceneGraphProgram = "";
+String sceneGraphPreview = "";
+uint32_t sceneGraphEpoch = 0;
+uint32_t sceneGraphSeq = 0;
+unsigned long sceneGraphLoads = 0;
+unsigned long sceneGraphEvents = 0;
+unsigned long sceneGraphResyncs = 0;
+unsigned long sceneGraphLastApplyUs = 0;  // Op receipt to display for the last tally change
+
+// Resolver cache shared by all outbound connections
+#define RESOLVER_CACHE_SIZE 4
+#define RESOLVER_TTL 300000          // Answers are trusted for 5 minutes
+#define RESOLVER_NEGATIVE_TTL 30000  // Failed lookups are not repeated for 30 seconds
+#define RESOLVER_REFRESH_AHEAD 60000 // Refresh in the background this long before expiry
+#define RESOLVER_REFRESH_INTERVAL 5000 // At most one background lookup per interval
+#define RESOLVER_IDLE_DROP 900000    // Forget hosts nobody asked for in 15 minutes
+#define RESOLVER_MDNS_TIMEOUT 500
+
+struct ResolverEntry {
+    char host[64];
+    IPAddress ip;
+    bool positive;                   // false: cached lookup failure
+    unsigned long expiresAt;
+    unsigned long refreshAt;
+    unsigned long lastUsed;
+};
+
+ResolverEntry resolverCache[RESOLVER_CACHE_SIZE];
+int resolverCount = 0;
+unsigned long lastResolverRefresh = 0;
+unsigned long resolverHits = 0;
+unsigned long resolverStaleHits = 0;
+unsigned long resolverNegativeHits = 0;
+unsigned long resolverMisses = 0;
+unsigned long resolverRefreshes = 0;
+unsigned long resolverFailures = 0;
+unsigned long lastLookupDuration = 0;
+
+// Refresh handed to the lookup task; guarded by lookupLock
+struct ResolverRefresh {
+    char host[64];
+    IPAddress ip;
+    bool found;
+};
+
+ResolverRefresh resolverRefresh;
+volatile bool resolverRefreshPending = false;  // Queued or running in the lookup task
+bool resolverRefreshDone = false;              // Result waiting to be applied by the loop
+
+// Preformatted heartbeat / registration requests
+#define HB_REQUEST_SIZE 768
+#define HB_BODY_SIZE 512
+#define HB_RESPONSE_SIZE 512
+#define HB_STATUS_SLOT 12            // Quoted status plus padding ("PREVIEW" fits)
+#define HB_UPTIME_SLOT 10            // Any unsigned long
+#define HB_SIGNAL_SLOT 3             // Signal quality 0-100
+#define HB_CONNECT_TIMEOUT 3000
+#define HB_STALE_SOCKET -4           // Internal: reused socket died before the response
+
+WiFiClient hbClient;                 // Reused while the server keeps the connection open
+char hbRequest[HB_REQUEST_SIZE];
+size_t hbRequestLength = 0;
+size_t hbStatusOffset = 0;
+size_t hbUptimeOffset = 0;
+size_t hbSignalOffset = 0;
+char registerRequest[HB_REQUEST_SIZE];
+size_t registerRequestLength = 0;
+char hbResponse[HB_RESPONSE_SIZE];
+IPAddress hbServerIP;
+uint16_t hbServerPort = 0;
+char hbServerHost[64] = "";
+bool hbTemplatesValid = false;
+String hbBuiltURL = "";              // Field values the templates were rendered from
+IPAddress hbBuiltIP;
+String hbBuiltName = "";
+String hbBuiltSource = "";
+unsigned long hbTemplateBuilds = 0;
+unsigned long hbConnections = 0;
+unsigned long hbReusedConnections = 0;
+unsigned long hbAllocs = 0;          // Heap allocations made by the last heartbeat
+unsigned long hbStaleRetries = 0;    // Requests resent after a kept-alive socket went stale
 
 // Status tracking
 unsigned long lastHeartbeatTime = 0;
@@ -171,7 +727,199 @@ unsigned long displayUpdates = 0;
 
 // WiFi signal tracking
 int wifiSignalStrength = -100;
-String lastHeartbeat = "Never";
+char lastHeartbeat[32] = "Never";
+
+// WiFi roaming
+#define ROAM_RSSI_THRESHOLD -72      // Start background scans below this RSSI (dBm)
+#define ROAM_RSSI_HYSTERESIS 8       // Candidate must beat the current AP by this margin (dB)
+#define ROAM_SCAN_INTERVAL 15000     // Time between single-channel background scan steps
+#define ROAM_SCAN_DWELL_MS 120       // Off-channel dwell time per scan step
+#define ROAM_CANDIDATE_TTL 120000    // Forget candidates not seen for 2 minutes
+#define ROAM_CONNECT_TIMEOUT 8000    // Abandon a roam attempt after 8 seconds
+#define MAX_ROAM_CANDIDATES 4
+#define MAX_ROAM_CHANNELS 8
+
+struct RoamCandidate {
+    uint8_t bssid[6];
+    int32_t channel;
+    int32_t rssi;
+    unsigned long lastSeen;
+};
+
+RoamCandidate roamCandidates[MAX_ROAM_CANDIDATES];
+int roamCandidateCount = 0;
+uint8_t roamChannels[MAX_ROAM_CHANNELS];
+int roamChannelCount = 0;
+int roamChannelIndex = 0;
+bool roamScanRunning = false;
+bool roamInProgress = false;
+unsigned long lastRoamScan = 0;
+unsigned long roamStartTime = 0;
+unsigned long roamScans = 0;
+unsigned long roamCount = 0;
+unsigned long failedRoams = 0;
+unsigned long lastRoamDuration = 0;
+
+// WiFi reconnect state machine
+#define RECONNECT_FAST_INTERVAL 500      // Fast retries right after the link drops
+#define RECONNECT_FAST_ATTEMPTS 4
+#define RECONNECT_BACKOFF_MIN 1000       // Backoff starts here and doubles per attempt
+#define RECONNECT_BACKOFF_MAX 16000
+#define RECONNECT_BACKOFF_ATTEMPTS 5     // Backoff attempts before a full rescan
+#define RECONNECT_JITTER 250             // Random spread added to each backoff wait
+#define RECONNECT_RESCAN_TIMEOUT 15000   // Time allowed for a full scan + associate
+
+enum ReconnectState {
+    RECONNECT_IDLE,
+    RECONNECT_FAST,
+    RECONNECT_BACKOFF,
+    RECONNECT_RESCAN
+};
+
+ReconnectState reconnectState = RECONNECT_IDLE;
+int reconnectAttempts = 0;
+unsigned long reconnectBackoff = RECONNECT_BACKOFF_MIN;   // Unjittered base, doubles per attempt
+unsigned long reconnectDelay = RECONNECT_BACKOFF_MIN;     // Base plus jitter for the next wait
+unsigned long lastReconnectAttempt = 0;
+unsigned long wifiLostTime = 0;
+unsigned long linkRestoredTime = 0;
+bool tallyStale = false;             // Last tally frame is kept on screen but may be outdated
+bool awaitingTally = false;          // Waiting for the first tally state after a reconnect
+unsigned long reconnectCount = 0;
+unsigned long lastOutageDuration = 0;
+unsigned long lastReconnectToTally = 0;
+unsigned long sessionResumes = 0;
+unsigned long fullReregistrations = 0;
+
+// Non-blocking configuration portal. While it is open the loop keeps running,
+// background scans fill a cache served to the portal page, and the saved
+// network is joined as soon as a scan sees it again
+#define PORTAL_SCAN_INTERVAL 10000    // Background scan period while the portal is up
+#define PORTAL_CONNECT_TIMEOUT 10000  // Time allowed to associate once the saved network is seen
+#define PORTAL_BLIND_RETRY 60000      // Hidden networks never show in a scan: try the saved one this often
+#define PORTAL_MAX_NETWORKS 16
+
+struct PortalNetwork {
+    char ssid[33];
+    int8_t rssi;
+    uint8_t channel;
+    bool open;
+};
+
+PortalNetwork portalNetworks[PORTAL_MAX_NETWORKS];
+int portalNetworkCount = 0;
+bool portalScanRunning = false;
+bool portalConnecting = false;
+String portalApName = "";
+String portalSavedSsid = "";
+unsigned long portalStartTime = 0;
+unsigned long portalLastScan = 0;
+unsigned long portalLastBlind = 0;
+unsigned long portalConnectStart = 0;
+unsigned long portalApSeenTime = 0;  // Saved network seen again (or blind attempt started)
+unsigned long portalScans = 0;
+unsigned long lastPortalApToLink = 0;
+unsigned long lastPortalApToTally = 0;
+
+// Live dashboard. The page is a static asset; state arrives over /events as
+// one full snapshot per client followed by changed fields only
+#define DASHBOARD_MAX_CLIENTS 4
+#define DASHBOARD_EVENT_INTERVAL 500   // Coalesce changes into at most one event per interval
+#define DASHBOARD_KEEPALIVE 15000      // Comment line so dead clients are noticed and dropped
+#define DASHBOARD_ETAG "\"dash-" FIRMWARE_VERSION " " BUILD_DATE "\""
+
+WiFiClient dashboardClients[DASHBOARD_MAX_CLIENTS];
+JsonDocument dashboardSent;          // State as last sent to every connected client
+unsigned long lastDashboardEvent = 0;
+unsigned long lastDashboardKeepalive = 0;
+unsigned long dashboardEvents = 0;
+unsigned long dashboardEventBytes = 0;
+unsigned long dashboardDrops = 0;        // Clients dropped because their socket was full
+
+// Versioned snapshots of the JSON status endpoints. An endpoint's version
+// moves when the hash of its document, less the free-running fields in
+// snapshotVolatileKeys, changes; its copy re-serialises only when the
+// version moved or is older than SNAPSHOT_MAX_AGE (those fields keep
+// ticking), and If-None-Match on the version's weak ETag is answered with 304
+#define SNAPSHOT_MAX_AGE 10000
+
+enum SnapshotEndpoint {
+    SNAPSHOT_DEVICE_INFO,
+    SNAPSHOT_FIRMWARE_INFO,
+    SNAPSHOT_STATUS,
+    SNAPSHOT_COUNT
+};
+
+struct StatusSnapshot {
+    String body;
+    uint32_t fingerprint;
+    uint32_t version;                  // stateVersion when the fingerprint last changed
+    uint32_t bodyVersion;
+    unsigned long builtAt;
+};
+
+// Keys left out of the fingerprint, anywhere or as "parent/key": clocks,
+// signal readings and counters that tick while idle. Everything else counts,
+// so a field added to a builder moves the ETag without further changes
+const char* const snapshotVolatileKeys[] = {
+    "uptime", "wifi/rssi", "tx_power/rssi_avg", "age_ms", "levels", "dashboard",
+    "heartbeat_client", "resolver", "snapshot", "discovery/udp_received",
+    "discovery/udp_dropped", "discovery/udp_duplicates", "discovery/udp_replies",
+    "discovery/announcements", "discovery/announcements_suppressed",
+    "udp_ingest/frames_received", "udp_ingest/frames_rejected", "udp_ingest/max_burst"
+};
+
+// Feeds serializeJson output straight into the fingerprint hash
+struct SnapshotHash : public Print {
+    uint32_t hash = 2166136261u;
+    size_t write(uint8_t b) override;
+    size_t write(const uint8_t* data, size_t length) override;
+};
+
+StatusSnapshot snapshots[SNAPSHOT_COUNT];
+uint32_t stateVersion = 1;
+uint32_t snapshotBootId = 0;         // Keeps ETags from one boot from matching the next
+unsigned long snapshotBuilds = 0;
+unsigned long snapshotHits = 0;
+unsigned long snapshotNotModified = 0;
+
+// Adds the cached scan to the SSID field of the no-scan WiFi page
+const char portalHeadScript[] = "<script>addEventListener('load',function(){var s=document.getElementById('s');"
+    "if(!s)return;fetch('/networks.json').then(function(r){return r.json()}).then(function(j){"
+    "var d=document.createElement('datalist');d.id='nets';j.networks.forEach(function(n){"
+    "var o=document.createElement('option');o.value=n.ssid;o.label=n.rssi+' dBm'+(n.open?', open':'');d.appendChild(o)});"
+    "s.setAttribute('list','nets');s.parentNode.appendChild(d)})})</script>";
+
+// Adaptive TX power
+#define TXPOWER_INTERVAL 10000        // Controller tick
+#define TXPOWER_DWELL 30000           // Minimum time at a level before stepping down
+#define TXPOWER_RSSI_LOW -70          // Step up below this smoothed RSSI (dBm)
+#define TXPOWER_RSSI_HIGH -55         // Step down above this smoothed RSSI (dBm)
+#define TXPOWER_CLEAN_TICKS 3         // Loss-free ticks required before stepping down
+#define TXPOWER_LEVEL_COUNT 7
+#define TXPOWER_MAX_LEVEL 4           // 15 dBm - higher levels risk brownout on battery
+#define TXPOWER_LOW_BATTERY_MAX 2     // 11 dBm ceiling in low battery mode
+#define TXPOWER_LIVE_FLOOR 2          // Never below 11 dBm while on air
+#define TXPOWER_DEFAULT_LEVEL 2       // Previous fixed 11 dBm setting
+
+const wifi_power_t txPowerLevels[TXPOWER_LEVEL_COUNT] = {
+    WIFI_POWER_5dBm, WIFI_POWER_8_5dBm, WIFI_POWER_11dBm, WIFI_POWER_13dBm,
+    WIFI_POWER_15dBm, WIFI_POWER_17dBm, WIFI_POWER_19_5dBm
+};
+const float txPowerDbm[TXPOWER_LEVEL_COUNT] = {5, 8.5, 11, 13, 15, 17, 19.5};
+
+int txPowerLevel = TXPOWER_DEFAULT_LEVEL;
+float rssiEwma = 0;
+int txPowerCleanTicks = 0;
+unsigned long lastTxPowerTick = 0;
+unsigned long lastTxPowerChange = 0;
+unsigned long txPowerChanges = 0;
+unsigned long txPowerLastHeartbeats = 0;   // Counter snapshots for per-tick deltas
+unsigned long txPowerLastFailures = 0;
+unsigned long txPowerLastRetries = 0;
+unsigned long txLevelHeartbeats[TXPOWER_LEVEL_COUNT] = {0};
+unsigned long txLevelFailures[TXPOWER_LEVEL_COUNT] = {0};
+unsigned long txLevelTime[TXPOWER_LEVEL_COUNT] = {0};
 
 // Power management variables
 bool powerSaveMode = false;
@@ -220,16 +968,36 @@ unsigned long lastDisplayUpdate = 0;
 // Function declarations
 void setupDisplay();
 void setupWiFi();
+void completeWiFiSetup();
+void startNetworkServices();
+void updatePortal();
+void cachePortalScan(int16_t found);
+void leavePortal();
+void drawPortalScreen();
+void drawPortalStatus();
+void handlePortalNetworks();
 void setupWebServer();
 void setupMDNS();
 void setupOTA();
 void handleRoot();
+void handleEvents();
+void fillDashboardState(JsonDocument& doc);
+void publishDashboard();
+void handleDashboardEvents();
+bool sendDashboardEvent(WiFiClient& client, const char* data, size_t length);
 void handleConfig();
 void handleConfigPost();
 void handleUpdate();
 void handleUpdateResponse();
 void handleUpdateFile();
 void handleStatus();
+void buildStatus(JsonDocument& doc);
+void buildDeviceInfo(JsonDocument& doc);
+void buildFirmwareInfo(JsonDocument& doc);
+uint32_t fnv1a(uint32_t hash, const void* data, size_t length);
+bool snapshotVolatile(const char* parent, const char* key);
+void hashSnapshotFields(JsonVariant value, const char* parent, SnapshotHash& out);
+void sendSnapshot(SnapshotEndpoint endpoint, void (*build)(JsonDocument&));
 void updateDisplay();
 void setBrightness(uint8_t brightness);
 void drawWiFiAndBattery(int32_t wifiSignal, int batteryPercent);
@@ -238,6 +1006,96 @@ void checkServer();
 void announceDevice();
 void sendHeartbeat();
 void registerDevice();
+int applyTallyUpdate(const String& body, String& reply, uint8_t path);
+bool acceptTallySequence(uint32_t epoch, uint32_t seq, bool redundant, uint8_t path);
+void handleSubscription();
+bool armSubscription();
+void finishSubscription(bool rearm);
+void handleMqtt();
+bool connectMqtt();
+void mqttCallback(char* topic, uint8_t* payload, unsigned int length);
+void mqttDeviceTopic(const char* kind, char* topic, size_t size);
+void mqttSourceTopic(const String& source, char* topic, size_t size);
+void publishMqttPresence(bool online);
+void publishMqttTelemetry();
+const String& activeMqttBroker();
+void applyNegotiation(const char* response);
+uint64_t serverNowMs();
+void startBenchmark(uint32_t run, uint32_t count);
+void recordBenchmarkProbe(JsonDocument& probe);
+void benchmarkResults(JsonDocument& doc);
+void handleBenchmark();
+bool syncServerClock();
+bool obsTallyActive();
+void handleObsDirect();
+bool connectObs();
+void readObsUpgrade();
+void closeObs(const char* reason);
+bool readObsFrame();
+bool obsReadExact(uint8_t* buffer, size_t length);
+bool skipObsPayload(uint64_t length);
+bool streamObsMessage(uint64_t length);
+bool sendObsFrame(uint8_t opcode, const uint8_t* payload, size_t length);
+bool sendObsJson(JsonDocument& doc);
+void sendObsRequest(const char* type, const char* id, const char* sceneName);
+void sendObsIdentify(JsonObject auth);
+void obsAuthHash(const char* first, const char* second, char* out);
+JsonDocument& obsMessageFilter();
+void handleObsMessage(JsonDocument& doc);
+void handleObsEvent(const char* type, JsonObject data);
+void handleObsResponse(JsonObject data);
+void requestObsSceneItems(bool program);
+void requestObsNestedItems(int side, const char* scene, bool group, int depth);
+bool obsWalkVisited(int side, const char* scene);
+void applyObsTally();
+void applyObsOutput(bool recording, bool active);
+bool showTally(bool program, bool preview);
+bool applyLocalTally(uint8_t feed, bool program, bool preview);
+bool deviceTallyActive();
+void recordFeed(uint8_t feed, bool active, bool program, bool preview);
+void dropFeed(uint8_t feed);
+bool showMergedTally();
+uint8_t firstActiveFeed();
+bool feedContributes(uint8_t feed);
+void mergeServerStatus(const char* status);
+void parseFeedPriority();
+void resetFeeds();
+void setupFrameKey();
+void frameMac(const uint8_t* data, size_t length, const char* suffix, uint8_t* digest);
+bool verifyFrameMac(const char* body, size_t length);
+bool frameFresh(JsonDocument& doc);
+void handleTsl();
+void feedTslByte(uint8_t b);
+void applyTslTally(uint8_t tally, uint32_t receivedUs);
+void handleSceneGraph();
+void requestSceneGraphSync(const char* reason);
+void queueSceneGraphFetch();
+void fetchSceneGraph();
+bool applySceneGraphFetch();
+void handleSceneEvent(const char* body);
+void applySceneOp(JsonDocument& doc, unsigned long receivedUs);
+void applySceneGraphTally(unsigned long receivedUs);
+void setupPushServer();
+void setSocketDscp(WiFiClient& client, uint8_t dscp);
+void handlePushServer();
+bool pushClientConnected();
+void handlePushRequest(PushConnection& conn);
+bool resolveHost(const char* host, IPAddress& ip);
+bool lookupHost(const char* host, IPAddress& ip);
+void updateResolverCache();
+void refreshResolverEntry();
+void applyResolverRefresh();
+void expediteResolve(const char* host);
+String resolvedURL(const String& url);
+bool refreshRequestTemplates();
+bool buildRequestTemplates();
+void patchSlot(char* buffer, size_t offset, size_t width, const char* value, bool quoted);
+int httpTransact(const char* request, size_t length);
+static int httpExchange(const char* request, size_t length, bool reused);
+const char* httpTransactError(int code);
+const char* jsonFindValue(const char* json, const char* key);
+bool jsonFindString(const char* json, const char* key, char* out, size_t outSize);
+bool jsonFindBool(const char* json, const char* key, bool& out);
 bool loadConfig();
 void saveConfig();
 void factoryReset();
@@ -254,9 +1112,38 @@ void updateWiFiSignalStrength();
 void checkServerConnection();
 void setupDiscovery();
 void handleDiscoveryRequest();
+void processDiscoveryFrame(const UdpFrame& frame);
+bool setupUdpIngest(uint16_t port);
+bool udpIngestSend(uint32_t addr, uint16_t port, const uint8_t* data, size_t length);
+void handleUdpTally();
+void handleFleetProvision(const char* body, uint32_t addr, uint16_t port);
+bool applyProvisionRow(JsonObject row);
+void saveProvisionState();
+bool refreshAnnouncement();
+void sendDiscoveryReply();
 void fetchCurrentTallyState();
 void performHealthCheck();
 
+// WiFi roaming functions
+void setupRoaming();
+void updateRoaming();
+void collectRoamCandidates(int16_t found);
+void startRoam(const RoamCandidate& candidate);
+void clearBssidLock();
+void beginReconnect();
+void updateReconnect();
+void resumeSession();
+void markTallyFresh();
+const char* reconnectStateName();
+void setupTxPower();
+void setupLookupTask();
+void lookupTask(void* param);
+int browseServers();
+void requestServerBrowse();
+bool discoverServer();
+void updateTxPower();
+void setTxPowerLevel(int level, const char* reason);
+
 // Power management functions
 void initPowerManagement();
 void updatePowerState();
@@ -331,6 +1218,7 @@ void setup() {
     
     // Initialize essential variables
     bootTime = millis();
+    snapshotBootId = esp_random();
     macAddress = WiFi.macAddress();
     deviceID = "tally-" + String((uint32_t)ESP.getEfuseMac());
     ipAddress = "0.0.0.0";
@@ -425,52 +1313,13 @@ void setup() {
     M5.Lcd.println("WiFi Setup");
     setupWiFi();
     
-    // Only continue with other services if WiFi is connected
+    // Only continue with other services if WiFi is connected (with the
+    // portal open they start once it joins)
     if (WiFi.status() == WL_CONNECTED) {
-        setupWebServer();
-        setupMDNS();
-        setupOTA();
-        
-        // Setup UDP for device discovery
-        udp.begin(UDP_PORT);
-        
-        // Setup time client
-        timeClient.begin();
-        timeClient.setUpdateInterval(3600000); // Update every hour
-        ntpInitialized = true; // Set flag to indicate NTP is initialized
-        
-        // If we have server configuration, automatically register and start communication
-        // Check if we have server IP and port (serverURL should be constructed by setupWiFi)
-        if (serverIP.length() > 0 && serverPort > 0 && serverURL.length() > 0) {
-            Serial.printf("[INIT] Starting automatic server communication to %s...\n", serverURL.c_str());
-            
-            // Show connecting status
-            M5.Lcd.fillScreen(TFT_BLACK);
-            M5.Lcd.setTextColor(TFT_CYAN);
-            M5.Lcd.setTextSize(2);
-            M5.Lcd.setCursor(10, 30);
-            M5.Lcd.println("Registering");
-            M5.Lcd.setCursor(10, 50);
-            M5.Lcd.println("Device...");
-            
-            // Small delay to ensure network stack is ready
-            delay(1000);
-            
-            // Attempt device registration
-            registerDevice();
-            
-            // Start immediate heartbeat and tally state fetch
-            sendHeartbeat();
-            fetchCurrentTallyState();
-            
-            // Brief delay to show registration attempt
-            delay(2000);
-            
-            Serial.println("[INIT] Automatic server communication initiated");
-        } else {
-            Serial.printf("[INIT] No server configuration - serverIP='%s', serverPort=%d, serverURL='%s'\n", 
-                         serverIP.c_str(), serverPort, serverURL.c_str());
-        }
+        startNetworkServices();
+        
+        // Brief delay to show registration attempt
+        if (serverURL.length() > 0) delay(2000);
     }
     
     // Initialize power management
@@ -557,60 +1406,51 @@ void loop() {
     }
     
     if (configMode) {
-        // In configuration mode, just handle basic functions
-        static unsigned long lastBlink = 0;
-        if (millis() - lastBlink > 1000) {
-            static bool blinkState = false;
-            blinkState = !blinkState;
-            
-            M5.Lcd.setTextColor(blinkState ? TFT_YELLOW : TFT_BLACK);
-            M5.Lcd.setCursor(10, 80);
-            M5.Lcd.println("Config Mode");
-            
-            lastBlink = millis();
-        }
-        
-        // Keep WiFi running
-        if (WiFi.status() == WL_CONNECTED) {
-            configMode = false;
-            setup(); // Re-run setup to initialize all services
-        }
-        
-        delay(100);
+        // Portal and background join of the saved network; services start
+        // in place once it links, without re-running setup() or rebooting
+        updatePortal();
+        delay(10);
         return;
     }
     
     // Normal operation mode
-    static unsigned long lastWifiCheck = 0;
-    static bool wasDisconnected = false;
     
-    if (WiFi.status() != WL_CONNECTED) {
-        wasDisconnected = true;
-        isRegistered = false; // Clear registration when WiFi is lost
-        serverConnected = false;
-        
-        if (millis() - lastWifiCheck > 5000) {
-            M5.Lcd.fillScreen(TFT_BLACK);
-            M5.Lcd.setTextColor(TFT_RED);
-            M5.Lcd.setCursor(10, 20);
-            M5.Lcd.println("WiFi Lost");
-            M5.Lcd.setCursor(10, 40);
-            M5.Lcd.println("Reconnecting");
-            
-            WiFi.reconnect();
-            lastWifiCheck = millis();
+    // Background roaming - a roam in progress is an expected, short disconnect
+    updateRoaming();
+    
+    if (WiFi.status() != WL_CONNECTED && !roamInProgress) {
+        if (reconnectState == RECONNECT_IDLE) {
+            Serial.println("[WIFI] Connection lost, holding last tally frame");
+            serverConnected = false;
+            beginReconnect();
+            updateDisplay(); // Redraw the last frame with the stale badge
         }
+        updateReconnect();
         delay(100);
         return;
     }
     
-    // WiFi connection restored - re-register device
-    if (wasDisconnected) {
-        wasDisconnected = false;
-        isRegistered = false; // Force re-registration
-        Serial.println("WiFi connection restored, will re-register device");
-        // After WiFi reconnect, fetch current tally state
-        fetchCurrentTallyState();
+    // WiFi connection restored - resume the server session
+    if (reconnectState != RECONNECT_IDLE) {
+        reconnectState = RECONNECT_IDLE;
+        linkRestoredTime = millis();
+        lastOutageDuration = linkRestoredTime - wifiLostTime;
+        reconnectCount++;
+        awaitingTally = true;
+        ipAddress = WiFi.localIP().toString();
+        Serial.printf("[WIFI] Link restored after %lu ms, resuming session\n", lastOutageDuration);
+        resumeSession();
+    }
+    
+    // Adapt TX power to link quality
+    updateTxPower();
+    
+    // Keep cached server addresses fresh ahead of expiry
+    updateResolverCache();
+    
+    // No server configured yet - keep browsing for one (rate limited by discoverServer)
+    if (serverIP.length() == 0 && discoverServer()) {
+        registerDevice();
     }
     
     // Fallback registration check - if device has been running for more than 60 seconds
@@ -624,6 +1464,9 @@ void loop() {
         
         Serial.println("[FALLBACK] Device not registered after 60s, attempting registration...");
         
+        // The configured server may have moved - prefer one advertised via mDNS
+        discoverServer();
+        
         // Ensure serverURL is constructed
         if (serverURL.length() == 0) {
             serverURL = "http://" + serverIP + ":" + String(serverPort);
@@ -647,6 +1490,10 @@ void loop() {
         Serial.println("[LOOP] WARNING: webServer.handleClient() failed - continuing");
     }
     
+    // Tally pushes on the persistent connection
+    handlePushServer();
+    handleDashboardEvents();
+    
     try {
         timeClient.update();
     } catch (...) {
@@ -659,6 +1506,19 @@ void loop() {
         Serial.printf("[LOOP] Heartbeat trigger: lastTime=%lu, now=%lu, interval=%lu\n", 
                      lastHeartbeatTime, millis(), heartbeatInterval);
         sendHeartbeat();
+        
+        // Server unreachable: follow it if it moved
+        if (!serverConnected && discoverServer()) {
+            registerDevice();
+        }
+    }
+    
+    // A background browse finished while the server was missing or unreachable
+    if (mdnsBrowseDone) {
+        mdnsBrowseDone = false;
+        if ((serverIP.length() == 0 || !serverConnected || !isRegistered) && discoverServer()) {
+            registerDevice();
+        }
     }
     
     // Announce device presence (reduce frequency in power save mode)
@@ -667,6 +1527,18 @@ void loop() {
         announceDevice();
     }
     
+    // Answer discovery requests (unicast, randomized delay)
+    handleDiscoveryRequest();
+    handleUdpTally();
+    
+    // Device-initiated tally updates
+    handleSubscription();
+    handleMqtt();
+    handleObsDirect();
+    handleTsl();
+    handleSceneGraph();
+    handleBenchmark();
+    
     // Perform health check periodically (similar to ESP32-1732S019)
     static unsigned long lastHealthCheck = 0;
     if (millis() - lastHealthCheck > HEALTH_CHECK_INTERVAL) {
@@ -683,13 +1555,15 @@ void loop() {
     static bool lastStreaming = isStreaming;
     static bool lastRecording = isRecording;
     static bool lastServerConnected = serverConnected;
+    static bool lastStale = tallyStale;
     
     // Check if any status has changed
     bool stateChanged = (lastPreview != isPreview ||
                         lastProgram != isProgram ||
                         lastStreaming != isStreaming ||
                         lastRecording != isRecording ||
-                        lastServerConnected != serverConnected);
+                        lastServerConnected != serverConnected ||
+                        lastStale != tallyStale);
 
     // Only draw the screen when the state has actually changed
     if (stateChanged) {
@@ -704,6 +1578,7 @@ void loop() {
         lastStreaming = isStreaming;
         lastRecording = isRecording;
         lastServerConnected = serverConnected;
+        lastStale = tallyStale;
 
         // Only log when there was an actual state change, not just a periodic redraw
         if (stateChanged) {
@@ -750,7 +1625,13 @@ void loop() {
     
     // Small delay to prevent tight loop (adjust based on power save mode)
     // Increased delays to reduce CPU usage and prevent watchdog timeouts
-    delay(powerSaveMode ? 1000 : 750); // Longer delays for stability
+    // Sleep on the ingest notification so queued UDP frames end the wait early
+    // Held subscriptions, push connections, MQTT, OBS and TSL TCP sessions are polled often so updates are applied promptly
+    unsigned long loopWait = powerSaveMode ? 1000 : 750;
+    if (subArmed || pushClientConnected() || mqttClient.connected() || obsIdentified || tslClient.connected()) {
+        loopWait = SUBSCRIBE_POLL_WAIT;
+    }
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(loopWait)); // Longer delays for stability
     
     // Additional yield to prevent watchdog resets
     yield();
@@ -887,6 +1768,15 @@ void updateDisplay() {
         }
     }
     
+    // Stale badge (top left) while the last tally frame is held during a reconnect
+    if (tallyStale) {
+        M5.Lcd.fillRect(2, 2, 34, 11, TFT_YELLOW);
+        M5.Lcd.setTextSize(1);
+        M5.Lcd.setTextColor(TFT_BLACK);
+        M5.Lcd.setCursor(4, 4);
+        M5.Lcd.print("STALE");
+    }
+    
     // Draw WiFi and battery indicators at the bottom
     drawWiFiAndBattery(wifiSignal, batteryPercent);
 }
@@ -1013,12 +1903,30 @@ bool loadConfig() {
     
     serverIP = preferences.getString("server_ip", "");
     serverPort = preferences.getUInt("server_port", 3005);
+    serverManual = preferences.getBool("server_manual", serverIP.length() > 0);
     deviceName = preferences.getString("device_name", "");
     assignedSource = preferences.getString("assigned_source", "");
     hostname = preferences.getString("hostname", DEFAULT_HOSTNAME);
     ledManuallyDisabled = preferences.getBool("led_disabled", false); // Load LED preference, default to enabled
+    subscribeMode = preferences.getBool("subscribe", false);
+    mqttBroker = preferences.getString("mqtt_broker", "");
+    mqttPort = preferences.getUShort("mqtt_port", MQTT_DEFAULT_PORT);
+    mqttQos = preferences.getUChar("mqtt_qos", 1);
+    tallyMode = preferences.getString("tally_mode", TALLY_MODE_SERVER);
+    obsHost = preferences.getString("obs_host", "");
+    obsPort = preferences.getUShort("obs_port", OBS_DEFAULT_PORT);
+    obsPassword = preferences.getString("obs_password", "");
+    tslPort = preferences.getUShort("tsl_port", TSL_DEFAULT_PORT);
+    tslIndex = preferences.getUShort("tsl_index", 0);
+    mergeRule = preferences.getString("merge_rule", MERGE_RULE_ANY);
+    feedPriority = preferences.getString("feed_priority", feedPriority);
+    frameKey = preferences.getString("frame_key", "");
+    provisionEpoch = preferences.getUInt("provision_epoch", 0);
+    provisionId = preferences.getUInt("provision_id", 0);
     
     preferences.end();
+    parseFeedPriority();
+    setupFrameKey();
     return true;
 }
 
@@ -1028,10 +1936,24 @@ void saveConfig() {
     preferences.putString("version", CONFIG_VERSION);
     preferences.putString("server_ip", serverIP);
     preferences.putUInt("server_port", serverPort);
+    preferences.putBool("server_manual", serverManual);
     preferences.putString("device_name", deviceName);
     preferences.putString("assigned_source", assignedSource);
     preferences.putString("hostname", hostname);
     preferences.putBool("led_disabled", ledManuallyDisabled); // Save LED preference
+    preferences.putBool("subscribe", subscribeMode);
+    preferences.putString("mqtt_broker", mqttBroker);
+    preferences.putUShort("mqtt_port", mqttPort);
+    preferences.putUChar("mqtt_qos", mqttQos);
+    preferences.putString("tally_mode", tallyMode);
+    preferences.putString("obs_host", obsHost);
+    preferences.putUShort("obs_port", obsPort);
+    preferences.putString("obs_password", obsPassword);
+    preferences.putUShort("tsl_port", tslPort);
+    preferences.putUShort("tsl_index", tslIndex);
+    preferences.putString("merge_rule", mergeRule);
+    preferences.putString("feed_priority", feedPriority);
+    preferences.putString("frame_key", frameKey);
     preferences.end();
 }
 
@@ -1067,14 +1989,21 @@ void setupWiFi() {
     WiFi.mode(WIFI_STA);
     WiFi.hostname(hostname);
 
-    WiFiManager wifiManager;
+    // The portal runs from loop(): the no-scan WiFi page is filled from the
+    // background scan cache instead of a blocking scan per page load
+    static const char* portalMenu[] = {"wifinoscan", "wifi", "info", "exit"};
+    wifiManager.setMenu(portalMenu, 4);
+    wifiManager.setCustomHeadElement(portalHeadScript);
+    wifiManager.setWebServerCallback([]() {
+        wifiManager.server->on("/networks.json", handlePortalNetworks);
+    });
+    wifiManager.setConfigPortalBlocking(false);
     wifiManager.setConfigPortalTimeout(CONFIG_PORTAL_TIMEOUT);
     
     // Reduce WiFi power to prevent brownout
     WiFi.setTxPower(WIFI_POWER_8_5dBm);
     
-    String apName = String("OBS-Tally-") + String((uint32_t)ESP.getEfuseMac(), HEX);
-    String apPassword = "obstally123"; // Simple password to prevent accidental connections
+    portalApName = String("OBS-Tally-") + String((uint32_t)ESP.getEfuseMac(), HEX);
     
     // Configure timeouts and retry behavior
     wifiManager.setConnectTimeout(20);
@@ -1085,22 +2014,29 @@ void setupWiFi() {
     M5.Lcd.setTextColor(TFT_WHITE);
     M5.Lcd.setCursor(10, 20);
     
-    if (!wifiManager.autoConnect(apName.c_str(), apPassword.c_str())) {
-        // If connection fails, show error but don't restart immediately
-        M5.Lcd.fillScreen(TFT_RED);
-        M5.Lcd.setTextColor(TFT_WHITE);
-        M5.Lcd.setCursor(10, 20);
-        M5.Lcd.println("WiFi Failed");
-        M5.Lcd.setCursor(10, 40);
-        M5.Lcd.println("AP Mode:");
-        M5.Lcd.setCursor(10, 60);
-        M5.Lcd.println(apName);
-        
-        // Stay in AP mode for configuration
+    if (!wifiManager.autoConnect(portalApName.c_str(), CONFIG_PORTAL_PASSWORD)) {
+        // Stay in AP mode for configuration; loop() runs the portal and
+        // keeps looking for the saved network
         configMode = true;
+        portalStartTime = millis();
+        portalLastScan = millis();
+        portalLastBlind = millis();
+        portalSavedSsid = wifiManager.getWiFiIsSaved() ? wifiManager.getWiFiSSID() : "";
+        Serial.printf("[PORTAL] Open as %s, waiting for %s\n", portalApName.c_str(),
+                      portalSavedSsid.length() ? portalSavedSsid.c_str() : "credentials");
+        drawPortalScreen();
         return;
     }
     
+    completeWiFiSetup();
+    delay(3000);
+}
+
+// Runs once the first link is up, from setupWiFi() or when the portal joins
+void completeWiFiSetup() {
+    // Reconnects are driven by updateReconnect() rather than the WiFi driver
+    WiFi.setAutoReconnect(false);
+    
     // Successfully connected
     M5.Lcd.fillScreen(TFT_GREEN);
     M5.Lcd.setTextColor(TFT_BLACK);
@@ -1133,12 +2069,72 @@ void setupWiFi() {
         M5.Lcd.setTextColor(TFT_ORANGE);
         M5.Lcd.println("No server config");
     }
+}
+
+void startNetworkServices() {
+    setupWebServer();
+    setupMDNS();
+    setupLookupTask();
+    setupOTA();
+    setupRoaming();
+    
+    // Setup UDP for device discovery. The port belongs to the ingest
+    // callback; the WiFiUDP socket only sends
+    setupUdpIngest(UDP_PORT);
+    udp.begin(0);
+    
+    // Setup time client
+    timeClient.begin();
+    timeClient.setUpdateInterval(3600000); // Update every hour
+    ntpInitialized = true; // Set flag to indicate NTP is initialized
+    
+    // Without a configured server, look one up via mDNS before giving up.
+    // Nothing is served yet, so the boot browse may block
+    if (serverIP.length() == 0) {
+        browseServers();
+        discoverServer();
+    }
     
-    delay(3000);
+    // If we have server configuration, automatically register and start communication
+    // Check if we have server IP and port (serverURL should be constructed by setupWiFi)
+    if (serverIP.length() > 0 && serverPort > 0 && serverURL.length() > 0) {
+        Serial.printf("[INIT] Starting automatic server communication to %s...\n", serverURL.c_str());
+        
+        // Show connecting status
+        M5.Lcd.fillScreen(TFT_BLACK);
+        M5.Lcd.setTextColor(TFT_CYAN);
+        M5.Lcd.setTextSize(2);
+        M5.Lcd.setCursor(10, 30);
+        M5.Lcd.println("Registering");
+        M5.Lcd.setCursor(10, 50);
+        M5.Lcd.println("Device...");
+        
+        // Small delay to ensure network stack is ready
+        delay(1000);
+        
+        // Attempt device registration, following the server via mDNS if it moved
+        registerDevice();
+        if (!isRegistered && discoverServer()) {
+            registerDevice();
+        }
+        
+        // Start immediate heartbeat and tally state fetch
+        sendHeartbeat();
+        fetchCurrentTallyState();
+        
+        Serial.println("[INIT] Automatic server communication initiated");
+    } else {
+        Serial.printf("[INIT] No server configuration - serverIP='%s', serverPort=%d, serverURL='%s'\n", 
+                     serverIP.c_str(), serverPort, serverURL.c_str());
+    }
 }
 
 void setupWebServer() {
+    const char* conditionalHeaders[] = {"If-None-Match"};
+    webServer.collectHeaders(conditionalHeaders, 1);
+    
     webServer.on("/", handleRoot);
+    webServer.on("/events", handleEvents);
     webServer.on("/config", HTTP_GET, handleConfig);
     webServer.on("/config", HTTP_POST, handleConfigPost);
     webServer.on("/update", HTTP_GET, handleUpdate);
@@ -1149,7 +2145,19 @@ void setupWebServer() {
         ESP.restart();
     });
     webServer.on("/api/reset", HTTP_POST, []() {
+        const String& body = webServer.arg("plain");
+        if (!verifyFrameMac(body.c_str(), body.length())) {
+            webServer.send(401, "application/json", "{\"error\":\"Bad MAC\"}");
+            return;
+        }
+        // The frame is the same every time, so its timestamp stops replays
         JsonDocument doc;
+        if (frameKeyReady && (deserializeJson(doc, body) || !frameFresh(doc))) {
+            frameReplays++;
+            webServer.send(409, "application/json", "{\"error\":\"Replayed frame\"}");
+            return;
+        }
+        doc.clear();
         doc["success"] = true;
         doc["message"] = "Device reset initiated";
         
@@ -1219,40 +2227,12 @@ void setupWebServer() {
     });
     
     webServer.on("/api/device-info", HTTP_GET, []() {
-        JsonDocument doc;
-        doc["device_type"] = DEVICE_MODEL;
-        doc["firmware_version"] = FIRMWARE_VERSION;
-        doc["device_name"] = deviceName;
-        doc["assigned_source"] = assignedSource;
-        doc["ip"] = WiFi.localIP().toString();
-        doc["mac"] = WiFi.macAddress();
-        doc["hostname"] = hostname;
-        doc["led_disabled"] = ledManuallyDisabled;
-        JsonObject state = doc["state"].to<JsonObject>();
-        state["preview"] = isPreview;
-        state["program"] = isProgram;
-        state["streaming"] = isStreaming;
-        state["recording"] = isRecording;
-        state["connected"] = serverConnected;
-        
-        String response;
-        serializeJson(doc, response);
-        webServer.send(200, "application/json", response);
+        sendSnapshot(SNAPSHOT_DEVICE_INFO, buildDeviceInfo);
     });
     
     // Add firmware info endpoint for server health checks
     webServer.on("/api/firmware/info", HTTP_GET, []() {
-        JsonDocument doc;
-        doc["device_type"] = DEVICE_MODEL;
-        doc["firmware_version"] = FIRMWARE_VERSION;
-        doc["model"] = "M5StickC-PLUS";
-        doc["device_name"] = deviceName;
-        doc["mac"] = WiFi.macAddress();
-        doc["uptime"] = millis() / 1000;
-        
-        String response;
-        serializeJson(doc, response);
-        webServer.send(200, "application/json", response);
+        sendSnapshot(SNAPSHOT_FIRMWARE_INFO, buildFirmwareInfo);
     });
     
     // Add firmware cleanup endpoint (to erase old firmware)
@@ -1272,81 +2252,212 @@ void setupWebServer() {
     // Handle tally status updates from server
     webServer.on("/api/tally", HTTP_POST, []() {
         if (webServer.hasArg("plain")) {
-            String body = webServer.arg("plain");
-            JsonDocument doc;
-            DeserializationError error = deserializeJson(doc, body);
-            
-            if (!error) {
-                // Update device state from tally data
-                isPreview = doc["status"] == "Preview";
-                isProgram = doc["status"] == "Live" || doc["status"] == "Program";
-                
-                // Handle enhanced recording/streaming status format
-
-                
-                if (doc["recordingStatus"].is<JsonObject>()) {
-                    bool newRecordingState = doc["recordingStatus"]["active"] | false;
-                    isRecording = newRecordingState;
-                } else if (doc["recording"].is<bool>()) {
-                    bool newRecordingState = doc["recording"] | false;
-                    isRecording = newRecordingState;
-                } else {
-                    isRecording = false;
-                }
-                
-                if (doc["streamingStatus"].is<JsonObject>()) {
-                    bool newStreamingState = doc["streamingStatus"]["active"] | false;
-                    isStreaming = newStreamingState;
-                } else if (doc["streaming"].is<bool>()) {
-                    bool newStreamingState = doc["streaming"] | false;
-                    isStreaming = newStreamingState;
-                } else {
-                    isStreaming = false;
-                }
-                
-                serverConnected = doc["obsConnected"] | true;
-                
-                // Update device name if provided
-                if (doc["deviceName"]) {
-                    String newDeviceName = doc["deviceName"];
-                    deviceName = newDeviceName;
-                }
-                
-                // Update assigned source if provided and save to persistent storage
-                if (doc["assignedSource"]) {
-                    String newAssignedSource = doc["assignedSource"];
-                    String currentAssignedSource = assignedSource;
-                    
-                    if (newAssignedSource != currentAssignedSource) {
-                        assignedSource = newAssignedSource;
-                        saveConfig(); // Save the updated assigned source to persistent storage
-                    }
-                }
-                
-
-                
-                // Update display to show the new status
-                // This is now the ONLY place where the display is updated
-                updateDisplay();
-                
-                webServer.send(200, "application/json", "{\"success\":true}");
-            } else {
-
-                webServer.send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
+            const String& body = webServer.arg("plain");
+            if (!verifyFrameMac(body.c_str(), body.length())) {
+                webServer.send(401, "application/json", "{\"error\":\"Bad MAC\"}");
+                return;
             }
+            String reply;
+            int code = applyTallyUpdate(body, reply, TALLY_PATH_PUSH);
+            webServer.send(code, "application/json", reply);
         } else {
-
             webServer.send(400, "application/json", "{\"error\":\"No data\"}");
         }
     });
     
+    // Transport benchmark driven by the server's /api/benchmark
+    webServer.on("/api/benchmark/start", HTTP_POST, []() {
+        const String& body = webServer.arg("plain");
+        if (!verifyFrameMac(body.c_str(), body.length())) {
+            webServer.send(401, "application/json", "{\"error\":\"Bad MAC\"}");
+            return;
+        }
+        JsonDocument doc;
+        if (deserializeJson(doc, body)) {
+            webServer.send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
+            return;
+        }
+        if (!frameFresh(doc)) {
+            frameReplays++;
+            webServer.send(409, "application/json", "{\"error\":\"Replayed frame\"}");
+            return;
+        }
+        startBenchmark(doc["run"] | 0UL, doc["count"] | 0UL);
+        webServer.send(200, "application/json", "{\"success\":true}");
+    });
+    
+    webServer.on("/api/benchmark", HTTP_GET, []() {
+        JsonDocument doc;
+        benchmarkResults(doc);
+        String response;
+        serializeJson(doc, response);
+        webServer.send(200, "application/json", response);
+    });
+    
+    // Verification cost on this chip for frames of ?size= bytes: with the
+    // cached key schedule as frames are checked, and with a full HMAC per frame
+    webServer.on("/api/frame-mac/bench", HTTP_GET, []() {
+        int count = webServer.hasArg("count") ? constrain(webServer.arg("count").toInt(), 1, 2000) : 200;
+        int size = webServer.hasArg("size") ? constrain(webServer.arg("size").toInt(), FRAME_MAC_TRAILER + 2, PUSH_MAX_BODY) : 320;
+        const char* key = frameKey.length() > 0 ? frameKey.c_str() : "benchmark";
+        const mbedtls_md_info_t* sha256 = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+        bool keyReady = frameKeyReady;
+        if (!keyReady) {
+            frameKey = key;
+            setupFrameKey();
+        }
+        
+        // Runs in the loop task, so the push buffer is free
+        size_t length = size - FRAME_MAC_TRAILER;
+        memset(pushBody, 'x', length);
+        pushBody[length] = '}';
+        uint8_t digest[32];
+        unsigned long start = micros();
+        for (int i = 0; i < count; i++) frameMac((const uint8_t*)pushBody, length, "}", digest);
+        float cachedUs = (float)(micros() - start) / count;
+        start = micros();
+        for (int i = 0; i < count; i++) {
+            mbedtls_md_hmac(sha256, (const uint8_t*)key, strlen(key), (const uint8_t*)pushBody, length + 1, digest);
+        }
+        float hmacUs = (float)(micros() - start) / count;
+        
+        if (!keyReady) {
+            frameKey = "";
+            setupFrameKey();
+        }
+        
+        JsonDocument doc;
+        doc["size"] = size;
+        doc["count"] = count;
+        doc["cached_us"] = cachedUs;
+        doc["hmac_us"] = hmacUs;
+        doc["key_configured"] = keyReady;
+        String response;
+        serializeJson(doc, response);
+        webServer.send(200, "application/json", response);
+    });
+    
     webServer.begin();
+    setupPushServer();
+}
+
+// Apply a tally push from either the web server or the push listener.
+// Returns the HTTP status and fills in the JSON reply
+int applyTallyUpdate(const String& body, String& reply, uint8_t path) {
+    JsonDocument doc;
+    DeserializationError error = deserializeJson(doc, body);
+    
+    if (error) {
+        reply = "{\"error\":\"Invalid JSON\"}";
+        return 400;
+    }
+    
+    // Benchmark probes are measured and never change the tally
+    if (doc["type"] == "bench-probe") {
+        if (!frameFresh(doc)) {
+            frameReplays++;
+            reply = "{\"error\":\"Replayed frame\"}";
+            return 409;
+        }
+        recordBenchmarkProbe(doc);
+        reply = "{\"success\":true}";
+        return 200;
+    }
+    
+    // A signed frame replayed from an earlier server run, or before this
+    // device has seen a numbered frame, would pass the MAC check. Only the
+    // broker delivers unnumbered tally, and those frames must be recent
+    if (frameKeyReady) {
+        bool stale;
+        if ((doc["seq"] | 0UL) != 0) {
+            stale = (doc["epoch"] | 0UL) < tallyEpoch || (lastTallySeq == 0 && !frameFresh(doc));
+        } else {
+            stale = path != TALLY_PATH_MQTT || !frameFresh(doc);
+        }
+        if (stale) {
+            frameReplays++;
+            reply = "{\"error\":\"Replayed frame\"}";
+            return 409;
+        }
+    }
+    
+    // Redundant delivery: a copy of an update that was already applied
+    if (!acceptTallySequence(doc["epoch"] | 0UL, doc["seq"] | 0UL, doc["redundant"] | false, path)) {
+        reply = "{\"success\":true,\"duplicate\":true}";
+        return 200;
+    }
+    
+    // One-way delivery time against the clock offset learnt at registration
+    if (clockSynced && doc["ts"].is<uint64_t>()) {
+        int64_t delivery = (int64_t)serverNowMs() - (int64_t)doc["ts"].as<uint64_t>();
+        if (delivery >= 0) {
+            lastDeliveryMs = delivery;
+            if (lastDeliveryMs > maxDeliveryMs) maxDeliveryMs = lastDeliveryMs;
+        }
+    }
+    
+    // Update device state from tally data, unless following OBS or TSL directly
+    if (!deviceTallyActive()) {
+        isPreview = doc["status"] == "Preview";
+        isProgram = doc["status"] == "Live" || doc["status"] == "Program";
+        markTallyFresh();
+    } else if (tallyMode == TALLY_MODE_MERGE && doc["status"].is<const char*>()) {
+        mergeServerStatus(doc["status"].as<const char*>());
+    }
+    
+    // Handle enhanced recording/streaming status format
+    if (doc["recordingStatus"].is<JsonObject>()) {
+        bool newRecordingState = doc["recordingStatus"]["active"] | false;
+        isRecording = newRecordingState;
+    } else if (doc["recording"].is<bool>()) {
+        bool newRecordingState = doc["recording"] | false;
+        isRecording = newRecordingState;
+    } else {
+        isRecording = false;
+    }
+    
+    if (doc["streamingStatus"].is<JsonObject>()) {
+        bool newStreamingState = doc["streamingStatus"]["active"] | false;
+        isStreaming = newStreamingState;
+    } else if (doc["streaming"].is<bool>()) {
+        bool newStreamingState = doc["streaming"] | false;
+        isStreaming = newStreamingState;
+    } else {
+        isStreaming = false;
+    }
+    
+    serverConnected = doc["obsConnected"] | true;
+    
+    // Update device name if provided
+    if (doc["deviceName"]) {
+        String newDeviceName = doc["deviceName"];
+        deviceName = newDeviceName;
+    }
+    
+    // Update assigned source if provided and save to persistent storage
+    if (doc["assignedSource"]) {
+        String newAssignedSource = doc["assignedSource"];
+        String currentAssignedSource = assignedSource;
+        
+        if (newAssignedSource != currentAssignedSource) {
+            assignedSource = newAssignedSource;
+            saveConfig(); // Save the updated assigned source to persistent storage
+        }
+    }
+    
+    // Update display to show the new status
+    // This is now the ONLY place where the display is updated
+    updateDisplay();
+    
+    reply = "{\"success\":true}";
+    return 200;
 }
 
 void setupMDNS() {
     if (MDNS.begin(hostname)) {
         MDNS.addService("http", "tcp", 80);
         MDNS.addService("obs-tally", "udp", UDP_PORT);
+        MDNS.addServiceTxt("obs-tally", "udp", "role", "device");
     }
 }
 
@@ -1384,76 +2495,319 @@ void setupOTA() {
     ArduinoOTA.begin();
 }
 
+// Dashboard page. Static for a given firmware build, so browsers revalidate
+// it with a header comparison; every value on it comes from /events
+const char DASHBOARD_HTML[] PROGMEM = R"html(<!DOCTYPE html><html><head>
+<title>OBS Tally Device</title>
+<meta name="viewport" content="width=device-width, initial-scale=1">
+<style>
+body { font-family: Arial; margin: 20px; background: #1a1a1a; color: #fff; }
+.container { max-width: 800px; margin: 0 auto; }
+.status { padding: 20px; border-radius: 8px; margin: 10px 0; text-align: center; font-size: 24px; }
+.live { background: #ff4444; }
+.preview { background: #ffaa00; }
+.ready { background: #44ff44; }
+.offline { background: #888888; }
+.error { background: #aa44ff; }
+.info { background: #333; padding: 15px; border-radius: 8px; margin: 10px 0; }
+.link { color: #888; font-size: 12px; }
+.btn { background: #0066cc; color: white; padding: 10px 20px; border: none; border-radius: 4px; margin: 5px; cursor: pointer; }
+.btn:hover { background: #0052a3; }
+.btn-danger { background: #dc3545; color: white; padding: 10px 20px; border: none; border-radius: 4px; cursor: pointer; }
+.btn-danger:hover { background: #c82333; }
+</style></head><body>
+<div class="container">
+<h1>OBS Tally Device</h1>
+<div id="status" class="status">...</div>
+<div class="info"><h3>Device Information</h3><div id="device"></div></div>
+<div class="info"><h3>Statistics</h3><div id="stats"></div></div>
+<div>
+<button class="btn" onclick="location.href='/config'">Configuration</button>
+<button class="btn" onclick="location.href='/restart'">Restart</button>
+<button class="btn btn-danger" onclick="location.href='/factory-reset'">Factory Reset</button>
+</div>
+<p id="link" class="link">Connecting...</p>
+</div>
+<script>
+var device = [
+  ['Device Name', '{name}'], ['Device ID', '{id}'], ['IP Address', '{ip}'], ['MAC Address', '{mac}'],
+  ['Firmware', '{fw}'], ['Uptime', '{uptime}'], ['Server URL', '{server}'], ['Assigned Source', '{source}'],
+  ['LED Status', '{led}']
+];
+var stats = [
+  ['Successful Heartbeats', '{hb_ok}'],
+  ['Failed Heartbeats', '{hb_fail}'],
+  ['Push Channel', '{push_requests} requests, {push_reused} on reused connections, avg {push_avg_us} us'],
+  ['Resolver', '{resolver_hits} hits, {resolver_misses} misses, {resolver_negative} negative ({resolver_cached} cached)'],
+  ['Heartbeat Client', '{hb_allocs} allocations per heartbeat ({hb_reused} reused / {hb_new} new connections, {hb_retries} stale retries)'],
+  ['Display Updates', '{display_updates}'],
+  ['Last Heartbeat', '{last_heartbeat}'],
+  ['Roams', '{roams} (last {last_roam_ms} ms, {failed_roams} failed)'],
+  ['Reconnects', '{reconnects} (last outage {last_outage_ms} ms, tally after {tally_after_ms} ms)'],
+  ['Session Resumes', '{resumes} ({reregistrations} full re-registrations)'],
+  ['TX Power', '{tx_dbm:1} dBm (avg RSSI {rssi_avg:1} dBm, {tx_changes} changes)'],
+  ['Free Heap', '{heap_kb} KB']
+];
+var state = {}, uptimeBase = 0, uptimeAt = Date.now();
+function escape(v) {
+  return String(v).replace(/[&<>"]/g, function (c) { return '&#' + c.charCodeAt(0) + ';'; });
+}
+function fill(template) {
+  return template.replace(/\{(\w+)(?::(\d))?\}/g, function (m, key, digits) {
+    var v = state[key];
+    if (v === undefined) return '-';
+    return escape(digits ? Number(v).toFixed(digits) : v);
+  });
+}
+function rows(list) {
+  return list.map(function (r) { return '<p><strong>' + r[0] + ':</strong> ' + fill(r[1]) + '</p>'; }).join('');
+}
+function formatUptime(seconds) {
+  var d = Math.floor(seconds / 86400), h = Math.floor(seconds / 3600) % 24, m = Math.floor(seconds / 60) % 60;
+  return (d ? d + 'd ' : '') + (h ? h + 'h ' : '') + (m ? m + 'm ' : '') + seconds % 60 + 's';
+}
+function render() {
+  state.uptime = formatUptime(uptimeBase + Math.floor((Date.now() - uptimeAt) / 1000));
+  var status = document.getElementById('status');
+  status.textContent = state.status;
+  status.className = 'status ' + String(state.status).toLowerCase();
+  document.getElementById('device').innerHTML = rows(device);
+  document.getElementById('stats').innerHTML = rows(stats);
+}
+var events = new EventSource('/events');
+events.onmessage = function (e) {
+  var delta = JSON.parse(e.data);
+  if (delta.uptime !== undefined) {
+    uptimeBase = delta.uptime;
+    uptimeAt = Date.now();
+    delete delta.uptime;
+  }
+  for (var key in delta) state[key] = delta[key];
+  render();
+};
+events.onopen = function () { document.getElementById('link').textContent = 'Live'; };
+events.onerror = function () { document.getElementById('link').textContent = 'Reconnecting...'; };
+setInterval(function () { if (state.status !== undefined) render(); }, 1000);
+</script>
+</body></html>)html";
 void handleRoot() {
-    String statusClass = currentStatus;
-    statusClass.toLowerCase();
-    
-    String html = "<!DOCTYPE html><html><head>";
-    html += "<title>OBS Tally Device</title>";
-    html += "<meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">";
-    html += "<style>";
-    html += "body { font-family: Arial; margin: 20px; background: #1a1a1a; color: #fff; }";
-    html += ".container { max-width: 800px; margin: 0 auto; }";
-    html += ".status { padding: 20px; border-radius: 8px; margin: 10px 0; text-align: center; font-size: 24px; }";
-    html += ".live { background: #ff4444; }";
-    html += ".preview { background: #ffaa00; }";
-    html += ".ready { background: #44ff44; }";
-    html += ".offline { background: #888888; }";
-    html += ".error { background: #aa44ff; }";
-    html += ".info { background: #333; padding: 15px; border-radius: 8px; margin: 10px 0; }";
-    html += ".btn { background: #0066cc; color: white; padding: 10px 20px; border: none; border-radius: 4px; margin: 5px; cursor: pointer; }";
-    html += ".btn:hover { background: #0052a3; }";
-    html += ".btn-danger { background: #dc3545; color: white; padding: 10px 20px; border: none; border-radius: 4px; cursor: pointer; }";
-    html += ".btn-danger:hover { background: #c82333; }";
-    html += "</style></head><body>";
-    
-    html += "<div class=\"container\">";
-    html += "<h1>OBS Tally Device</h1>";
-    html += "<div class=\"status " + statusClass + "\">";
-    html += currentStatus;
-    html += "</div>";
-    html += "<div class=\"info\">";
-    html += "<h3>Device Information</h3>";
-    html += "<p><strong>Device Name:</strong> " + deviceName + "</p>";
-    html += "<p><strong>Device ID:</strong> " + deviceID + "</p>";
-    html += "<p><strong>IP Address:</strong> " + ipAddress + "</p>";
-    html += "<p><strong>MAC Address:</strong> " + macAddress + "</p>";
-    html += "<p><strong>Firmware:</strong> " + String(FIRMWARE_VERSION) + "</p>";
-    html += "<p><strong>Uptime:</strong> " + formatUptime() + "</p>";
-    html += "<p><strong>Server URL:</strong> " + serverURL + "</p>";
-    html += "<p><strong>Assigned Source:</strong> " + (assignedSource.length() > 0 ? assignedSource : String("None")) + "</p>";
-    html += "<p><strong>LED Status:</strong> " + (ledManuallyDisabled ? String("Disabled") : String("Auto")) + "</p>";
-    html += "</div>";
-    html += "<div class=\"info\">";
-    html += "<h3>Statistics</h3>";
-    html += "<p><strong>Successful Heartbeats:</strong> " + String(successfulHeartbeats) + "</p>";
-    html += "<p><strong>Failed Heartbeats:</strong> " + String(failedHeartbeats) + "</p>";
-    html += "<p><strong>Display Updates:</strong> " + String(displayUpdates) + "</p>";
-    html += "<p><strong>Last Heartbeat:</strong> " + String(lastHeartbeat) + "</p>";
-    html += "</div>";
-    html += "<div>";
-    html += "<button class=\"btn\" onclick=\"location.href='/config'\">Configuration</button>";
-    html += "<button class=\"btn\" onclick=\"location.href='/restart'\">Restart</button>";
-    html += "<button class=\"btn btn-danger\" onclick=\"location.href='/factory-reset'\">Factory Reset</button>";
-    html += "</div></div></body></html>";
+    WiFiClient client = webServer.client();
+    setSocketDscp(client, DSCP_BULK);
     
-    webServer.send(200, "text/html", html);
+    webServer.sendHeader("ETag", DASHBOARD_ETAG);
+    webServer.sendHeader("Cache-Control", "no-cache");
+    if (webServer.header("If-None-Match") == DASHBOARD_ETAG) {
+        webServer.send(304);
+        return;
+    }
+    webServer.send_P(200, "text/html", DASHBOARD_HTML);
 }
 
-void handleConfigPost() {
-    String newServerIP = webServer.arg("server_ip");
-    String newDeviceName = webServer.arg("device_name");
-    uint16_t newServerPort = webServer.arg("server_port").toInt();
-    String newAssignedSource = webServer.arg("assigned_source");
-    bool newLedDisabled = webServer.hasArg("led_disabled"); // Checkbox is present when checked
+// Everything the dashboard shows, except uptime which the page counts itself
+void fillDashboardState(JsonDocument& doc) {
+    doc["status"] = currentStatus;
+    doc["name"] = deviceName;
+    doc["id"] = deviceID;
+    doc["ip"] = ipAddress;
+    doc["mac"] = macAddress;
+    doc["fw"] = FIRMWARE_VERSION;
+    doc["server"] = serverURL;
+    doc["source"] = assignedSource.length() > 0 ? assignedSource : "None";
+    doc["led"] = ledManuallyDisabled ? "Disabled" : "Auto";
+    doc["hb_ok"] = successfulHeartbeats;
+    doc["hb_fail"] = failedHeartbeats;
+    doc["push_requests"] = pushRequests;
+    doc["push_reused"] = pushReusedRequests;
+    doc["push_avg_us"] = (unsigned long)pushAvgLatencyUs;
+    doc["resolver_hits"] = resolverHits + resolverStaleHits;
+    doc["resolver_misses"] = resolverMisses;
+    doc["resolver_negative"] = resolverNegativeHits;
+    doc["resolver_cached"] = resolverCount;
+#ifdef HEAP_ALLOC_COUNT
+    doc["hb_allocs"] = hbAllocs;
+#endif
+    doc["hb_retries"] = hbStaleRetries;
+    doc["hb_reused"] = hbReusedConnections;
+    doc["hb_new"] = hbConnections;
+    doc["display_updates"] = displayUpdates;
+    doc["last_heartbeat"] = lastHeartbeat;
+    doc["roams"] = roamCount;
+    doc["last_roam_ms"] = lastRoamDuration;
+    doc["failed_roams"] = failedRoams;
+    doc["reconnects"] = reconnectCount;
+    doc["last_outage_ms"] = lastOutageDuration;
+    doc["tally_after_ms"] = lastReconnectToTally;
+    doc["resumes"] = sessionResumes;
+    doc["reregistrations"] = fullReregistrations;
+    doc["tx_dbm"] = txPowerDbm[txPowerLevel];
+    doc["rssi_avg"] = round(rssiEwma * 10) / 10.0;
+    doc["tx_changes"] = txPowerChanges;
+    doc["heap_kb"] = ESP.getFreeHeap() / 1024;
+}
+
+// Send the fields that changed since the last event to every client
+void publishDashboard() {
+    JsonDocument state;
+    fillDashboardState(state);
+    
+    JsonDocument delta;
+    for (JsonPair field : state.as<JsonObject>()) {
+        if (field.value() != dashboardSent[field.key()]) {
+            delta[field.key()] = field.value();
+        }
+    }
+    dashboardSent = state;
+    if (delta.size() == 0) return;
+    
+    String event = "data: ";
+    serializeJson(delta, event);
+    event += "\n\n";
+    for (int i = 0; i < DASHBOARD_MAX_CLIENTS; i++) {
+        if (!dashboardClients[i].connected()) continue;
+        if (!sendDashboardEvent(dashboardClients[i], event.c_str(), event.length())) continue;
+        dashboardEvents++;
+        dashboardEventBytes += event.length();
+    }
+}
+
+// The WebServer only drops its reference to the client after a handler
+// returns, so the copy kept here holds the stream open
+void handleEvents() {
+    int slot = -1;
+    for (int i = 0; i < DASHBOARD_MAX_CLIENTS && slot < 0; i++) {
+        if (!dashboardClients[i].connected()) slot = i;
+    }
+    if (slot < 0) {
+        webServer.send(503, "text/plain", "Too many dashboard clients");
+        return;
+    }
+    
+    // Flush pending changes to the other clients so that the snapshot and
+    // the shared "last sent" state agree
+    publishDashboard();
+    
+    WiFiClient client = webServer.client();
+    setSocketDscp(client, DSCP_BULK);
+    
+    JsonDocument snapshot = dashboardSent;
+    snapshot["uptime"] = (millis() - bootTime) / 1000;
+    String event = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+                   "Cache-Control: no-cache\r\nConnection: keep-alive\r\n\r\nretry: 3000\n"
+                   "data: ";
+    serializeJson(snapshot, event);
+    event += "\n\n";
+    if (sendDashboardEvent(client, event.c_str(), event.length())) dashboardClients[slot] = client;
+}
+
+void handleDashboardEvents() {
+    unsigned long now = millis();
+    if (now - lastDashboardEvent < DASHBOARD_EVENT_INTERVAL) return;
+    lastDashboardEvent = now;
+    
+    bool watched = false;
+    for (int i = 0; i < DASHBOARD_MAX_CLIENTS; i++) {
+        if (dashboardClients[i].connected()) watched = true;
+    }
+    if (!watched) return;
+    
+    publishDashboard();
+    
+    if (now - lastDashboardKeepalive > DASHBOARD_KEEPALIVE) {
+        lastDashboardKeepalive = now;
+        for (int i = 0; i < DASHBOARD_MAX_CLIENTS; i++) {
+            if (dashboardClients[i].connected()) sendDashboardEvent(dashboardClients[i], ":\n\n", 3);
+        }
+    }
+}
+
+// Dashboard writes never block the loop. WiFiClient::write waits for room
+// in the socket; here an event the socket cannot take whole right away
+// drops the client, which reconnects and starts again from a snapshot
+bool sendDashboardEvent(WiFiClient& client, const char* data, size_t length) {
+    int sent = (client.fd() < 0) ? -1 : send(client.fd(), data, length, MSG_DONTWAIT);
+    if (sent == (int)length) return true;
+    client.stop();
+    dashboardDrops++;
+    return false;
+}
+
+void handleConfigPost() {
+    String newServerIP = webServer.arg("server_ip");
+    String newDeviceName = webServer.arg("device_name");
+    uint16_t newServerPort = webServer.arg("server_port").toInt();
+    String newAssignedSource = webServer.arg("assigned_source");
+    bool newLedDisabled = webServer.hasArg("led_disabled"); // Checkbox is present when checked
+    subscribeMode = webServer.hasArg("subscribe_mode");
+    
+    // Reconnect to the broker with the new settings on the next loop
+    String newMqttBroker = webServer.arg("mqtt_broker");
+    newMqttBroker.trim();
+    uint16_t newMqttPort = webServer.arg("mqtt_port").toInt();
+    uint8_t newMqttQos = webServer.arg("mqtt_qos").toInt() > 0 ? 1 : 0;
+    if (newMqttPort == 0) newMqttPort = MQTT_DEFAULT_PORT;
+    if (newMqttBroker != mqttBroker || newMqttPort != mqttPort || newMqttQos != mqttQos) {
+        mqttBroker = newMqttBroker;
+        mqttPort = newMqttPort;
+        mqttQos = newMqttQos;
+        if (mqttClient.connected()) {
+            publishMqttPresence(false);
+            mqttClient.disconnect();
+        }
+        lastMqttAttempt = 0;
+    }
+    
+    uint16_t newTslPort = webServer.arg("tsl_port").toInt();
+    if (newTslPort > 0) tslPort = newTslPort;
+    if (webServer.hasArg("tsl_index")) tslIndex = webServer.arg("tsl_index").toInt();
+    
+    String newFrameKey = webServer.arg("frame_key");
+    if (newFrameKey.length() > 0) {
+        frameKey = newFrameKey == "-" ? "" : newFrameKey;
+        setupFrameKey();
+    }
+    
+    // Reconnect to OBS with the new settings on the next loop
+    String newTallyMode = webServer.arg("tally_mode");
+    if (newTallyMode != TALLY_MODE_OBS && newTallyMode != TALLY_MODE_TSL && newTallyMode != TALLY_MODE_MERGE) {
+        newTallyMode = TALLY_MODE_SERVER;
+    }
+    if (newTallyMode != TALLY_MODE_TSL) tslSeen = false;  // The server's tally applies again
+    String newObsHost = webServer.arg("obs_host");
+    newObsHost.trim();
+    uint16_t newObsPort = webServer.arg("obs_port").toInt();
+    if (newObsPort == 0) newObsPort = OBS_DEFAULT_PORT;
+    bool newObsPassword = webServer.arg("obs_password").length() > 0;
+    if (newTallyMode != tallyMode || newObsHost != obsHost || newObsPort != obsPort || newObsPassword) {
+        tallyMode = newTallyMode;
+        obsHost = newObsHost;
+        obsPort = newObsPort;
+        if (newObsPassword) obsPassword = webServer.arg("obs_password");
+        closeObs("reconfigured");
+        lastObsAttempt = 0;
+    }
+    
+    if (webServer.hasArg("merge_rule")) mergeRule = webServer.arg("merge_rule") == MERGE_RULE_PRIORITY ? MERGE_RULE_PRIORITY : MERGE_RULE_ANY;
+    if (webServer.hasArg("feed_priority")) {
+        feedPriority = webServer.arg("feed_priority");
+        feedPriority.trim();
+        parseFeedPriority();
+    }
+    // Feeds are only kept while merging; a new rule applies at once
+    if (tallyMode == TALLY_MODE_MERGE) {
+        showMergedTally();
+    } else {
+        resetFeeds();
+    }
 
     if (newServerIP.length() > 0) {
+        if (newServerIP != serverIP) serverManual = true;
         serverIP = newServerIP;
     }
     if (newDeviceName.length() > 0) {
         deviceName = newDeviceName;
     }
     if (newServerPort > 0) {
+        if (newServerPort != serverPort) serverManual = true;
         serverPort = newServerPort;
     } else if (serverPort == 0) {
         serverPort = 3005;
@@ -1488,7 +2842,7 @@ void handleConfig() {
     html += "body { font-family: Arial; margin: 20px; background: #1a1a1a; color: #fff; }";
     html += ".form-group { margin: 15px 0; }";
     html += "label { display: block; margin-bottom: 5px; font-weight: bold; }";
-    html += "input[type='text'], input[type='number'] { width: 300px; padding: 8px; border: 1px solid #444; background: #333; color: #fff; border-radius: 4px; }";
+    html += "input[type='text'], input[type='number'], input[type='password'], select { width: 300px; padding: 8px; border: 1px solid #444; background: #333; color: #fff; border-radius: 4px; }";
     html += "input[type='checkbox'] { margin-right: 8px; transform: scale(1.2); }";
     html += "input[type='submit'] { background: #0066cc; color: white; padding: 10px 20px; border: none; border-radius: 4px; cursor: pointer; }";
     html += "input[type='submit']:hover { background: #0052a3; }";
@@ -1519,6 +2873,69 @@ void handleConfig() {
     html += "<label for='led_disabled'>Disable LED (keep LED off regardless of tally status)</label>";
     html += "</div>";
     html += "</div>";
+    html += "<div class='form-group'>";
+    html += "<label>Network:</label>";
+    html += "<div class='checkbox-group'>";
+    html += "<input type='checkbox' id='subscribe_mode' name='subscribe_mode' value='1'" + (subscribeMode ? String(" checked") : String("")) + ">";
+    html += "<label for='subscribe_mode'>Subscribe for tally updates (network blocks connections to the device)</label>";
+    html += "</div>";
+    html += "</div>";
+    html += "<div class='form-group'>";
+    html += "<label for='mqtt_broker'>MQTT Broker (empty to disable):</label>";
+    html += "<input type='text' id='mqtt_broker' name='mqtt_broker' value='" + mqttBroker + "' placeholder='broker.local'>";
+    html += "</div>";
+    html += "<div class='form-group'>";
+    html += "<label for='mqtt_port'>MQTT Port:</label>";
+    html += "<input type='number' id='mqtt_port' name='mqtt_port' value='" + String(mqttPort) + "' placeholder='1883'>";
+    html += "</div>";
+    html += "<div class='form-group'>";
+    html += "<label for='mqtt_qos'>MQTT QoS (0 or 1):</label>";
+    html += "<input type='number' id='mqtt_qos' name='mqtt_qos' min='0' max='1' value='" + String(mqttQos) + "'>";
+    html += "</div>";
+    html += "<div class='form-group'>";
+    html += "<label for='tally_mode'>Tally Source:</label>";
+    html += "<select id='tally_mode' name='tally_mode'>";
+    html += "<option value='server'" + (tallyMode == TALLY_MODE_SERVER ? String(" selected") : String("")) + ">OBS Tally server</option>";
+    html += "<option value='obs'" + (tallyMode == TALLY_MODE_OBS ? String(" selected") : String("")) + ">OBS WebSocket directly</option>";
+    html += "<option value='tsl'" + (tallyMode == TALLY_MODE_TSL ? String(" selected") : String("")) + ">TSL UMD (switcher/multiviewer)</option>";
+    html += "<option value='merge'" + (tallyMode == TALLY_MODE_MERGE ? String(" selected") : String("")) + ">Merge server, OBS and TSL</option>";
+    html += "</select>";
+    html += "</div>";
+    html += "<div class='form-group'>";
+    html += "<label for='merge_rule'>Merge Rule:</label>";
+    html += "<select id='merge_rule' name='merge_rule'>";
+    html += "<option value='any'" + (mergeRule == MERGE_RULE_ANY ? String(" selected") : String("")) + ">Program anywhere wins</option>";
+    html += "<option value='priority'" + (mergeRule == MERGE_RULE_PRIORITY ? String(" selected") : String("")) + ">First active feed</option>";
+    html += "</select>";
+    html += "</div>";
+    html += "<div class='form-group'>";
+    html += "<label for='feed_priority'>Feed Priority:</label>";
+    html += "<input type='text' id='feed_priority' name='feed_priority' value='" + feedPriority + "' placeholder='server,obs,tsl'>";
+    html += "</div>";
+    html += "<div class='form-group'>";
+    html += "<label for='obs_host'>OBS Host:</label>";
+    html += "<input type='text' id='obs_host' name='obs_host' value='" + obsHost + "' placeholder='obs-pc.local'>";
+    html += "</div>";
+    html += "<div class='form-group'>";
+    html += "<label for='obs_port'>OBS WebSocket Port:</label>";
+    html += "<input type='number' id='obs_port' name='obs_port' value='" + String(obsPort) + "' placeholder='4455'>";
+    html += "</div>";
+    html += "<div class='form-group'>";
+    html += "<label for='obs_password'>OBS WebSocket Password (empty keeps the current one):</label>";
+    html += "<input type='password' id='obs_password' name='obs_password' value=''>";
+    html += "</div>";
+    html += "<div class='form-group'>";
+    html += "<label for='tsl_port'>TSL Port (applies after restart):</label>";
+    html += "<input type='number' id='tsl_port' name='tsl_port' value='" + String(tslPort) + "' placeholder='40001'>";
+    html += "</div>";
+    html += "<div class='form-group'>";
+    html += "<label for='tsl_index'>TSL Display Index:</label>";
+    html += "<input type='number' id='tsl_index' name='tsl_index' min='0' max='65534' value='" + String(tslIndex) + "'>";
+    html += "</div>";
+    html += "<div class='form-group'>";
+    html += "<label for='frame_key'>Frame Key, as TALLY_FRAME_KEY on the server (empty keeps the current one, - removes it):</label>";
+    html += "<input type='password' id='frame_key' name='frame_key' value=''>";
+    html += "</div>";
     html += "<input type='submit' value='Save Configuration'>";
     html += "</form>";
     html += "<br><a href='/' style='color: #0066cc;'>← Back to Status</a>";
@@ -1529,6 +2946,10 @@ void handleConfig() {
 void handleUpdateFile() {
     HTTPUpload& upload = webServer.upload();
     if (upload.status == UPLOAD_FILE_START) {
+        // Firmware uploads should not compete with tally frames
+        WiFiClient client = webServer.client();
+        setSocketDscp(client, DSCP_BULK);
+        
         M5.Lcd.fillScreen(TFT_BLACK);
         M5.Lcd.setCursor(0, 0);
         M5.Lcd.println("Update starting...");
@@ -1566,17 +2987,16 @@ void handleUpdate() {
 }
 
 void handleStatus() {
-    JsonDocument doc;
+    sendSnapshot(SNAPSHOT_STATUS, buildStatus);
+}
+
+void buildStatus(JsonDocument& doc) {
     doc["device_name"] = deviceName;
     doc["preview"] = isPreview;
     doc["program"] = isProgram;
     doc["streaming"] = isStreaming;
     doc["recording"] = isRecording;
     doc["connected"] = serverConnected;
-    
-    String response;
-    serializeJson(doc, response);
-    webServer.send(200, "application/json", response);
 }
 
 void checkServer() {
@@ -1584,7 +3004,7 @@ void checkServer() {
     
     HTTPClient http;
     String url = "http://" + serverIP + ":" + String(serverPort) + "/device/status";
-    http.begin(url);
+    http.begin(resolvedURL(url));
     
     int httpCode = http.GET();
     if (httpCode == HTTP_CODE_OK) {
@@ -1605,42 +3025,70 @@ void checkServer() {
     http.end();
 }
 
-void announceDevice() {
+// Rebuild the cached announcement if name, IP or source changed since it was
+// serialised (the firmware version is fixed for the lifetime of the image).
+// Returns false if no announcement is available
+bool refreshAnnouncement() {
+    if (serverIP != announcedServerIP) {
+        announceServerValid = announceServerAddr.fromString(serverIP);
+        announcedServerIP = serverIP;
+    }
+    
+    IPAddress localIP = WiFi.localIP();
+    if (announcementLength > 0 && deviceName == announcedName &&
+        localIP == announcedIP && assignedSource == announcedSource) {
+        return true;
+    }
+    
     JsonDocument doc;
     doc["type"] = "device-announce";  // Changed to match server's expected type
     doc["deviceId"] = deviceID;  // Use proper unique deviceID
     doc["deviceName"] = deviceName;
-    doc["ipAddress"] = WiFi.localIP().toString();  // Changed from "ip" to "ipAddress"
+    doc["ipAddress"] = localIP.toString();  // Changed from "ip" to "ipAddress"
     doc["macAddress"] = WiFi.macAddress();  // Changed from "mac" to "macAddress"
     doc["firmware"] = FIRMWARE_VERSION;  // Changed from "version" to "firmware"
     doc["model"] = DEVICE_MODEL;  // Changed from "type" to "model"
     doc["assignedSource"] = assignedSource;
-    doc["timestamp"] = millis();
     
-    String message;
-    serializeJson(doc, message);
+    size_t length = serializeJson(doc, announcementCache, sizeof(announcementCache));
+    if (length == 0 || length >= sizeof(announcementCache) - 1) {
+        announcementLength = 0;
+        Serial.println("[UDP] Announcement does not fit the presence buffer");
+        return false;
+    }
+    
+    announcementLength = length;
+    announcedName = deviceName;
+    announcedIP = localIP;
+    announcedSource = assignedSource;
+    announcementRebuilds++;
+    return true;
+}
+
+void announceDevice() {
+    unsigned long now = millis();
+    if (lastAnnounceSent != 0 && now - lastAnnounceSent < ANNOUNCE_MIN_INTERVAL) {
+        announcementsSuppressed++;
+        return;
+    }
+    if (!refreshAnnouncement()) return;
     
     // Send to configured server IP if available
-    if (serverIP.length() > 0) {
-        udp.beginPacket(serverIP.c_str(), 3006);
-        udp.write((uint8_t*)message.c_str(), message.length());
+    if (announceServerValid) {
+        udp.beginPacket(announceServerAddr, 3006);
+        udp.write((const uint8_t*)announcementCache, announcementLength);
         udp.endPacket();
     }
     
     // Also send broadcast for auto-discovery
     IPAddress broadcastIP(255, 255, 255, 255);
     udp.beginPacket(broadcastIP, 3006);
-    udp.write((uint8_t*)message.c_str(), message.length());
+    udp.write((const uint8_t*)announcementCache, announcementLength);
     udp.endPacket();
     
-    lastAnnounce = millis();
-    
-    // Reduce announcement logging to minimize serial spam
-    static unsigned long lastAnnounceLog = 0;
-    if (millis() - lastAnnounceLog > 300000) { // Only log every 5 minutes
-        Serial.println("Device announcement sent to server and broadcast");
-        lastAnnounceLog = millis();
-    }
+    lastAnnounce = now;
+    lastAnnounceSent = now;
+    announcementsSent++;
 }
 
 void registerDevice() {
@@ -1650,33 +3098,27 @@ void registerDevice() {
     
     Serial.println("[REGISTER] Registering device with server...");
     
-    HTTPClient http;
-    String url = serverURL + "/api/esp32/register";
-    http.begin(url);
-    http.addHeader("Content-Type", "application/json");
-    
-    JsonDocument doc;
-    doc["deviceId"] = deviceID;
-    doc["deviceName"] = deviceName.length() > 0 ? deviceName : "M5StickC-Tally";
-    doc["ipAddress"] = WiFi.localIP().toString();
-    doc["macAddress"] = macAddress;
-    doc["firmware"] = FIRMWARE_VERSION;
-    doc["model"] = DEVICE_MODEL;
-    doc["assignedSource"] = assignedSource;
-    
-    String jsonString;
-    serializeJson(doc, jsonString);
+    if (!refreshRequestTemplates()) {
+        Serial.println(serverURL.startsWith("https://") ? "[REGISTER] Registration failed: https:// is not supported"
+                                                        : "[REGISTER] Registration failed: invalid server URL");
+        isRegistered = false;
+        return;
+    }
     
-    int httpCode = http.POST(jsonString);
+    int httpCode = httpTransact(registerRequest, registerRequestLength);
     
     if (httpCode > 0) {
-        String response = http.getString();
-        Serial.printf("[REGISTER] Response: %s\n", response.c_str());
+        Serial.printf("[REGISTER] Response: %s\n", hbResponse);
         
         if (httpCode == 200) {
             isRegistered = true;
             isConnected = true;
             serverConnected = true; // Set serverConnected flag for API endpoint
+            applyNegotiation(hbResponse);
+            if (bootToRegister == 0) {
+                bootToRegister = millis() - bootTime;
+                Serial.printf("[REGISTER] Registered %lu ms after boot\n", bootToRegister);
+            }
             lastHeartbeatTime = 0; // Reset heartbeat timer to trigger immediate heartbeat
             Serial.println("[REGISTER] Device registration successful");
         } else {
@@ -1684,13 +3126,55 @@ void registerDevice() {
             isRegistered = false;
         }
     } else {
-        Serial.printf("[REGISTER] Registration failed: %s\n", http.errorToString(httpCode).c_str());
+        Serial.printf("[REGISTER] Registration failed: %s\n", httpTransactError(httpCode));
         isRegistered = false;
     }
-    
-    http.end();
 }
 
+#ifdef HEAP_ALLOC_COUNT
+// Allocation counter for the heartbeat path. malloc/calloc/realloc are
+// wrapped at link time by the _diag env in platformio.ini; only calls from
+// the task that armed the counter are counted
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+}
+
+static volatile TaskHandle_t allocCountTask = NULL;
+static volatile unsigned long allocCount = 0;
+
+extern "C" void* __wrap_malloc(size_t size) {
+    if (allocCountTask && xTaskGetCurrentTaskHandle() == allocCountTask) allocCount++;
+    return __real_malloc(size);
+}
+
+extern "C" void* __wrap_calloc(size_t count, size_t size) {
+    if (allocCountTask && xTaskGetCurrentTaskHandle() == allocCountTask) allocCount++;
+    return __real_calloc(count, size);
+}
+
+extern "C" void* __wrap_realloc(void* ptr, size_t size) {
+    if (allocCountTask && xTaskGetCurrentTaskHandle() == allocCountTask) allocCount++;
+    return __real_realloc(ptr, size);
+}
+
+static void startAllocCount() {
+    allocCount = 0;
+    allocCountTask = xTaskGetCurrentTaskHandle();
+}
+
+static void stopAllocCount() {
+    allocCountTask = NULL;
+    hbAllocs = allocCount;
+}
+#else
+static void startAllocCount() {}
+static void stopAllocCount() {}
+#endif
+
+// Heartbeats patch the status, uptime and signal slots of a prebuilt request
+// and parse the response in place, so the steady state does no heap allocation
 void sendHeartbeat() {
     if (WiFi.status() != WL_CONNECTED || serverURL.length() == 0) {
         return;
@@ -1705,136 +3189,113 @@ void sendHeartbeat() {
         }
     }
     
-    HTTPClient http;
-    String url = serverURL + "/api/heartbeat";
-    http.begin(url);
-    http.addHeader("Content-Type", "application/json");
-    
-    JsonDocument doc;
-    doc["id"] = deviceID;
-    doc["status"] = currentStatus;
-    doc["uptime"] = millis() - bootTime;
-    doc["ip"] = WiFi.localIP().toString();
-    doc["assignedSource"] = assignedSource;
-    doc["signal"] = getWiFiSignalQuality(wifiSignalStrength);
-    doc["version"] = FIRMWARE_VERSION;
-    doc["model"] = DEVICE_MODEL;
-    
-    String jsonString;
-    serializeJson(doc, jsonString);
-    
-    int httpCode = http.POST(jsonString);
+    if (!refreshRequestTemplates()) {
+        failedHeartbeats++;
+        lastHeartbeatTime = millis();
+        return;
+    }
     
-    if (httpCode > 0) {
-        String response = http.getString();
-        
-        if (httpCode == 200) {
-            JsonDocument responseDoc;
-            DeserializationError error = deserializeJson(responseDoc, response);
+    startAllocCount();
+    
+    char field[12];
+    patchSlot(hbRequest, hbStatusOffset, HB_STATUS_SLOT, currentStatus.c_str(), true);
+    snprintf(field, sizeof(field), "%lu", millis() - bootTime);
+    patchSlot(hbRequest, hbUptimeOffset, HB_UPTIME_SLOT, field, false);
+    snprintf(field, sizeof(field), "%d", getWiFiSignalQuality(wifiSignalStrength));
+    patchSlot(hbRequest, hbSignalOffset, HB_SIGNAL_SLOT, field, false);
+    
+    int httpCode = httpTransact(hbRequest, hbRequestLength);
+    
+    if (httpCode == 200) {
+        // Status arrives as {"source": ..., "status": ...} or, from older servers, a string
+        char newStatus[16];
+        if (!deviceTallyActive() && jsonFindString(hbResponse, "status", newStatus, sizeof(newStatus))) {
+            // Update tally status based on server response
+            bool program = strcmp(newStatus, "Live") == 0 || strcmp(newStatus, "Program") == 0;
+            bool preview = !program && strcmp(newStatus, "Preview") == 0;
+            const char* status = program ? "LIVE" : (preview ? "PREVIEW" : "IDLE");
+            bool changed = program != isProgram || preview != isPreview || currentStatus != status;
             
-            if (!error) {
-                // Update device state from server response
-                String newStatus = "";
-                
-                // Check for status in the nested object format from heartbeat response
-                if (responseDoc["status"].is<JsonObject>() && responseDoc["status"]["status"].is<String>()) {
-                    newStatus = responseDoc["status"]["status"].as<String>();
-                } else if (responseDoc["status"].is<String>()) {
-                    // Fallback to direct string format for compatibility
-                    newStatus = responseDoc["status"].as<String>();
-                }
-                
-                if (newStatus.length() > 0) {
-                    // Update tally status based on server response
-                    bool oldPreview = isPreview;
-                    bool oldProgram = isProgram;
-                    String oldCurrentStatus = currentStatus;
-                    
-                    if (newStatus == "Live" || newStatus == "Program") {
-                        isProgram = true;
-                        isPreview = false;
-                        currentStatus = "LIVE";
-                    } else if (newStatus == "Preview") {
-                        isProgram = false;
-                        isPreview = true;
-                        currentStatus = "PREVIEW";
-                    } else {
-                        isProgram = false;
-                        isPreview = false;
-                        currentStatus = "IDLE";
-                    }
-                    
-                    // Log status changes for debugging
-                    if (oldPreview != isPreview || oldProgram != isProgram || oldCurrentStatus != currentStatus) {
-                        Serial.printf("[HEARTBEAT] Status change: %s -> currentStatus=%s, isProgram=%s, isPreview=%s\n", 
-                                      newStatus.c_str(), 
-                                      currentStatus.c_str(),
-                                      isProgram ? "true" : "false", 
-                                      isPreview ? "true" : "false");
-                    }
-                }
-                
-                // Update assigned source if provided
-                if (responseDoc["assignedSource"].is<String>()) {
-                    String newAssignedSource = responseDoc["assignedSource"].as<String>();
-                    if (newAssignedSource != assignedSource) {
-                        assignedSource = newAssignedSource;
-                        saveConfig(); // Save the updated assigned source to persistent storage
-                        Serial.printf("[HEARTBEAT] Assigned source updated and saved: %s\n", assignedSource.c_str());
-                    }
-                }
-                
-                // Update streaming/recording status if provided
-                if (responseDoc["recording"].is<bool>()) {
-                    bool newRecording = responseDoc["recording"] | false;
-                    if (newRecording != isRecording) {
-                        isRecording = newRecording;
-                        Serial.printf("[HEARTBEAT] Recording status: %s\n", isRecording ? "STARTED" : "STOPPED");
-                    }
-                }
-                if (responseDoc["streaming"].is<bool>()) {
-                    bool newStreaming = responseDoc["streaming"] | false;
-                    if (newStreaming != isStreaming) {
-                        isStreaming = newStreaming;
-                        Serial.printf("[HEARTBEAT] Streaming status: %s\n", isStreaming ? "STARTED" : "STOPPED");
-                    }
-                }
-            }
-            
-            isConnected = true;
-            serverConnected = true; // Update serverConnected flag for API endpoint
-            successfulHeartbeats++;
-            lastHeartbeat = formatTime();
+            isProgram = program;
+            isPreview = preview;
+            if (changed) currentStatus = status;
+            markTallyFresh();
             
-            // Reduce heartbeat success logging to minimize serial spam
-            static unsigned long lastHeartbeatLog = 0;
-            if (millis() - lastHeartbeatLog > 60000) { // Only log every minute
-                Serial.println("[HEARTBEAT] Successful");
-                lastHeartbeatLog = millis();
+            // Log status changes for debugging
+            if (changed) {
+                Serial.printf("[HEARTBEAT] Status change: %s -> currentStatus=%s, isProgram=%s, isPreview=%s\n", 
+                              newStatus, 
+                              currentStatus.c_str(),
+                              isProgram ? "true" : "false", 
+                              isPreview ? "true" : "false");
             }
-        } else if (httpCode == 404) {
-            // Device not registered on server, clear registration flag
-            isRegistered = false;
-            isConnected = false;
-            serverConnected = false;
-            failedHeartbeats++;
-            Serial.println("[HEARTBEAT] Device not registered on server, will re-register");
-        } else {
-            isConnected = false;
-            serverConnected = false;
-            failedHeartbeats++;
-            lastError = "Heartbeat failed: HTTP " + String(httpCode);
-            Serial.printf("[HEARTBEAT] Failed: HTTP %d\n", httpCode);
+        } else if (tallyMode == TALLY_MODE_MERGE && jsonFindString(hbResponse, "status", newStatus, sizeof(newStatus))) {
+            mergeServerStatus(newStatus);
+        }
+        
+        // Update assigned source if provided
+        char newAssignedSource[64];
+        if (jsonFindString(hbResponse, "assignedSource", newAssignedSource, sizeof(newAssignedSource)) &&
+            assignedSource != newAssignedSource) {
+            assignedSource = newAssignedSource;
+            saveConfig(); // Save the updated assigned source to persistent storage
+            Serial.printf("[HEARTBEAT] Assigned source updated and saved: %s\n", assignedSource.c_str());
+        }
+        
+        // Update streaming/recording status if provided
+        bool flag;
+        if (jsonFindBool(hbResponse, "recording", flag) && flag != isRecording) {
+            isRecording = flag;
+            Serial.printf("[HEARTBEAT] Recording status: %s\n", isRecording ? "STARTED" : "STOPPED");
         }
+        if (jsonFindBool(hbResponse, "streaming", flag) && flag != isStreaming) {
+            isStreaming = flag;
+            Serial.printf("[HEARTBEAT] Streaming status: %s\n", isStreaming ? "STARTED" : "STOPPED");
+        }
+        
+        isConnected = true;
+        serverConnected = true; // Update serverConnected flag for API endpoint
+        successfulHeartbeats++;
+        if (ntpInitialized) {
+            time_t epochTime = timeClient.getEpochTime();
+            strftime(lastHeartbeat, sizeof(lastHeartbeat), "%Y-%m-%d %H:%M:%S UTC", gmtime(&epochTime));
+        }
+        
+        // Reduce heartbeat success logging to minimize serial spam
+        static unsigned long lastHeartbeatLog = 0;
+        if (millis() - lastHeartbeatLog > 60000) { // Only log every minute
+            Serial.println("[HEARTBEAT] Successful");
+            lastHeartbeatLog = millis();
+        }
+    } else if (httpCode == 404) {
+        // Device not registered on server, clear registration flag
+        isRegistered = false;
+        isConnected = false;
+        serverConnected = false;
+        failedHeartbeats++;
+        Serial.println("[HEARTBEAT] Device not registered on server, will re-register");
+        dropFeed(FEED_SERVER);
+    } else if (httpCode > 0) {
+        isConnected = false;
+        serverConnected = false;
+        failedHeartbeats++;
+        lastError = "Heartbeat failed: HTTP " + String(httpCode);
+        Serial.printf("[HEARTBEAT] Failed: HTTP %d\n", httpCode);
+        dropFeed(FEED_SERVER);
     } else {
         isConnected = false;
         serverConnected = false;
         failedHeartbeats++;
-        lastError = "Heartbeat failed: " + http.errorToString(httpCode);
-        Serial.printf("[HEARTBEAT] Failed: %s\n", http.errorToString(httpCode).c_str());
+        lastError = "Heartbeat failed: " + String(httpTransactError(httpCode));
+        Serial.printf("[HEARTBEAT] Failed: %s\n", httpTransactError(httpCode));
+        dropFeed(FEED_SERVER);
+        
+        // The cached address may be out of date
+        if (httpCode == -1) expediteResolve(hbServerHost);
     }
     
-    http.end();
+    stopAllocCount();
+    
     lastHeartbeatTime = millis();
 }
 
@@ -2111,7 +3572,7 @@ void initPowerManagement() {
     
     // Configure WiFi power saving VERY conservatively
     WiFi.setSleep(false); // Keep WiFi fully awake for stability
-    WiFi.setTxPower(WIFI_POWER_11dBm); // Use normal power for stability
+    setupTxPower(); // Adaptive TX power, starting at the normal 11 dBm level
     
     // Update battery status after initialization
     delay(1000); // Give AXP192 time to initialize properly
@@ -2178,9 +3639,9 @@ void updatePowerState() {
     displayDimmed = false;
     deepSleepEnabled = false;
     
-    // Keep WiFi at full power to prevent disconnection-related restarts
+    // Keep WiFi awake to prevent disconnection-related restarts
+    // (TX power is managed by updateTxPower())
     WiFi.setSleep(false);
-    WiFi.setTxPower(WIFI_POWER_11dBm);
     
     // Keep CPU at normal frequency to prevent clock-related instability
     if (getCpuFrequencyMhz() != CPU_FREQ_NORMAL) {
@@ -2373,8 +3834,10 @@ void handleLowBattery() {
     // Further reduce display brightness
     setBrightness(20); // Very dim
     
-    // Reduce WiFi power even more
-    WiFi.setTxPower(WIFI_POWER_2dBm); // Minimum WiFi power
+    // Cap WiFi TX power (applied by the adaptive controller)
+    if (txPowerLevel > TXPOWER_LOW_BATTERY_MAX) {
+        setTxPowerLevel(TXPOWER_LOW_BATTERY_MAX, "low battery");
+    }
     
     // Disable LED to save power
     digitalWrite(LED_PIN, HIGH); // LED OFF
@@ -2532,14 +3995,7 @@ void optimizeWiFiPower() {
     // Use moderate WiFi sleep mode instead of aggressive sleep
     WiFi.setSleep(WIFI_PS_MIN_MODEM); // Less aggressive than true
     
-    // Use moderate power reduction instead of minimum power
-    if (lowBatteryMode) {
-        WiFi.setTxPower(WIFI_POWER_5dBm); // Moderate instead of minimum
-    } else if (powerSaveMode) {
-        WiFi.setTxPower(WIFI_POWER_8_5dBm); // Conservative power reduction
-    } else {
-        WiFi.setTxPower(WIFI_POWER_11dBm); // Normal power for stability
-    }
+    // TX power is left to the adaptive controller, which caps it in low battery mode
     
     // Remove aggressive modem sleep that could cause disconnects
     // esp_wifi_set_ps(WIFI_PS_MIN_MODEM); // DISABLED - causing instability
@@ -2646,7 +4102,7 @@ void checkServerConnection() {
   if (serverURL.length() == 0) return;
   
   HTTPClient http;
-  http.begin(serverURL + "/api/status");
+  http.begin(resolvedURL(serverURL) + "/api/status");
   http.setTimeout(5000);
   
   int httpCode = http.GET();
@@ -2677,101 +4133,3878 @@ void setupDiscovery() {
   }
 }
 
-void handleDiscoveryRequest() {
-  if (!discoveryUDPInitialized) return;
-  
-  int packetSize = discoveryUDP.parsePacket();
-  if (packetSize > 0) {
-    String request = discoveryUDP.readString();
-    request.trim();
-    
-    if (request == "DISCOVER_TALLY") {
-      JsonDocument response;
-      response["type"] = "tally_device";
-      response["id"] = deviceID;
-      response["name"] = deviceName;
-      response["model"] = DEVICE_MODEL;
-      response["version"] = FIRMWARE_VERSION;
-      response["ip"] = WiFi.localIP().toString();
-      response["mac"] = macAddress;
-      response["status"] = currentStatus;
-      response["uptime"] = millis() - bootTime;
-      
-      String responseStr;
-      serializeJson(response, responseStr);
-      
-      discoveryUDP.beginPacket(discoveryUDP.remoteIP(), discoveryUDP.remotePort());
-      discoveryUDP.print(responseStr);
-      discoveryUDP.endPacket();
-      
-      Serial.printf("[UDP] Responded to discovery from %s\n", 
-                   discoveryUDP.remoteIP().toString().c_str());
+// Runs in the lwIP thread: classify the datagram in place and hand the pbuf
+// to the owning subsystem's queue. Nothing is copied here; the receiver
+// frees the pbuf once it has processed the frame
+static void udpIngestReceive(void* arg, struct udp_pcb* pcb, struct pbuf* p, const ip_addr_t* addr, uint16_t port) {
+    udpFramesReceived++;
+    QueueHandle_t target = NULL;
+    
+    if (pbuf_get_at(p, 0) == '{') {
+        if (p->tot_len < DISCOVERY_MAX_PACKET && pbuf_memfind(p, "discover-request", 16, 0) != 0xFFFF) {
+            target = discoveryQueue;
+        } else if (p->tot_len <= UDP_TALLY_MAX_FRAME && (pbuf_memfind(p, "tally-update", 12, 0) != 0xFFFF ||
+                                                         pbuf_memfind(p, "scene-event", 11, 0) != 0xFFFF ||
+                                                         pbuf_memfind(p, "bench-probe", 11, 0) != 0xFFFF ||
+                                                         pbuf_memfind(p, "fleet-provision", 15, 0) != 0xFFFF)) {
+            target = tallyQueue;
+        }
     }
-  }
-}
-
-// Perform periodic health check to monitor device status (reduce logging frequency)
-void performHealthCheck() {
-  // Reduce health check logging frequency to minimize serial spam
-  static unsigned long lastHealthLog = 0;
-  bool shouldLog = (millis() - lastHealthLog > 300000); // Only log every 5 minutes
-  
-  if (shouldLog) {
-    Serial.println("[HEALTH] Performing health check...");
-    lastHealthLog = millis();
-  }
-  
-  // Check memory
-  uint32_t freeHeap = ESP.getFreeHeap();
-  if (freeHeap < 50000) {
-    Serial.printf("[HEALTH] WARNING: Low memory - %u bytes\n", freeHeap);
-  }
-  
-  // Check WiFi signal strength
-  if (WiFi.status() == WL_CONNECTED) {
-    updateWiFiSignalStrength();
-    if (shouldLog) {
-      Serial.printf("[HEALTH] WiFi RSSI: %d dBm\n", wifiSignalStrength);
+    if (p->tot_len >= 14 && p->tot_len < DISCOVERY_MAX_PACKET && pbuf_memcmp(p, 0, "DISCOVER_TALLY", 14) == 0) {
+        target = discoveryQueue;  // Legacy plain-text probe
     }
     
-    if (wifiSignalStrength < -80 && shouldLog) {
-      Serial.println("[HEALTH] WARNING: Weak WiFi signal");
+    if (target == NULL) {
+        udpFramesRejected++;
+        pbuf_free(p);
+        return;
     }
-  }
-  
-  // Check heartbeat success rate
-  if (successfulHeartbeats + failedHeartbeats > 10) {
-    float successRate = (float)successfulHeartbeats / (successfulHeartbeats + failedHeartbeats) * 100;
-    if (shouldLog) {
-      Serial.printf("[HEALTH] Heartbeat success rate: %.1f%%\n", successRate);
+    
+    UdpFrame frame = { p, ip_addr_get_ip4_u32(addr), port };
+    if (xQueueSend(target, &frame, 0) != pdTRUE) {
+        udpQueueOverflows++;
+        pbuf_free(p);
+        return;
+    }
+    if (udpIngestWakeTask) xTaskNotifyGive(udpIngestWakeTask);
+}
+
+// lwIP pcbs must be created from the tcpip thread
+static err_t udpIngestBind(struct tcpip_api_call_data* call) {
+    UdpIngestCall* msg = (UdpIngestCall*)call;
+    
+    struct udp_pcb* pcb = udp_new();
+    if (!pcb) return ERR_MEM;
+    ip_set_option(pcb, SOF_BROADCAST);
+    if (DSCP_MARKING) pcb->tos = DSCP_TALLY << 2;  // Replies sent through udpIngestSend()
+    
+    err_t err = udp_bind(pcb, IP_ANY_TYPE, msg->port);
+    if (err == ERR_OK && msg->group != 0) {
+        ip4_addr_t group;
+        group.addr = msg->group;
+        err = igmp_joingroup(IP4_ADDR_ANY4, &group);
+    }
+    if (err != ERR_OK) {
+        udp_remove(pcb);
+        return err;
     }
     
-    if (successRate < 80) {
-      Serial.println("[HEALTH] WARNING: Low heartbeat success rate");
+    udp_recv(pcb, msg->recv, NULL);
+    msg->pcb = pcb;
+    return ERR_OK;
+}
+
+static struct udp_pcb* udpIngestOpen(uint16_t port, uint32_t group, udp_recv_fn recv) {
+    UdpIngestCall msg;
+    msg.port = port;
+    msg.group = group;
+    msg.recv = recv;
+    msg.pcb = NULL;
+    if (tcpip_api_call(udpIngestBind, &msg.call) != ERR_OK) {
+        Serial.printf("[UDP] Ingest could not bind port %d\n", port);
+        return NULL;
     }
-  }
-  
-  // Check battery status
-  Serial.printf("[HEALTH] Battery: %d%%, Power save: %s\n", 
-                batteryPercent, powerSaveMode ? "ON" : "OFF");
-  
-  Serial.println("[HEALTH] Health check complete");
+    return msg.pcb;
 }
 
-// Disable deep sleep mode completely
-void disableDeepSleep() {
-    deepSleepEnabled = false;
-    Serial.println("[POWER] Deep sleep DISABLED by user/system");
+static err_t udpIngestSendCall(struct tcpip_api_call_data* call) {
+    UdpSendCall* msg = (UdpSendCall*)call;
+    
+    struct pbuf* p = pbuf_alloc(PBUF_TRANSPORT, msg->length, PBUF_RAM);
+    if (!p) return ERR_MEM;
+    memcpy(p->payload, msg->data, msg->length);
+    ip_addr_t to = IPADDR4_INIT(msg->addr);
+    err_t err = udp_sendto(msg->pcb, p, &to, msg->port);
+    pbuf_free(p);
+    return err;
 }
 
-// Enable deep sleep mode (with safety checks)
-void enableDeepSleep() {
-    // Only enable if battery readings are reliable
-    if (batteryPercent > 5 && batteryPercent < 95) {
-        deepSleepEnabled = true;
-        Serial.println("[POWER] Deep sleep ENABLED");
-    } else {
-        Serial.printf("[POWER] Deep sleep NOT enabled - battery reading suspicious: %d%%\n", batteryPercent);
+// Send a datagram from the ingest pcb so it carries the EF marking. The
+// WiFiUDP sockets give no access to their descriptor and stay unmarked
+bool udpIngestSend(uint32_t addr, uint16_t port, const uint8_t* data, size_t length) {
+    if (!udpIngestPcb) return false;
+    UdpSendCall msg;
+    msg.pcb = udpIngestPcb;
+    msg.addr = addr;
+    msg.port = port;
+    msg.data = data;
+    msg.length = length;
+    return tcpip_api_call(udpIngestSendCall, &msg.call) == ERR_OK;
+}
+
+// Bind the ingest callback once; the pcbs listen on any address and
+// survive WiFi reconnects. Must be called from the loop task
+bool setupUdpIngest(uint16_t port) {
+    if (udpIngestPcb) return true;
+    
+    if (!discoveryQueue) discoveryQueue = xQueueCreate(UDP_INGEST_QUEUE_LEN, sizeof(UdpFrame));
+    if (!tallyQueue) tallyQueue = xQueueCreate(UDP_INGEST_QUEUE_LEN, sizeof(UdpFrame));
+    if (!discoveryQueue || !tallyQueue) return false;
+    
+    udpIngestWakeTask = xTaskGetCurrentTaskHandle();
+    
+    udpIngestPcb = udpIngestOpen(port, 0, udpIngestReceive);
+    if (!udpIngestPcb) return false;
+    
+    // Second tally path; without it only the redundant copies are lost
+    tallyMulticastPcb = udpIngestOpen(TALLY_MULTICAST_PORT, (uint32_t)IPAddress(TALLY_MULTICAST_GROUP), udpIngestReceive);
+    return true;
+}
+
+// Tally frames carry the same JSON as a /api/tally push. Multicast frames
+// addressed to other devices are skipped inside the pbuf; scene events are
+// for every device
+void handleUdpTally() {
+    if (!tallyQueue) return;
+    
+    if (tallyIdNeedle[0] == 0) {
+        snprintf(tallyIdNeedle, sizeof(tallyIdNeedle), "\"deviceId\":\"%s\"", deviceID.c_str());
+        snprintf(provisionNeedle, sizeof(provisionNeedle), "\"%s\":", macAddress.c_str());
+    }
+    uint16_t needleLength = strlen(tallyIdNeedle);
+    
+    UdpFrame frame;
+    while (xQueueReceive(tallyQueue, &frame, 0) == pdTRUE) {
+        bool fromServer = (uint32_t)hbServerIP == 0 || frame.addr == (uint32_t)hbServerIP;
+        if (fromServer && pbuf_memfind(frame.p, "\"type\":\"scene-event\"", 20, 0) != 0xFFFF) {
+            size_t length = pbuf_copy_partial(frame.p, pushBody, frame.p->tot_len, 0);
+            pushBody[length] = 0;
+            if (verifyFrameMac(pushBody, length)) handleSceneEvent(pushBody);
+        } else if (fromServer && pbuf_memfind(frame.p, "\"type\":\"fleet-provision\"", 24, 0) != 0xFFFF) {
+            if (pbuf_memfind(frame.p, provisionNeedle, strlen(provisionNeedle), 0) != 0xFFFF) {
+                size_t length = pbuf_copy_partial(frame.p, pushBody, frame.p->tot_len, 0);
+                pushBody[length] = 0;
+                if (verifyFrameMac(pushBody, length)) handleFleetProvision(pushBody, frame.addr, frame.port);
+            }
+        } else if (fromServer && pbuf_memfind(frame.p, tallyIdNeedle, needleLength, 0) != 0xFFFF) {
+            size_t length = pbuf_copy_partial(frame.p, pushBody, frame.p->tot_len, 0);
+            pushBody[length] = 0;
+            
+            if (verifyFrameMac(pushBody, length)) {
+                String reply;
+                applyTallyUpdate(String(pushBody), reply, TALLY_PATH_UDP);
+                udpTallyFrames++;
+            }
+        }
+        pbuf_free(frame.p);
+    }
+}
+
+// Apply this device's row of a provisioning frame and acknowledge it
+void handleFleetProvision(const char* body, uint32_t addr, uint16_t port) {
+    JsonDocument doc;
+    if (deserializeJson(doc, body)) return;
+    JsonObject row = doc["rows"][macAddress.c_str()];
+    if (row.isNull()) return;
+    
+    uint32_t epoch = doc["epoch"] | 0UL;
+    uint32_t id = doc["id"] | 0UL;
+    bool serverChanged = false;
+    if (epoch == provisionEpoch && id == provisionId) {
+        provisionRepeats++;                // The previous ack was lost
+    } else {
+        // Older provisioning, or a signed frame replayed before any was applied
+        bool stale = epoch < provisionEpoch || (epoch == provisionEpoch && id < provisionId);
+        if (frameKeyReady && provisionEpoch == 0 && clockSynced && doc["ts"].is<uint64_t>()) {
+            stale = (int64_t)serverNowMs() - (int64_t)doc["ts"].as<uint64_t>() > FRAME_MAX_AGE;
+        }
+        if (stale) {
+            provisionRejected++;
+            return;
+        }
+        
+        serverChanged = applyProvisionRow(row);
+        provisionEpoch = epoch;
+        provisionId = id;
+        saveProvisionState();
+        provisionsApplied++;
+        Serial.printf("[PROVISION] Provisioning %lu applied: %s\n", (unsigned long)id,
+                                    provisionChanged.length() > 0 ? provisionChanged.c_str() : "no changes");
+    }
+    
+    JsonDocument ack;
+    ack["type"] = "provision-ack";
+    ack["epoch"] = epoch;
+    ack["id"] = id;
+    ack["deviceId"] = deviceID;
+    ack["macAddress"] = macAddress;
+    ack["changed"] = provisionChanged;
+    char buffer[192];
+    size_t length = serializeJson(ack, buffer, sizeof(buffer));
+    udpIngestSend(addr, port, (const uint8_t*)buffer, length);
+    
+    // Register with the new server once the old one has its ack
+    if (serverChanged) registerDevice();
+}
+
+// Only the last applied frame is written, not the rest of the configuration
+void saveProvisionState() {
+    preferences.begin("obs-tally", false);
+    preferences.putUInt("provision_epoch", provisionEpoch);
+    preferences.putUInt("provision_id", provisionId);
+    preferences.end();
+}
+
+// Returns true if the server changed. provisionChanged lists what changed.
+// The server is "http://host:port" or "host[:port]"; https:// is refused
+bool applyProvisionRow(JsonObject row) {
+    provisionChanged = "";
+    bool serverChanged = false;
+    bool displayChanged = false;
+    
+    const char* name = row["name"];
+    if (name && name[0] && deviceName != name) {
+        deviceName = name;
+        displayChanged = true;
+        provisionChanged += "name,";
+    }
+    const char* source = row["source"];
+    if (source && assignedSource != source) {
+        assignedSource = source;
+        displayChanged = true;
+        provisionChanged += "source,";
+    }
+    const char* url = row["server"];
+    if (url && strncasecmp(url, "https://", 8) == 0) {
+        Serial.println("[PROVISION] Ignoring https:// server, only http:// is supported");
+    } else if (url && url[0]) {
+        String host = url;
+        if (host.startsWith("http://")) host = host.substring(7);
+        if (host.endsWith("/")) host.remove(host.length() - 1);
+        uint16_t port = 3005;
+        int colon = host.indexOf(':');
+        if (colon > 0) {
+            port = host.substring(colon + 1).toInt();
+            host = host.substring(0, colon);
+        }
+        if (port > 0 && (host != serverIP || port != serverPort)) {
+            serverIP = host;
+            serverPort = port;
+            serverURL = "http://" + serverIP + ":" + String(serverPort);
+            serverManual = true;
+            isRegistered = false;
+            serverChanged = true;
+            provisionChanged += "server,";
+        }
+    }
+    if (row["showRecording"].is<bool>() && row["showRecording"].as<bool>() != showRecordingStatus) {
+        showRecordingStatus = row["showRecording"].as<bool>();
+        displayChanged = true;
+        provisionChanged += "showRecording,";
+    }
+    if (row["showStreaming"].is<bool>() && row["showStreaming"].as<bool>() != showStreamingStatus) {
+        showStreamingStatus = row["showStreaming"].as<bool>();
+        displayChanged = true;
+        provisionChanged += "showStreaming,";
+    }
+    if (row["led"].is<bool>() && row["led"].as<bool>() == ledManuallyDisabled) {
+        ledManuallyDisabled = !row["led"].as<bool>();
+        if (ledManuallyDisabled) {
+            digitalWrite(LED_PIN, HIGH);  // Off
+        } else {
+            updateLED();
+        }
+        provisionChanged += "led,";
+    }
+    
+    if (displayChanged) updateDisplay();
+    if (provisionChanged.length() > 0) {
+        provisionChanged.remove(provisionChanged.length() - 1);
+        saveConfig();
+    }
+    return serverChanged;
+}
+
+// O(1) de-duplication: only the latest sequence number and the paths that
+// delivered it are kept. Returns true if the update should be applied
+bool acceptTallySequence(uint32_t epoch, uint32_t seq, bool redundant, uint8_t path) {
+    if (seq == 0) return true;         // Server without sequence numbers
+    uint8_t bit = 1 << path;
+    
+    // A restarted server numbers from 1 again
+    if (epoch != tallyEpoch) {
+        tallyEpoch = epoch;
+        lastTallySeq = 0;
+        lastTallyPaths = 0;
+    }
+    
+    if (seq == lastTallySeq) {
+        lastTallyPaths |= bit;
+        tallyDuplicates++;
+        return false;
+    }
+    if (seq < lastTallySeq) {
+        tallyStaleUpdates++;
+        return false;
+    }
+    
+    // The previous redundant update arrived on one path only: the other lost it
+    if (lastTallyRedundant && lastTallyPaths != 0 && (lastTallyPaths & (lastTallyPaths - 1)) == 0) {
+        redundancySaves++;
+    }
+    if (lastTallySeq != 0 && seq > lastTallySeq + 1) {
+        tallySeqGaps += seq - lastTallySeq - 1;
+    }
+    
+    lastTallySeq = seq;
+    lastTallyPaths = bit;
+    lastTallyRedundant = redundant;
+    tallyPathWins[path]++;
+    return true;
+}
+
+// Answer server discovery requests with a unicast reply to the requester.
+// Replies are delayed by a random amount so a fleet does not answer in one
+// burst, and repeated requests with the same id are answered only once.
+// Queued frames are drained completely each pass
+void handleDiscoveryRequest() {
+    if (WiFi.status() != WL_CONNECTED || !discoveryQueue) return;
+    
+    if (discoveryReplyPending && (long)(millis() - discoveryReplyAt) >= 0) {
+        sendDiscoveryReply();
+    }
+    
+    UdpFrame frame;
+    unsigned long burst = 0;
+    while (xQueueReceive(discoveryQueue, &frame, 0) == pdTRUE) {
+        processDiscoveryFrame(frame);
+        pbuf_free(frame.p);
+        burst++;
+    }
+    if (burst > udpMaxBurst) udpMaxBurst = burst;
+}
+
+// Request ids are echoed raw into the reply JSON, so only short ids made of
+// letters, digits, '-', '_', '.' and ':' are accepted. Older servers send no
+// requestId and their toISOString() timestamp stands in for it
+#define LEGACY_REQUEST_ID "2024-01-01T00:00:00.000Z"
+
+static constexpr bool requestIdChar(char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           c == '-' || c == '_' || c == '.' || c == ':';
+}
+
+static constexpr bool requestIdChars(const char* id) {
+    return *id == 0 || (requestIdChar(*id) && requestIdChars(id + 1));
+}
+
+static_assert(sizeof(LEGACY_REQUEST_ID) < DISCOVERY_ID_LEN && requestIdChars(LEGACY_REQUEST_ID),
+              "Discover requests from older servers would go unanswered");
+
+static bool validRequestId(const char* id) {
+    size_t length = 0;
+    for (; id[length]; length++) {
+        if (length >= DISCOVERY_ID_LEN - 1 || !requestIdChar(id[length])) return false;
+    }
+    return true;
+}
+
+void processDiscoveryFrame(const UdpFrame& frame) {
+    discoveryPacketsReceived++;
+    
+    // Single-segment frames are parsed straight out of the pbuf. The ingest
+    // callback already limits the length; the copy is clamped regardless
+    char copy[DISCOVERY_MAX_PACKET];
+    const char* data = (const char*)frame.p->payload;
+    size_t length = frame.p->tot_len;
+    if (frame.p->len < frame.p->tot_len) {
+        length = pbuf_copy_partial(frame.p, copy, min(length, sizeof(copy) - 1), 0);
+        copy[length] = 0;
+        data = copy;
+    }
+    
+    const char* requestId = "";
+    bool legacy = data[0] != '{';
+    JsonDocument doc;
+    if (!legacy) {
+        DeserializationError error = deserializeJson(doc, data, length);
+        if (error || doc["type"] != "discover-request") {
+            discoveryPacketsDropped++;
+            return;
+        }
+        
+        // Older servers send no requestId; their timestamp identifies the request
+        requestId = doc["requestId"] | (doc["timestamp"] | "");
+        if (!validRequestId(requestId)) {
+            discoveryPacketsDropped++;
+            return;
+        }
+        if (requestId[0]) {
+            for (int i = 0; i < DISCOVERY_RECENT_IDS; i++) {
+                if (strncmp(recentRequestIds[i], requestId, DISCOVERY_ID_LEN - 1) == 0) {
+                    discoveryDuplicates++;
+                    return;
+                }
+            }
+            strncpy(recentRequestIds[recentRequestIndex], requestId, DISCOVERY_ID_LEN - 1);
+            recentRequestIds[recentRequestIndex][DISCOVERY_ID_LEN - 1] = 0;
+            recentRequestIndex = (recentRequestIndex + 1) % DISCOVERY_RECENT_IDS;
+        }
+    }
+    // Otherwise a legacy plain-text probe, no request id
+    
+    // A newer request replaces a reply that is still waiting
+    discoveryReplyIP = IPAddress(frame.addr);
+    discoveryReplyPort = frame.port;
+    strncpy(discoveryReplyId, requestId, DISCOVERY_ID_LEN - 1);
+    discoveryReplyId[DISCOVERY_ID_LEN - 1] = 0;
+    discoveryReplyLegacy = legacy;
+    discoveryReplyAt = millis() + random(0, DISCOVERY_REPLY_SPREAD);
+    discoveryReplyPending = true;
+    
+    Serial.printf("[UDP] Discovery request from %s, reply scheduled\n", discoveryReplyIP.toString().c_str());
+}
+
+// Unicast reply: the cached announcement with the request id spliced in.
+// Servers that still send the plain-text probe only parse tally_device
+void sendDiscoveryReply() {
+    discoveryReplyPending = false;
+    if (discoveryReplyLegacy) {
+        JsonDocument response;
+        response["type"] = "tally_device";
+        response["id"] = deviceID;
+        response["name"] = deviceName;
+        response["model"] = DEVICE_MODEL;
+        response["version"] = FIRMWARE_VERSION;
+        response["ip"] = ipAddress;
+        response["mac"] = macAddress;
+        response["status"] = currentStatus;
+        response["uptime"] = millis() - bootTime;
+        
+        char buffer[256];
+        size_t length = serializeJson(response, buffer, sizeof(buffer));
+        if (udpIngestSend((uint32_t)discoveryReplyIP, discoveryReplyPort, (const uint8_t*)buffer, length)) {
+            discoveryRepliesSent++;
+        }
+        return;
+    }
+    if (!refreshAnnouncement()) return;
+    
+    const uint8_t* reply = (const uint8_t*)announcementCache;
+    size_t length = announcementLength;
+    char buffer[ANNOUNCE_BUFFER_SIZE + DISCOVERY_ID_LEN + 16];
+    if (discoveryReplyId[0]) {
+        length = snprintf(buffer, sizeof(buffer), "%.*s,\"requestId\":\"%s\"}",
+                          (int)announcementLength - 1, announcementCache, discoveryReplyId);
+        reply = (const uint8_t*)buffer;
+    }
+    if (udpIngestSend((uint32_t)discoveryReplyIP, discoveryReplyPort, reply, length)) {
+        discoveryRepliesSent++;
+    }
+}
+
+// Perform periodic health check to monitor device status (reduce logging frequency)
+void performHealthCheck() {
+  // Reduce health check logging frequency to minimize serial spam
+  static unsigned long lastHealthLog = 0;
+  bool shouldLog = (millis() - lastHealthLog > 300000); // Only log every 5 minutes
+  
+  if (shouldLog) {
+    Serial.println("[HEALTH] Performing health check...");
+    lastHealthLog = millis();
+  }
+  
+  // Check memory
+  uint32_t freeHeap = ESP.getFreeHeap();
+  if (freeHeap < 50000) {
+    Serial.printf("[HEALTH] WARNING: Low memory - %u bytes\n", freeHeap);
+  }
+  
+  // Check WiFi signal strength
+  if (WiFi.status() == WL_CONNECTED) {
+    updateWiFiSignalStrength();
+    if (shouldLog) {
+      Serial.printf("[HEALTH] WiFi RSSI: %d dBm\n", wifiSignalStrength);
+    }
+    
+    if (wifiSignalStrength < -80 && shouldLog) {
+      Serial.println("[HEALTH] WARNING: Weak WiFi signal");
+    }
+  }
+  
+  // Check heartbeat success rate
+  if (successfulHeartbeats + failedHeartbeats > 10) {
+    float successRate = (float)successfulHeartbeats / (successfulHeartbeats + failedHeartbeats) * 100;
+    if (shouldLog) {
+      Serial.printf("[HEALTH] Heartbeat success rate: %.1f%%\n", successRate);
+    }
+    
+    if (successRate < 80) {
+      Serial.println("[HEALTH] WARNING: Low heartbeat success rate");
+    }
+  }
+  
+  // Check battery status
+  Serial.printf("[HEALTH] Battery: %d%%, Power save: %s\n", 
+                batteryPercent, powerSaveMode ? "ON" : "OFF");
+  
+  Serial.println("[HEALTH] Health check complete");
+}
+
+// Disable deep sleep mode completely
+void disableDeepSleep() {
+    deepSleepEnabled = false;
+    Serial.println("[POWER] Deep sleep DISABLED by user/system");
+}
+
+// Enable deep sleep mode (with safety checks)
+void enableDeepSleep() {
+    // Only enable if battery readings are reliable
+    if (batteryPercent > 5 && batteryPercent < 95) {
+        deepSleepEnabled = true;
+        Serial.println("[POWER] Deep sleep ENABLED");
+    } else {
+        Serial.printf("[POWER] Deep sleep NOT enabled - battery reading suspicious: %d%%\n", batteryPercent);
+    }
+}
+
+// ==================== WIFI ROAMING FUNCTIONS ====================
+
+// Build the background scan channel plan: the non-overlapping 2.4 GHz channels
+// plus the channel we are currently associated on
+void setupRoaming() {
+    const uint8_t defaultChannels[] = {1, 6, 11};
+    roamChannelCount = 0;
+    roamChannelIndex = 0;
+    
+    for (uint8_t ch : defaultChannels) {
+        roamChannels[roamChannelCount++] = ch;
+    }
+    
+    int32_t current = WiFi.channel();
+    if (current > 0 && current != 1 && current != 6 && current != 11) {
+        roamChannels[roamChannelCount++] = current;
+    }
+    
+    roamCandidateCount = 0;
+    lastRoamScan = millis();
+    Serial.printf("[ROAM] Roaming manager ready - threshold %d dBm, %d scan channels\n",
+                  ROAM_RSSI_THRESHOLD, roamChannelCount);
+}
+
+// Called every loop. Runs one short single-channel scan at a time while the
+// signal is weak and moves to a better BSSID of the same SSID while tally is idle
+void updateRoaming() {
+    unsigned long now = millis();
+    
+    if (roamInProgress) {
+        if (WiFi.status() == WL_CONNECTED) {
+            roamInProgress = false;
+            lastRoamDuration = now - roamStartTime;
+            roamCount++;
+            
+            String newIP = WiFi.localIP().toString();
+            bool ipChanged = (newIP != ipAddress);
+            ipAddress = newIP;
+            Serial.printf("[ROAM] Roamed to %s (ch %d, %d dBm) in %lu ms\n",
+                          WiFi.BSSIDstr().c_str(), WiFi.channel(), WiFi.RSSI(), lastRoamDuration);
+            if (ipChanged) {
+                announceDevice();
+            }
+        } else if (now - roamStartTime > ROAM_CONNECT_TIMEOUT) {
+            roamInProgress = false;
+            failedRoams++;
+            Serial.println("[ROAM] Roam attempt timed out, reconnecting to any AP");
+            WiFi.disconnect();
+            clearBssidLock();
+            WiFi.begin();
+        }
+        return;
+    }
+    
+    if (WiFi.status() != WL_CONNECTED) return;
+    
+    // Collect the results of a finished scan step
+    if (roamScanRunning) {
+        int16_t found = WiFi.scanComplete();
+        if (found == WIFI_SCAN_RUNNING) return;
+        roamScanRunning = false;
+        if (found > 0) {
+            collectRoamCandidates(found);
+        }
+        WiFi.scanDelete();
+    }
+    
+    // Age out candidates we have not heard from recently (order preserved)
+    int kept = 0;
+    for (int i = 0; i < roamCandidateCount; i++) {
+        if (now - roamCandidates[i].lastSeen <= ROAM_CANDIDATE_TTL) {
+            roamCandidates[kept++] = roamCandidates[i];
+        }
+    }
+    roamCandidateCount = kept;
+    
+    int32_t rssi = WiFi.RSSI();
+    if (rssi >= ROAM_RSSI_THRESHOLD) return;
+    
+    // Candidates are kept sorted strongest first
+    if (roamCandidateCount > 0 && !isProgram && !isPreview &&
+        roamCandidates[0].rssi >= rssi + ROAM_RSSI_HYSTERESIS) {
+        startRoam(roamCandidates[0]);
+        return;
+    }
+    
+    if (now - lastRoamScan > ROAM_SCAN_INTERVAL && roamChannelCount > 0) {
+        uint8_t channel = roamChannels[roamChannelIndex];
+        roamChannelIndex = (roamChannelIndex + 1) % roamChannelCount;
+        
+        String ssid = WiFi.SSID();
+        int16_t result = WiFi.scanNetworks(true, false, false, ROAM_SCAN_DWELL_MS, channel, ssid.c_str());
+        roamScanRunning = (result == WIFI_SCAN_RUNNING);
+        lastRoamScan = now;
+        roamScans++;
+    }
+}
+
+// Merge scan results for our SSID into the ranked candidate list
+void collectRoamCandidates(int16_t found) {
+    String ssid = WiFi.SSID();
+    uint8_t* currentBSSID = WiFi.BSSID();
+    unsigned long now = millis();
+    
+    for (int16_t i = 0; i < found; i++) {
+        if (WiFi.SSID(i) != ssid) continue;
+        
+        uint8_t* bssid = WiFi.BSSID(i);
+        if (currentBSSID && memcmp(bssid, currentBSSID, 6) == 0) continue;
+        
+        int slot = -1;
+        for (int j = 0; j < roamCandidateCount; j++) {
+            if (memcmp(roamCandidates[j].bssid, bssid, 6) == 0) {
+                slot = j;
+                break;
+            }
+        }
+        
+        if (slot < 0) {
+            if (roamCandidateCount < MAX_ROAM_CANDIDATES) {
+                slot = roamCandidateCount++;
+            } else if (WiFi.RSSI(i) > roamCandidates[MAX_ROAM_CANDIDATES - 1].rssi) {
+                slot = MAX_ROAM_CANDIDATES - 1;
+            } else {
+                continue;
+            }
+            memcpy(roamCandidates[slot].bssid, bssid, 6);
+        }
+        
+        roamCandidates[slot].channel = WiFi.channel(i);
+        roamCandidates[slot].rssi = WiFi.RSSI(i);
+        roamCandidates[slot].lastSeen = now;
+        
+        // Keep the channel plan aware of channels where candidates live
+        bool known = false;
+        for (int c = 0; c < roamChannelCount; c++) {
+            if (roamChannels[c] == roamCandidates[slot].channel) known = true;
+        }
+        if (!known && roamChannelCount < MAX_ROAM_CHANNELS) {
+            roamChannels[roamChannelCount++] = roamCandidates[slot].channel;
+        }
+    }
+    
+    // Insertion sort, strongest first (list is tiny)
+    for (int i = 1; i < roamCandidateCount; i++) {
+        RoamCandidate key = roamCandidates[i];
+        int j = i - 1;
+        while (j >= 0 && roamCandidates[j].rssi < key.rssi) {
+            roamCandidates[j + 1] = roamCandidates[j];
+            j--;
+        }
+        roamCandidates[j + 1] = key;
+    }
+}
+
+// Reassociate to a specific BSSID using the current credentials
+void startRoam(const RoamCandidate& candidate) {
+    String ssid = WiFi.SSID();
+    String psk = WiFi.psk();
+    RoamCandidate target = candidate;
+    
+    Serial.printf("[ROAM] Current %d dBm, roaming to candidate on ch %d at %d dBm\n",
+                  WiFi.RSSI(), target.channel, target.rssi);
+    
+    // Drop the candidate so a failed attempt is not retried immediately
+    for (int i = 1; i < roamCandidateCount; i++) {
+        roamCandidates[i - 1] = roamCandidates[i];
+    }
+    roamCandidateCount--;
+    
+    roamInProgress = true;
+    roamStartTime = millis();
+    WiFi.begin(ssid.c_str(), psk.c_str(), target.channel, target.bssid);
+}
+
+// WiFi.begin() with a BSSID stores a locked STA config that later
+// WiFi.begin()/reconnect() calls reuse; clear it so any AP of the SSID qualifies
+void clearBssidLock() {
+    wifi_config_t conf;
+    if (esp_wifi_get_config(WIFI_IF_STA, &conf) != ESP_OK || !conf.sta.bssid_set) return;
+    conf.sta.bssid_set = false;
+    esp_wifi_set_config(WIFI_IF_STA, &conf);
+}
+
+// ==================== SNAPSHOT CACHE FUNCTIONS ====================
+
+uint32_t fnv1a(uint32_t hash, const void* data, size_t length) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+size_t SnapshotHash::write(uint8_t b) {
+    hash = fnv1a(hash, &b, 1);
+    return 1;
+}
+
+size_t SnapshotHash::write(const uint8_t* data, size_t length) {
+    hash = fnv1a(hash, data, length);
+    return length;
+}
+
+bool snapshotVolatile(const char* parent, const char* key) {
+    for (const char* entry : snapshotVolatileKeys) {
+        const char* slash = strchr(entry, '/');
+        if (slash == NULL) {
+            if (strcmp(entry, key) == 0) return true;
+        } else if (strlen(parent) == (size_t)(slash - entry) && strncmp(entry, parent, slash - entry) == 0 &&
+                   strcmp(slash + 1, key) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Hash a document field by field, skipping volatile keys. Array elements
+// take the array's key as their parent
+void hashSnapshotFields(JsonVariant value, const char* parent, SnapshotHash& out) {
+    if (value.is<JsonObject>()) {
+        out.write('{');
+        for (JsonPair field : value.as<JsonObject>()) {
+            const char* key = field.key().c_str();
+            if (snapshotVolatile(parent, key)) continue;
+            out.write((const uint8_t*)key, strlen(key) + 1);
+            hashSnapshotFields(field.value(), key, out);
+        }
+        out.write('}');
+    } else if (value.is<JsonArray>()) {
+        out.write('[');
+        for (JsonVariant item : value.as<JsonArray>()) hashSnapshotFields(item, parent, out);
+        out.write(']');
+    } else {
+        serializeJson(value, out);
+    }
+}
+
+// Answer a status endpoint from its cached snapshot. The document is built
+// to fingerprint it; a poller that sends back the ETag is answered without
+// serialising or sending it while the state is unchanged
+void sendSnapshot(SnapshotEndpoint endpoint, void (*build)(JsonDocument&)) {
+    StatusSnapshot& snapshot = snapshots[endpoint];
+    JsonDocument doc;
+    build(doc);
+    SnapshotHash stable;
+    hashSnapshotFields(doc, "", stable);
+    if (snapshot.version == 0 || stable.hash != snapshot.fingerprint) {
+        snapshot.fingerprint = stable.hash;
+        snapshot.version = ++stateVersion;
+    }
+    
+    char etag[24];
+    snprintf(etag, sizeof(etag), "W/\"%08lx-%lu\"", (unsigned long)snapshotBootId, (unsigned long)snapshot.version);
+    webServer.sendHeader("ETag", etag);
+    webServer.sendHeader("Cache-Control", "no-cache");
+    if (webServer.header("If-None-Match") == etag) {
+        snapshotNotModified++;
+        webServer.send(304);
+        return;
+    }
+    
+    if (snapshot.body.length() == 0 || snapshot.bodyVersion != snapshot.version ||
+        millis() - snapshot.builtAt > SNAPSHOT_MAX_AGE) {
+        snapshot.body = "";
+        serializeJson(doc, snapshot.body);
+        snapshot.bodyVersion = snapshot.version;
+        snapshot.builtAt = millis();
+        snapshotBuilds++;
+    } else {
+        snapshotHits++;
+    }
+    webServer.send(200, "application/json", snapshot.body);
+}
+
+void buildFirmwareInfo(JsonDocument& doc) {
+    doc["device_type"] = DEVICE_MODEL;
+    doc["firmware_version"] = FIRMWARE_VERSION;
+    doc["model"] = "M5StickC-PLUS";
+    doc["device_name"] = deviceName;
+    doc["mac"] = WiFi.macAddress();
+    doc["uptime"] = millis() / 1000;
+}
+
+void buildDeviceInfo(JsonDocument& doc) {
+    doc["device_type"] = DEVICE_MODEL;
+    doc["firmware_version"] = FIRMWARE_VERSION;
+    doc["device_name"] = deviceName;
+    doc["assigned_source"] = assignedSource;
+    doc["ip"] = WiFi.localIP().toString();
+    doc["mac"] = WiFi.macAddress();
+    doc["hostname"] = hostname;
+    doc["led_disabled"] = ledManuallyDisabled;
+    JsonObject wifi = doc["wifi"].to<JsonObject>();
+    wifi["rssi"] = WiFi.RSSI();
+    wifi["bssid"] = WiFi.BSSIDstr();
+    wifi["roam_count"] = roamCount;
+    wifi["failed_roams"] = failedRoams;
+    wifi["last_roam_ms"] = lastRoamDuration;
+    wifi["roam_scans"] = roamScans;
+    wifi["roam_candidates"] = roamCandidateCount;
+    wifi["reconnect_state"] = reconnectStateName();
+    wifi["reconnect_count"] = reconnectCount;
+    wifi["last_outage_ms"] = lastOutageDuration;
+    wifi["last_reconnect_to_tally_ms"] = lastReconnectToTally;
+    wifi["session_resumes"] = sessionResumes;
+    wifi["full_reregistrations"] = fullReregistrations;
+    int dashboardWatchers = 0;
+    for (int i = 0; i < DASHBOARD_MAX_CLIENTS; i++) {
+        if (dashboardClients[i].connected()) dashboardWatchers++;
+    }
+    JsonObject dashboard = doc["dashboard"].to<JsonObject>();
+    dashboard["clients"] = dashboardWatchers;
+    dashboard["events"] = dashboardEvents;
+    dashboard["event_bytes"] = dashboardEventBytes;
+    dashboard["drops"] = dashboardDrops;
+    JsonObject portal = doc["portal"].to<JsonObject>();
+    portal["scans"] = portalScans;
+    portal["last_ap_to_link_ms"] = lastPortalApToLink;
+    portal["last_ap_to_tally_ms"] = lastPortalApToTally;
+    JsonObject discovery = doc["discovery"].to<JsonObject>();
+    discovery["boot_to_register_ms"] = bootToRegister;
+    JsonObject subscription = doc["subscription"].to<JsonObject>();
+    subscription["enabled"] = subscribeMode;
+    subscription["armed"] = subArmed;
+    subscription["connections"] = subscribeConnections;
+    subscription["updates"] = subscribeUpdates;
+    subscription["timeouts"] = subscribeTimeouts;
+    subscription["errors"] = subscribeErrors;
+    subscription["last_wait_ms"] = subscribeLastWaitMs;
+    JsonObject negotiation = doc["negotiation"].to<JsonObject>();
+    negotiation["transport"] = negotiatedTransport;
+    negotiation["redundant"] = negotiatedRedundant;
+    negotiation["max_frame"] = negotiatedMaxFrame;
+    negotiation["clock_synced"] = clockSynced;
+    negotiation["last_delivery_ms"] = lastDeliveryMs;
+    negotiation["max_delivery_ms"] = maxDeliveryMs;
+    JsonObject mqtt = doc["mqtt"].to<JsonObject>();
+    mqtt["broker"] = activeMqttBroker();
+    mqtt["port"] = mqttPort;
+    mqtt["qos"] = mqttQos;
+    mqtt["connected"] = mqttClient.connected();
+    mqtt["connects"] = mqttConnects;
+    mqtt["failures"] = mqttFailures;
+    mqtt["messages"] = mqttMessages;
+    mqtt["last_apply_us"] = mqttLastApplyUs;
+    JsonObject obs = doc["obs"].to<JsonObject>();
+    obs["tally_mode"] = tallyMode;
+    obs["host"] = obsHost;
+    obs["port"] = obsPort;
+    obs["identified"] = obsIdentified;
+    obs["program_scene"] = obsProgramScene;
+    obs["preview_scene"] = obsPreviewScene;
+    obs["in_program"] = obsInProgram;
+    obs["in_preview"] = obsInPreview;
+    obs["connects"] = obsConnects;
+    obs["failures"] = obsFailures;
+    obs["events"] = obsEvents;
+    obs["skipped_frames"] = obsSkippedFrames;
+    obs["streamed_frames"] = obsStreamedFrames;
+    obs["request_timeouts"] = obsRequestTimeouts;
+    obs["last_apply_us"] = obsLastApplyUs;
+    JsonObject tsl = doc["tsl"].to<JsonObject>();
+    tsl["port"] = tslPort;
+    tsl["index"] = tslIndex;
+    tsl["listening"] = tslListening;
+    tsl["following"] = tslSeen;
+    tsl["tally"] = tslTally;
+    tsl["packets"] = tslPackets;
+    tsl["matched"] = tslMatched;
+    tsl["malformed"] = tslMalformed;
+    tsl["tcp_packets"] = tslTcpPackets;
+    tsl["tcp_connected"] = (bool)tslClient.connected();
+    tsl["last_apply_us"] = tslLastApplyUs;
+    JsonObject feedInfo = doc["feeds"].to<JsonObject>();
+    feedInfo["merging"] = tallyMode == TALLY_MODE_MERGE;
+    feedInfo["rule"] = mergeRule;
+    feedInfo["priority"] = feedPriority;
+    feedInfo["program_feeds"] = feedProgramCount;
+    feedInfo["preview_feeds"] = feedPreviewCount;
+    for (uint8_t i = 0; i < FEED_COUNT; i++) {
+        const FeedState& feed = feeds[i];
+        JsonObject info = feedInfo[feedNames[i]].to<JsonObject>();
+        info["active"] = feed.active;
+        info["state"] = feed.program ? "program" : (feed.preview ? "preview" : "idle");
+        info["seq"] = feed.seq;
+        info["changes"] = feed.changes;
+        info["contributes"] = feedContributes(i);
+        if (feed.updatedAt != 0) info["age_ms"] = millis() - feed.updatedAt;
+    }
+    JsonObject auth = doc["frame_auth"].to<JsonObject>();
+    auth["enabled"] = frameKeyReady;
+    auth["verified"] = frameMacVerified;
+    auth["rejected"] = frameMacRejected;
+    auth["replays"] = frameReplays;
+    auth["last_verify_us"] = frameMacLastUs;
+    auth["max_verify_us"] = frameMacMaxUs;
+    JsonObject provision = doc["provisioning"].to<JsonObject>();
+    provision["last_id"] = provisionId;
+    provision["last_changed"] = provisionChanged;
+    provision["applied"] = provisionsApplied;
+    provision["repeats"] = provisionRepeats;
+    provision["rejected"] = provisionRejected;
+    JsonObject scene = doc["scene_graph"].to<JsonObject>();
+    scene["negotiated"] = sceneGraphNegotiated;
+    scene["loaded"] = sceneGraphValid;
+    scene["source"] = sceneGraphSource;
+    scene["program"] = sceneGraphProgram;
+    scene["preview"] = sceneGraphPreview;
+    scene["seq"] = sceneGraphSeq;
+    scene["edges"] = sceneEdgeCount;
+    scene["loads"] = sceneGraphLoads;
+    scene["events"] = sceneGraphEvents;
+    scene["resyncs"] = sceneGraphResyncs;
+    scene["last_apply_us"] = sceneGraphLastApplyUs;
+    JsonObject redundancy = doc["redundancy"].to<JsonObject>();
+    redundancy["last_seq"] = lastTallySeq;
+    redundancy["push_wins"] = tallyPathWins[TALLY_PATH_PUSH];
+    redundancy["udp_wins"] = tallyPathWins[TALLY_PATH_UDP];
+    redundancy["poll_wins"] = tallyPathWins[TALLY_PATH_POLL];
+    redundancy["mqtt_wins"] = tallyPathWins[TALLY_PATH_MQTT];
+    redundancy["duplicates"] = tallyDuplicates;
+    redundancy["stale_updates"] = tallyStaleUpdates;
+    redundancy["saves"] = redundancySaves;
+    redundancy["seq_gaps"] = tallySeqGaps;
+    JsonObject push = doc["push"].to<JsonObject>();
+    push["port"] = PUSH_PORT;
+    push["accepted"] = pushAccepted;
+    push["rejected"] = pushRejected;
+    push["idle_closes"] = pushIdleCloses;
+    push["requests"] = pushRequests;
+    push["reused_requests"] = pushReusedRequests;
+    push["reuse_ratio"] = pushRequests > 0 ? (float)pushReusedRequests / pushRequests : 0;
+    push["last_latency_us"] = pushLastLatencyUs;
+    push["avg_latency_us"] = (unsigned long)pushAvgLatencyUs;
+    push["max_latency_us"] = pushMaxLatencyUs;
+    JsonObject resolver = doc["resolver"].to<JsonObject>();
+    resolver["entries"] = resolverCount;
+    resolver["hits"] = resolverHits;
+    resolver["stale_hits"] = resolverStaleHits;
+    resolver["negative_hits"] = resolverNegativeHits;
+    resolver["misses"] = resolverMisses;
+    resolver["refreshes"] = resolverRefreshes;
+    resolver["failures"] = resolverFailures;
+    resolver["last_lookup_ms"] = lastLookupDuration;
+    JsonObject hb = doc["heartbeat_client"].to<JsonObject>();
+    hb["template_builds"] = hbTemplateBuilds;
+    hb["connections"] = hbConnections;
+    hb["reused_connections"] = hbReusedConnections;
+#ifdef HEAP_ALLOC_COUNT
+    hb["allocations"] = hbAllocs;
+#endif
+    hb["stale_retries"] = hbStaleRetries;
+    JsonObject ingest = doc["udp_ingest"].to<JsonObject>();
+    ingest["frames_received"] = (unsigned long)udpFramesReceived;
+    ingest["frames_rejected"] = (unsigned long)udpFramesRejected;
+    ingest["queue_overflows"] = (unsigned long)udpQueueOverflows;
+    ingest["max_burst"] = udpMaxBurst;
+    ingest["tally_frames"] = udpTallyFrames;
+    discovery["udp_received"] = discoveryPacketsReceived;
+    discovery["udp_dropped"] = discoveryPacketsDropped;
+    discovery["udp_duplicates"] = discoveryDuplicates;
+    discovery["udp_replies"] = discoveryRepliesSent;
+    discovery["announcements"] = announcementsSent;
+    discovery["announcements_suppressed"] = announcementsSuppressed;
+    discovery["announcement_rebuilds"] = announcementRebuilds;
+    discovery["mdns_servers"] = mdnsServerCount;
+    discovery["mdns_browses"] = mdnsBrowses;
+    discovery["server_manual"] = serverManual;
+    discovery["server_switches"] = serverSwitches;
+    JsonObject tx = wifi["tx_power"].to<JsonObject>();
+    tx["dbm"] = txPowerDbm[txPowerLevel];
+    tx["level"] = txPowerLevel;
+    tx["rssi_avg"] = rssiEwma;
+    tx["changes"] = txPowerChanges;
+    JsonArray levels = tx["levels"].to<JsonArray>();
+    for (int i = 0; i < TXPOWER_LEVEL_COUNT; i++) {
+        unsigned long total = txLevelHeartbeats[i] + txLevelFailures[i];
+        if (total == 0 && txLevelTime[i] == 0) continue;
+        JsonObject level = levels.add<JsonObject>();
+        level["dbm"] = txPowerDbm[i];
+        level["time_ms"] = txLevelTime[i];
+        level["heartbeats"] = total;
+        level["failed"] = txLevelFailures[i];
+        level["loss_pct"] = total > 0 ? (100.0 * txLevelFailures[i] / total) : 0.0;
+    }
+    JsonObject state = doc["state"].to<JsonObject>();
+    state["preview"] = isPreview;
+    state["program"] = isProgram;
+    state["streaming"] = isStreaming;
+    state["recording"] = isRecording;
+    state["connected"] = serverConnected;
+    state["stale"] = tallyStale;
+    
+    JsonObject snapshot = doc["snapshot"].to<JsonObject>();
+    snapshot["version"] = stateVersion;
+    snapshot["builds"] = snapshotBuilds;
+    snapshot["hits"] = snapshotHits;
+    snapshot["not_modified"] = snapshotNotModified;
+}
+
+// ==================== PORTAL FUNCTIONS ====================
+
+// Called every loop until the first link. Scans run asynchronously so the
+// portal, display and buttons stay responsive; a scan that sees the saved
+// SSID starts an association straight to that BSSID and channel
+void updatePortal() {
+    unsigned long now = millis();
+    wifiManager.process();
+    
+    if (WiFi.status() == WL_CONNECTED) {
+        leavePortal();
+        return;
+    }
+    
+    // Timed out with nothing saved to wait for: open it again
+    if (!wifiManager.getConfigPortalActive() && portalSavedSsid.length() == 0) {
+        Serial.println("[PORTAL] Timed out without credentials, reopening");
+        portalStartTime = now;
+        wifiManager.startConfigPortal(portalApName.c_str(), CONFIG_PORTAL_PASSWORD);
+    }
+    
+    if (portalConnecting) {
+        if (now - portalConnectStart < PORTAL_CONNECT_TIMEOUT) return;
+        Serial.printf("[PORTAL] Could not join %s, scanning again\n", portalSavedSsid.c_str());
+        portalConnecting = false;
+        portalApSeenTime = 0;
+        WiFi.disconnect();
+    }
+    
+    if (portalScanRunning) {
+        int16_t found = WiFi.scanComplete();
+        if (found == WIFI_SCAN_RUNNING) return;
+        portalScanRunning = false;
+        if (found >= 0) cachePortalScan(found);
+        WiFi.scanDelete();
+    } else if (portalSavedSsid.length() > 0 && now - portalLastBlind > PORTAL_BLIND_RETRY) {
+        Serial.printf("[PORTAL] Trying %s without a scan result\n", portalSavedSsid.c_str());
+        portalLastBlind = now;
+        portalApSeenTime = now;
+        portalConnecting = true;
+        portalConnectStart = now;
+        WiFi.begin(portalSavedSsid.c_str(), wifiManager.getWiFiPass().c_str());
+    } else if (now - portalLastScan > PORTAL_SCAN_INTERVAL) {
+        portalLastScan = now;
+        portalScanRunning = WiFi.scanNetworks(true) == WIFI_SCAN_RUNNING;
+    }
+    
+    static unsigned long lastPortalDraw = 0;
+    if (now - lastPortalDraw > 1000) {
+        drawPortalStatus();
+        lastPortalDraw = now;
+    }
+}
+
+void cachePortalScan(int16_t found) {
+    portalScans++;
+    portalNetworkCount = 0;
+    int saved = -1;
+    
+    for (int16_t i = 0; i < found; i++) {
+        String ssid = WiFi.SSID(i);
+        if (ssid.length() == 0) continue;
+        if (ssid == portalSavedSsid && (saved < 0 || WiFi.RSSI(i) > WiFi.RSSI(saved))) saved = i;
+        
+        // Strongest entry per SSID, capped, for the portal page
+        int slot = -1;
+        for (int j = 0; j < portalNetworkCount; j++) {
+            if (ssid == portalNetworks[j].ssid) slot = j;
+        }
+        if (slot < 0) {
+            if (portalNetworkCount >= PORTAL_MAX_NETWORKS) continue;
+            slot = portalNetworkCount++;
+            strncpy(portalNetworks[slot].ssid, ssid.c_str(), sizeof(portalNetworks[slot].ssid) - 1);
+            portalNetworks[slot].ssid[sizeof(portalNetworks[slot].ssid) - 1] = 0;
+            portalNetworks[slot].rssi = -127;
+        }
+        if (WiFi.RSSI(i) > portalNetworks[slot].rssi) {
+            portalNetworks[slot].rssi = WiFi.RSSI(i);
+            portalNetworks[slot].channel = WiFi.channel(i);
+            portalNetworks[slot].open = WiFi.encryptionType(i) == WIFI_AUTH_OPEN;
+        }
+    }
+    
+    if (saved >= 0) {
+        // Joining on another channel moves the portal AP with it; portal
+        // clients reconnect, and on success the portal closes anyway.
+        // No BSSID: a locked config would stick to this AP on later reconnects
+        Serial.printf("[PORTAL] %s is back (%d dBm, ch %d), joining\n", portalSavedSsid.c_str(), WiFi.RSSI(saved), WiFi.channel(saved));
+        portalApSeenTime = millis();
+        portalConnecting = true;
+        portalConnectStart = portalApSeenTime;
+        WiFi.begin(portalSavedSsid.c_str(), wifiManager.getWiFiPass().c_str());
+    }
+}
+
+// Linked: close the portal and bring up normal operation in place
+void leavePortal() {
+    if (portalApSeenTime) {
+        lastPortalApToLink = millis() - portalApSeenTime;
+        Serial.printf("[PORTAL] Joined %lu ms after the saved network reappeared\n", lastPortalApToLink);
+    }
+    if (wifiManager.getConfigPortalActive()) {
+        wifiManager.stopConfigPortal();
+    }
+    WiFi.mode(WIFI_STA);
+    configMode = false;
+    portalConnecting = false;
+    portalScanRunning = false;
+    
+    completeWiFiSetup();
+    startNetworkServices();
+    updateDisplay();
+}
+
+void drawPortalScreen() {
+    M5.Lcd.fillScreen(TFT_RED);
+    M5.Lcd.setTextSize(2);
+    M5.Lcd.setTextColor(TFT_WHITE);
+    M5.Lcd.setCursor(10, 20);
+    M5.Lcd.println("WiFi Failed");
+    M5.Lcd.setCursor(10, 40);
+    M5.Lcd.println("AP Mode:");
+    M5.Lcd.setCursor(10, 60);
+    M5.Lcd.println(portalApName);
+    drawPortalStatus();
+}
+
+void drawPortalStatus() {
+    static bool blinkState = false;
+    blinkState = !blinkState;
+    
+    M5.Lcd.setTextSize(2);
+    M5.Lcd.setTextColor(blinkState ? TFT_YELLOW : TFT_RED);
+    M5.Lcd.setCursor(10, 80);
+    M5.Lcd.println("Config Mode");
+    
+    M5.Lcd.fillRect(0, 102, SCREEN_WIDTH, SCREEN_HEIGHT - 102, TFT_RED);
+    M5.Lcd.setTextSize(1);
+    M5.Lcd.setTextColor(TFT_WHITE);
+    M5.Lcd.setCursor(10, 105);
+    if (portalConnecting) {
+        M5.Lcd.print("Joining " + portalSavedSsid + "...");
+    } else if (portalSavedSsid.length() > 0) {
+        M5.Lcd.print("Waiting for " + portalSavedSsid + " (" + String(portalNetworkCount) + " nearby)");
+    } else {
+        M5.Lcd.print(String(portalNetworkCount) + " networks nearby");
+    }
+    
+    M5.Lcd.setCursor(10, 120);
+    if (wifiManager.getConfigPortalActive()) {
+        unsigned long elapsed = (millis() - portalStartTime) / 1000;
+        M5.Lcd.print("Portal timeout: " + String(elapsed < CONFIG_PORTAL_TIMEOUT ? CONFIG_PORTAL_TIMEOUT - elapsed : 0) + "s");
+    } else {
+        M5.Lcd.print("Portal closed, still retrying");
+    }
+}
+
+// Scan cache for the portal page; never scans itself
+void handlePortalNetworks() {
+    JsonDocument doc;
+    doc["age"] = portalScans ? (millis() - portalLastScan) / 1000 : -1;
+    JsonArray networks = doc["networks"].to<JsonArray>();
+    for (int i = 0; i < portalNetworkCount; i++) {
+        JsonObject network = networks.add<JsonObject>();
+        network["ssid"] = portalNetworks[i].ssid;
+        network["rssi"] = portalNetworks[i].rssi;
+        network["channel"] = portalNetworks[i].channel;
+        network["open"] = portalNetworks[i].open;
+    }
+    
+    String response;
+    serializeJson(doc, response);
+    wifiManager.server->send(200, "application/json", response);
+}
+
+// ==================== RECONNECT FUNCTIONS ====================
+
+// Enter the reconnect state machine. The last tally frame stays on screen
+// with a stale badge instead of being replaced by a "WiFi Lost" screen
+void beginReconnect() {
+    wifiLostTime = millis();
+    reconnectState = RECONNECT_FAST;
+    reconnectAttempts = 0;
+    reconnectBackoff = RECONNECT_BACKOFF_MIN;
+    reconnectDelay = RECONNECT_BACKOFF_MIN;
+    lastReconnectAttempt = 0;
+    roamScanRunning = false;
+    tallyStale = true;
+}
+
+// Called every loop while the link is down:
+// fast retries -> exponential backoff -> full rescan, then back to backoff
+void updateReconnect() {
+    unsigned long now = millis();
+    
+    switch (reconnectState) {
+        case RECONNECT_IDLE:
+            beginReconnect();
+            break;
+            
+        case RECONNECT_FAST:
+            if (now - lastReconnectAttempt < RECONNECT_FAST_INTERVAL) break;
+            if (reconnectAttempts >= RECONNECT_FAST_ATTEMPTS) {
+                Serial.println("[WIFI] Fast reconnect failed, backing off");
+                reconnectState = RECONNECT_BACKOFF;
+                reconnectAttempts = 0;
+                break;
+            }
+            WiFi.reconnect();
+            reconnectAttempts++;
+            lastReconnectAttempt = now;
+            break;
+            
+        case RECONNECT_BACKOFF:
+            if (now - lastReconnectAttempt < reconnectDelay) break;
+            if (reconnectAttempts >= RECONNECT_BACKOFF_ATTEMPTS) {
+                Serial.println("[WIFI] Backoff exhausted, full rescan");
+                reconnectState = RECONNECT_RESCAN;
+                reconnectAttempts = 0;
+                WiFi.disconnect();
+                clearBssidLock();
+                WiFi.begin();
+                lastReconnectAttempt = now;
+                connectionAttempts++;
+                break;
+            }
+            WiFi.reconnect();
+            reconnectAttempts++;
+            lastReconnectAttempt = now;
+            reconnectBackoff = min((unsigned long)RECONNECT_BACKOFF_MAX, reconnectBackoff * 2);
+            reconnectDelay = reconnectBackoff + random(0, RECONNECT_JITTER);
+            Serial.printf("[WIFI] Reconnect attempt %d, next in %lu ms\n", reconnectAttempts, reconnectDelay);
+            break;
+            
+        case RECONNECT_RESCAN:
+            if (now - lastReconnectAttempt < RECONNECT_RESCAN_TIMEOUT) break;
+            Serial.println("[WIFI] Rescan timed out, resuming backoff");
+            reconnectState = RECONNECT_BACKOFF;
+            reconnectAttempts = 0;
+            reconnectBackoff = RECONNECT_BACKOFF_MAX;
+            reconnectDelay = reconnectBackoff + random(0, RECONNECT_JITTER);
+            lastReconnectAttempt = now;
+            break;
+    }
+}
+
+// Lightweight session resume: the server confirms it still knows this device
+// and returns the current tally state. Falls back to full registration on 404
+void resumeSession() {
+    if (serverURL.length() == 0) {
+        return;
+    }
+    
+    HTTPClient http;
+    http.begin(resolvedURL(serverURL) + "/api/esp32/resume");
+    http.addHeader("Content-Type", "application/json");
+    
+    JsonDocument doc;
+    doc["deviceId"] = deviceID;
+    doc["ipAddress"] = ipAddress;
+    doc["assignedSource"] = assignedSource;
+    
+    String jsonString;
+    serializeJson(doc, jsonString);
+    
+    int httpCode = http.POST(jsonString);
+    
+    if (httpCode == 200) {
+        JsonDocument responseDoc;
+        DeserializationError error = deserializeJson(responseDoc, http.getString());
+        http.end();
+        
+        if (!error) {
+            isRegistered = true;
+            isConnected = true;
+            serverConnected = true;
+            sessionResumes++;
+            
+            if (responseDoc["recording"].is<bool>()) isRecording = responseDoc["recording"].as<bool>();
+            if (responseDoc["streaming"].is<bool>()) isStreaming = responseDoc["streaming"].as<bool>();
+            if (!deviceTallyActive() && responseDoc["status"].is<const char*>()) {
+                String status = responseDoc["status"].as<String>();
+                isProgram = (status == "Live" || status == "Program");
+                isPreview = (status == "Preview");
+                currentStatus = isProgram ? "LIVE" : (isPreview ? "PREVIEW" : "IDLE");
+                markTallyFresh();
+            } else if (tallyMode == TALLY_MODE_MERGE && responseDoc["status"].is<const char*>()) {
+                mergeServerStatus(responseDoc["status"].as<const char*>());
+            }
+            Serial.println("[RESUME] Session resumed");
+            return;
+        }
+    } else {
+        http.end();
+        if (httpCode <= 0) {
+            // Server unreachable: keep the stale frame, heartbeats will retry
+            lastError = "Session resume failed: " + http.errorToString(httpCode);
+            Serial.printf("[RESUME] Failed: %s\n", lastError.c_str());
+            return;
+        }
+    }
+    
+    // Server no longer knows this device - register on the next heartbeat
+    Serial.printf("[RESUME] Rejected (HTTP %d), falling back to registration\n", httpCode);
+    fullReregistrations++;
+    isRegistered = false;
+    lastHeartbeatTime = 0;
+}
+
+// Called whenever an authoritative tally state arrives
+void markTallyFresh() {
+    if (awaitingTally) {
+        awaitingTally = false;
+        lastReconnectToTally = millis() - linkRestoredTime;
+        Serial.printf("[WIFI] Tally state confirmed %lu ms after reconnect\n", lastReconnectToTally);
+    }
+    if (portalApSeenTime && !configMode) {
+        lastPortalApToTally = millis() - portalApSeenTime;
+        portalApSeenTime = 0;
+        Serial.printf("[PORTAL] Tally state confirmed %lu ms after the saved network reappeared\n", lastPortalApToTally);
+    }
+    tallyStale = false;
+}
+
+const char* reconnectStateName() {
+    switch (reconnectState) {
+        case RECONNECT_FAST: return "fast";
+        case RECONNECT_BACKOFF: return "backoff";
+        case RECONNECT_RESCAN: return "rescan";
+        default: return "idle";
+    }
+}
+
+// ==================== TX POWER FUNCTIONS ====================
+
+// Start the TX power controller and seed the RSSI average
+void setupTxPower() {
+    rssiEwma = (WiFi.status() == WL_CONNECTED) ? WiFi.RSSI() : TXPOWER_RSSI_LOW;
+    txPowerCleanTicks = 0;
+    txPowerLastHeartbeats = successfulHeartbeats;
+    txPowerLastFailures = failedHeartbeats;
+    txPowerLastRetries = connectionAttempts + reconnectCount;
+    lastTxPowerTick = millis();
+    setTxPowerLevel(txPowerLevel, "init");
+}
+
+// Closed-loop TX power control. Steps up immediately on loss or weak signal,
+// steps down only after a loss-free dwell period with strong signal
+void updateTxPower() {
+    unsigned long now = millis();
+    if (now - lastTxPowerTick < TXPOWER_INTERVAL) return;
+    if (WiFi.status() != WL_CONNECTED || roamInProgress) return;
+    
+    txLevelTime[txPowerLevel] += now - lastTxPowerTick;
+    lastTxPowerTick = now;
+    
+    rssiEwma = 0.8f * rssiEwma + 0.2f * WiFi.RSSI();
+    
+    // Attribute heartbeat outcomes since the last tick to the current level.
+    // The Arduino core does not expose MAC-level retry counters, so
+    // application retries (registrations, reconnects) stand in for them
+    unsigned long heartbeats = successfulHeartbeats - txPowerLastHeartbeats;
+    unsigned long failures = failedHeartbeats - txPowerLastFailures;
+    unsigned long retries = (connectionAttempts + reconnectCount) - txPowerLastRetries;
+    txPowerLastHeartbeats = successfulHeartbeats;
+    txPowerLastFailures = failedHeartbeats;
+    txPowerLastRetries = connectionAttempts + reconnectCount;
+    txLevelHeartbeats[txPowerLevel] += heartbeats;
+    txLevelFailures[txPowerLevel] += failures;
+    
+    bool lossy = (failures > 0 || retries > 0);
+    txPowerCleanTicks = lossy ? 0 : txPowerCleanTicks + 1;
+    
+    int maxLevel = lowBatteryMode ? TXPOWER_LOW_BATTERY_MAX : TXPOWER_MAX_LEVEL;
+    int minLevel = (isProgram || isPreview) ? TXPOWER_LIVE_FLOOR : 0;
+    
+    if (txPowerLevel < minLevel) {
+        setTxPowerLevel(minLevel, "tally floor");
+    } else if (txPowerLevel > maxLevel) {
+        setTxPowerLevel(maxLevel, "low battery");
+    } else if ((lossy || rssiEwma < TXPOWER_RSSI_LOW) && txPowerLevel < maxLevel) {
+        setTxPowerLevel(txPowerLevel + 1, lossy ? "loss" : "weak signal");
+    } else if (rssiEwma > TXPOWER_RSSI_HIGH && txPowerCleanTicks >= TXPOWER_CLEAN_TICKS &&
+               txPowerLevel > minLevel && now - lastTxPowerChange > TXPOWER_DWELL) {
+        setTxPowerLevel(txPowerLevel - 1, "strong signal");
+    }
+}
+
+void setTxPowerLevel(int level, const char* reason) {
+    if (level != txPowerLevel) {
+        Serial.printf("[TXPOWER] %.1f -> %.1f dBm (%s, avg RSSI %.1f dBm)\n",
+                      txPowerDbm[txPowerLevel], txPowerDbm[level], reason, rssiEwma);
+        txPowerLevel = level;
+        txPowerChanges++;
+        txPowerCleanTicks = 0;
+    }
+    lastTxPowerChange = millis();
+    WiFi.setTxPower(txPowerLevels[txPowerLevel]);
+}
+
+// ==================== MDNS DISCOVERY FUNCTIONS ====================
+
+void setupLookupTask() {
+    lookupQueue = xQueueCreate(LOOKUP_QUEUE_LENGTH, sizeof(LookupJob));
+    if (!lookupQueue || xTaskCreate(lookupTask, "lookup", LOOKUP_TASK_STACK, NULL, 1, NULL) != pdPASS) {
+        Serial.println("[MDNS] Lookup task failed to start, discovery disabled");
+        lookupQueue = NULL;
+    }
+}
+
+// Runs blocking lookups off the loop so tally, display and web server
+// never wait on the network
+void lookupTask(void* param) {
+    LookupJob job;
+    for (;;) {
+        if (xQueueReceive(lookupQueue, &job, portMAX_DELAY) != pdTRUE) continue;
+        switch (job) {
+            case LOOKUP_BROWSE:
+                browseServers();
+                break;
+            case LOOKUP_RESOLVE:
+                refreshResolverEntry();
+                break;
+            case LOOKUP_SCENE_GRAPH:
+                fetchSceneGraph();
+                break;
+        }
+    }
+}
+
+// Browse for servers advertising _obs-tally._tcp. Devices advertise the same
+// service name, so only entries with TXT role=server are kept. Blocks for
+// the query timeout; only called from the lookup task and during boot
+int browseServers() {
+    DiscoveredServer found[MAX_MDNS_SERVERS];
+    int count = 0;
+    
+    int services = MDNS.queryService(MDNS_SERVICE, "tcp");
+    for (int i = 0; i < services && count < MAX_MDNS_SERVERS; i++) {
+        if (!MDNS.hasTxt(i, "role") || MDNS.txt(i, "role") != "server") continue;
+        found[count].ip = MDNS.IP(i);
+        found[count].port = MDNS.port(i);
+        count++;
+    }
+    
+    portENTER_CRITICAL(&lookupLock);
+    for (int i = 0; i < count; i++) mdnsServers[i] = found[i];
+    mdnsServerCount = count;
+    lastMdnsBrowse = millis();
+    mdnsBrowses++;
+    mdnsBrowsePending = false;
+    mdnsBrowseDone = true;
+    portEXIT_CRITICAL(&lookupLock);
+    
+    Serial.printf("[MDNS] Browse: %d service(s), %d server(s)\n", services, count);
+    return count;
+}
+
+void requestServerBrowse() {
+    if (mdnsBrowsePending || !lookupQueue) return;
+    LookupJob job = LOOKUP_BROWSE;
+    mdnsBrowsePending = true;
+    if (xQueueSend(lookupQueue, &job, 0) != pdTRUE) mdnsBrowsePending = false;
+}
+
+// Point the server configuration at a discovered server. Never blocks: a
+// stale cache only queues a browse, and mdnsBrowseDone brings the loop back
+// once it lands. A server set by a user is kept. Returns true if it changed
+bool discoverServer() {
+    if (serverManual) return false;
+    
+    portENTER_CRITICAL(&lookupLock);
+    unsigned long age = millis() - lastMdnsBrowse;
+    bool stale = (lastMdnsBrowse == 0) ||
+                 (mdnsServerCount > 0 ? age > MDNS_CACHE_TTL : age > MDNS_RETRY_INTERVAL);
+    int count = mdnsServerCount;
+    DiscoveredServer first = mdnsServers[0];
+    portEXIT_CRITICAL(&lookupLock);
+    
+    if (stale) {
+        requestServerBrowse();
+    }
+    if (count == 0) return false;
+    
+    String ip = first.ip.toString();
+    uint16_t port = first.port;
+    if (ip == serverIP && port == serverPort) return false;
+    
+    Serial.printf("[MDNS] Server discovered: %s:%u (was '%s:%u')\n", ip.c_str(), port, serverIP.c_str(), serverPort);
+    serverIP = ip;
+    serverPort = port;
+    serverURL = "http://" + serverIP + ":" + String(serverPort);
+    serverSwitches++;
+    isRegistered = false;
+    saveConfig();
+    return true;
+}
+
+// ==================== PUSH LISTENER FUNCTIONS ====================
+
+// Persistent listener for server tally pushes. The stock WebServer closes
+// every connection after one response; here the server's socket stays open
+// so consecutive pushes skip the TCP handshake
+void setupPushServer() {
+    if (pushServerRunning) return;
+    pushServer.begin();
+    pushServer.setNoDelay(true);
+    pushServerRunning = true;
+    Serial.printf("[PUSH] Push listener started on port %d\n", PUSH_PORT);
+}
+
+// An open push connection keeps the loop on the short wait, so a push on it
+// is read within SUBSCRIBE_POLL_WAIT instead of after the idle sleep
+bool pushClientConnected() {
+    for (int i = 0; i < PUSH_MAX_CLIENTS; i++) {
+        if (pushClients[i].client.connected()) return true;
+    }
+    return false;
+}
+
+void handlePushServer() {
+    if (!pushServerRunning) return;
+    unsigned long now = millis();
+    
+    WiFiClient incoming = pushServer.available();
+    if (incoming) {
+        // Only the tally server gets a persistent slot
+        if ((uint32_t)hbServerIP != 0 && incoming.remoteIP() != hbServerIP) {
+            incoming.stop();
+            pushRejected++;
+        } else {
+            // Use a free slot, otherwise replace the connection idle the longest
+            int slot = 0;
+            for (int i = 0; i < PUSH_MAX_CLIENTS; i++) {
+                if (!pushClients[i].client.connected()) {
+                    slot = i;
+                    break;
+                }
+                if (pushClients[i].lastActivity < pushClients[slot].lastActivity) slot = i;
+            }
+            pushClients[slot].client.stop();
+            pushClients[slot].client = incoming;
+            pushClients[slot].client.setNoDelay(true);
+            setSocketDscp(pushClients[slot].client, DSCP_TALLY);
+            pushClients[slot].lastActivity = now;
+            pushClients[slot].requests = 0;
+            pushAccepted++;
+        }
+    }
+    
+    for (int i = 0; i < PUSH_MAX_CLIENTS; i++) {
+        PushConnection& conn = pushClients[i];
+        if (!conn.client.connected()) continue;
+        
+        if (conn.client.available()) {
+            handlePushRequest(conn);
+        } else if (now - conn.lastActivity > PUSH_IDLE_TIMEOUT) {
+            conn.client.stop();
+            pushIdleCloses++;
+        }
+    }
+}
+
+// Serve one HTTP/1.1 request from a push connection and keep it open
+// unless the client asked to close or the request was malformed
+void handlePushRequest(PushConnection& conn) {
+    unsigned long start = micros();
+    WiFiClient& client = conn.client;
+    
+    char line[128];
+    size_t n = client.readBytesUntil('\n', line, sizeof(line) - 1);
+    line[n] = 0;
+    bool isTally = strncmp(line, "POST /api/tally ", 16) == 0;
+    
+    long contentLength = 0;
+    bool closeAfter = strstr(line, "HTTP/1.1") == NULL;
+    while (true) {
+        n = client.readBytesUntil('\n', line, sizeof(line) - 1);
+        if (n == 0) {
+            client.stop();
+            return;
+        }
+        line[n] = 0;
+        if (line[0] == '\r') break;
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            contentLength = atol(line + 15);
+        } else if (strncasecmp(line, "Connection:", 11) == 0 && strstr(line + 11, "close")) {
+            closeAfter = true;
+        }
+    }
+    
+    int code;
+    String reply;
+    if (contentLength < 0 || contentLength > PUSH_MAX_BODY) {
+        code = 413;
+        reply = "{\"error\":\"Body too large\"}";
+        closeAfter = true;
+    } else {
+        size_t received = client.readBytes(pushBody, contentLength);
+        pushBody[received] = 0;
+        if (received < (size_t)contentLength) {
+            client.stop();
+            return;
+        }
+        if (!isTally) {
+            code = 404;
+            reply = "{\"error\":\"Not found\"}";
+        } else if (contentLength == 0) {
+            code = 400;
+            reply = "{\"error\":\"No body\"}";
+        } else if (!verifyFrameMac(pushBody, received)) {
+            code = 401;
+            reply = "{\"error\":\"Bad MAC\"}";
+        } else {
+            code = applyTallyUpdate(String(pushBody), reply, TALLY_PATH_PUSH);
+        }
+    }
+    
+    char header[160];
+    int headerLength = snprintf(header, sizeof(header),
+                                "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\nContent-Length: %u\r\n%s\r\n",
+                                code, code == 200 ? "OK" : "Error", reply.length(),
+                                closeAfter ? "Connection: close\r\n" : "Connection: keep-alive\r\nKeep-Alive: timeout=30\r\n");
+    client.write((const uint8_t*)header, headerLength);
+    client.write((const uint8_t*)reply.c_str(), reply.length());
+    if (closeAfter) client.stop();
+    
+    conn.requests++;
+    conn.lastActivity = millis();
+    pushRequests++;
+    if (conn.requests > 1) pushReusedRequests++;
+    
+    pushLastLatencyUs = micros() - start;
+    if (pushLastLatencyUs > pushMaxLatencyUs) pushMaxLatencyUs = pushLastLatencyUs;
+    pushAvgLatencyUs = (pushRequests == 1) ? pushLastLatencyUs : pushAvgLatencyUs * 0.9f + pushLastLatencyUs * 0.1f;
+}
+
+// Set the DSCP bits of a TCP connection's outgoing packets. The WiFi driver
+// picks the WMM access category from the IP TOS field
+void setSocketDscp(WiFiClient& client, uint8_t dscp) {
+    if (!DSCP_MARKING || client.fd() < 0) return;
+    int tos = dscp << 2;
+    setsockopt(client.fd(), IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+}
+
+// ==================== RESOLVER CACHE FUNCTIONS ====================
+
+// Resolve a host name through the cache. Literal addresses bypass it,
+// expired answers are still served while the background refresh runs,
+// and failures are remembered so they do not block every caller
+bool resolveHost(const char* host, IPAddress& ip) {
+    if (ip.fromString(host)) return true;
+    
+    unsigned long now = millis();
+    ResolverEntry* entry = NULL;
+    for (int i = 0; i < resolverCount; i++) {
+        if (strcasecmp(resolverCache[i].host, host) == 0) {
+            entry = &resolverCache[i];
+            break;
+        }
+    }
+    
+    if (entry) {
+        entry->lastUsed = now;
+        if (entry->positive) {
+            if ((long)(now - entry->expiresAt) < 0) {
+                resolverHits++;
+            } else {
+                resolverStaleHits++;
+                entry->refreshAt = now;
+            }
+            ip = entry->ip;
+            return true;
+        }
+        if ((long)(now - entry->expiresAt) < 0) {
+            resolverNegativeHits++;
+            return false;
+        }
+    } else {
+        if (strlen(host) >= sizeof(entry->host)) return lookupHost(host, ip);
+        
+        // Take a free slot or evict the least recently used host
+        if (resolverCount < RESOLVER_CACHE_SIZE) {
+            entry = &resolverCache[resolverCount++];
+        } else {
+            entry = &resolverCache[0];
+            for (int i = 1; i < resolverCount; i++) {
+                if (resolverCache[i].lastUsed < entry->lastUsed) entry = &resolverCache[i];
+            }
+        }
+        strcpy(entry->host, host);
+        entry->lastUsed = now;
+    }
+    
+    resolverMisses++;
+    entry->positive = lookupHost(host, entry->ip);
+    now = millis();
+    if (entry->positive) {
+        entry->expiresAt = now + RESOLVER_TTL;
+        entry->refreshAt = now + RESOLVER_TTL - RESOLVER_REFRESH_AHEAD;
+        ip = entry->ip;
+    } else {
+        entry->expiresAt = now + RESOLVER_NEGATIVE_TTL;
+        entry->refreshAt = entry->expiresAt;
+        resolverFailures++;
+    }
+    return entry->positive;
+}
+
+// Uncached lookup; .local names go straight to mDNS with a short timeout
+bool lookupHost(const char* host, IPAddress& ip) {
+    unsigned long start = millis();
+    bool found = false;
+    size_t length = strlen(host);
+    
+    if (length > 6 && strcasecmp(host + length - 6, ".local") == 0) {
+        char name[64];
+        size_t nameLength = min(length - 6, sizeof(name) - 1);
+        memcpy(name, host, nameLength);
+        name[nameLength] = 0;
+        IPAddress answer = MDNS.queryHost(name, RESOLVER_MDNS_TIMEOUT);
+        if ((uint32_t)answer != 0) {
+            ip = answer;
+            found = true;
+        }
+    } else {
+        found = WiFi.hostByName(host, ip) == 1;
+    }
+    
+    lastLookupDuration = millis() - start;
+    Serial.printf("[RESOLVER] Resolved %s -> %s in %lu ms\n", host, found ? ip.toString().c_str() : "(failed)", lastLookupDuration);
+    return found;
+}
+
+// Refresh one entry ahead of expiry so lookups stay off the heartbeat path.
+// The lookup itself runs in the lookup task; the entry keeps serving its
+// current address until the result is applied here on a later loop
+void updateResolverCache() {
+    applyResolverRefresh();
+    
+    unsigned long now = millis();
+    if (resolverCount == 0 || resolverRefreshPending || now - lastResolverRefresh < RESOLVER_REFRESH_INTERVAL) return;
+    lastResolverRefresh = now;
+    
+    for (int i = 0; i < resolverCount; i++) {
+        ResolverEntry& entry = resolverCache[i];
+        
+        if (now - entry.lastUsed > RESOLVER_IDLE_DROP) {
+            resolverCache[i] = resolverCache[--resolverCount];
+            return;
+        }
+        if (!entry.positive || (long)(now - entry.refreshAt) < 0 || !lookupQueue) continue;
+        
+        portENTER_CRITICAL(&lookupLock);
+        memcpy(resolverRefresh.host, entry.host, sizeof(resolverRefresh.host));
+        portEXIT_CRITICAL(&lookupLock);
+        
+        LookupJob job = LOOKUP_RESOLVE;
+        resolverRefreshPending = true;
+        if (xQueueSend(lookupQueue, &job, 0) != pdTRUE) {
+            resolverRefreshPending = false;
+            return;
+        }
+        resolverRefreshes++;
+        entry.refreshAt = now + RESOLVER_NEGATIVE_TTL;  // Not queued again while in flight
+        return;
+    }
+}
+
+// Lookup task side of a refresh
+void refreshResolverEntry() {
+    char host[sizeof(resolverRefresh.host)];
+    portENTER_CRITICAL(&lookupLock);
+    memcpy(host, resolverRefresh.host, sizeof(host));
+    portEXIT_CRITICAL(&lookupLock);
+    
+    IPAddress ip;
+    bool found = lookupHost(host, ip);
+    
+    portENTER_CRITICAL(&lookupLock);
+    resolverRefresh.ip = ip;
+    resolverRefresh.found = found;
+    resolverRefreshDone = true;
+    resolverRefreshPending = false;
+    portEXIT_CRITICAL(&lookupLock);
+}
+
+// Apply a finished refresh to its entry, if the host is still cached
+void applyResolverRefresh() {
+    portENTER_CRITICAL(&lookupLock);
+    bool done = resolverRefreshDone;
+    ResolverRefresh result = resolverRefresh;
+    resolverRefreshDone = false;
+    portEXIT_CRITICAL(&lookupLock);
+    if (!done) return;
+    
+    for (int i = 0; i < resolverCount; i++) {
+        ResolverEntry& entry = resolverCache[i];
+        if (strcasecmp(entry.host, result.host) != 0) continue;
+        
+        if (result.found) {
+            if (result.ip != entry.ip) {
+                Serial.printf("[RESOLVER] %s moved to %s\n", entry.host, result.ip.toString().c_str());
+                entry.ip = result.ip;
+                if (strcasecmp(entry.host, hbServerHost) == 0) hbTemplatesValid = false;
+            }
+            unsigned long now = millis();
+            entry.expiresAt = now + RESOLVER_TTL;
+            entry.refreshAt = now + RESOLVER_TTL - RESOLVER_REFRESH_AHEAD;
+        } else {
+            // Keep serving the old address and try again later
+            resolverFailures++;
+            entry.refreshAt = millis() + RESOLVER_NEGATIVE_TTL;
+        }
+        return;
+    }
+}
+
+// Ask for an early background refresh, e.g. after a connection failure
+void expediteResolve(const char* host) {
+    for (int i = 0; i < resolverCount; i++) {
+        if (strcasecmp(resolverCache[i].host, host) == 0) {
+            resolverCache[i].refreshAt = millis();
+            return;
+        }
+    }
+}
+
+// Rewrite http://host:port with the cached address for HTTPClient callers
+String resolvedURL(const String& url) {
+    int hostStart = url.startsWith("http://") ? 7 : 0;
+    int hostEnd = hostStart;
+    while (hostEnd < (int)url.length() && url[hostEnd] != ':' && url[hostEnd] != '/') hostEnd++;
+    
+    String host = url.substring(hostStart, hostEnd);
+    IPAddress ip;
+    if (ip.fromString(host) || !resolveHost(host.c_str(), ip)) return url;
+    return url.substring(0, hostStart) + ip.toString() + url.substring(hostEnd);
+}
+
+// ==================== HEARTBEAT TEMPLATE FUNCTIONS ====================
+
+// Re-render the request templates if any field baked into them changed
+bool refreshRequestTemplates() {
+    const char* name = deviceName.length() > 0 ? deviceName.c_str() : "M5StickC-Tally";
+    if (hbTemplatesValid && serverURL == hbBuiltURL && WiFi.localIP() == hbBuiltIP &&
+        name == hbBuiltName && assignedSource == hbBuiltSource) {
+        return true;
+    }
+    
+    hbTemplatesValid = buildRequestTemplates();
+    hbBuiltURL = serverURL;
+    hbBuiltIP = WiFi.localIP();
+    hbBuiltName = name;
+    hbBuiltSource = assignedSource;
+    return hbTemplatesValid;
+}
+
+// Bounded writers used to render the templates
+static bool tplAppend(char* buffer, size_t size, size_t& pos, const char* text) {
+    size_t length = strlen(text);
+    if (pos + length >= size) return false;
+    memcpy(buffer + pos, text, length);
+    pos += length;
+    buffer[pos] = 0;
+    return true;
+}
+
+static bool tplAppendString(char* buffer, size_t size, size_t& pos, const String& text) {
+    if (!tplAppend(buffer, size, pos, "\"")) return false;
+    for (size_t i = 0; i < text.length(); i++) {
+        char c = text[i];
+        if ((uint8_t)c < 0x20) continue;
+        if (c == '"' || c == '\\') {
+            if (pos + 1 >= size) return false;
+            buffer[pos++] = '\\';
+        }
+        if (pos + 1 >= size) return false;
+        buffer[pos++] = c;
+    }
+    buffer[pos] = 0;
+    return tplAppend(buffer, size, pos, "\"");
+}
+
+static bool tplAppendSlot(char* buffer, size_t size, size_t& pos, size_t width, size_t& offset) {
+    if (pos + width >= size) return false;
+    offset = pos;
+    memset(buffer + pos, ' ', width);
+    pos += width;
+    buffer[pos] = 0;
+    return true;
+}
+
+// Prefix an HTTP POST header to a rendered body
+static bool tplFinishRequest(char* request, size_t size, size_t& length, const char* path,
+                             const char* host, const char* body, size_t bodyLength, size_t& headerLength) {
+    int written = snprintf(request, size,
+                           "POST %s HTTP/1.1\r\nHost: %s\r\nContent-Type: application/json\r\n"
+                           "Connection: keep-alive\r\nContent-Length: %u\r\n\r\n",
+                           path, host, (unsigned)bodyLength);
+    if (written <= 0 || (size_t)written + bodyLength >= size) return false;
+    memcpy(request + written, body, bodyLength);
+    length = written + bodyLength;
+    request[length] = 0;
+    headerLength = written;
+    return true;
+}
+
+// Render the registration and heartbeat requests. Variable heartbeat fields
+// are fixed-width slots padded with whitespace outside the JSON token, so
+// they can be rewritten later without moving anything else
+bool buildRequestTemplates() {
+    hbTemplateBuilds++;
+    
+    // serverURL is http://host[:port][/...]. The raw client has no TLS, so
+    // https:// is refused rather than sent as plain HTTP to the TLS port
+    const char* url = serverURL.c_str();
+    if (strncasecmp(url, "https://", 8) == 0) return false;
+    if (strncmp(url, "http://", 7) == 0) url += 7;
+    size_t hostLength = strcspn(url, "/");
+    size_t nameLength = strcspn(url, ":/");
+    char host[72];
+    char name[64];
+    if (hostLength == 0 || hostLength >= sizeof(host) || nameLength >= sizeof(name)) return false;
+    memcpy(host, url, hostLength);
+    host[hostLength] = 0;
+    memcpy(name, url, nameLength);
+    name[nameLength] = 0;
+    hbServerPort = (url[nameLength] == ':') ? atoi(url + nameLength + 1) : 80;
+    strcpy(hbServerHost, name);
+    if (!resolveHost(name, hbServerIP)) {
+        Serial.printf("[HEARTBEAT] Cannot resolve server host %s\n", name);
+        return false;
+    }
+    hbClient.stop();
+    subClient.stop();
+    subArmed = false;
+    
+    String ip = WiFi.localIP().toString();
+    char body[HB_BODY_SIZE];
+    size_t pos = 0;
+    size_t headerLength = 0;
+    size_t statusSlot = 0;
+    size_t uptimeSlot = 0;
+    size_t signalSlot = 0;
+    char registerTail[192];
+    snprintf(registerTail, sizeof(registerTail),
+                 ",\"pushPort\":%d,\"capabilities\":{\"transports\":[\"push\",\"multicast\",\"poll\",\"mqtt\"],"
+                 "\"maxFrame\":%d,\"clockSync\":true,\"sceneGraph\":%d}}", PUSH_PORT, PUSH_MAX_BODY, SCENE_GRAPH_MAX_EDGES);
+    
+    bool ok = tplAppend(body, sizeof(body), pos, "{\"deviceId\":") &&
+              tplAppendString(body, sizeof(body), pos, deviceID) &&
+              tplAppend(body, sizeof(body), pos, ",\"deviceName\":") &&
+              tplAppendString(body, sizeof(body), pos, deviceName.length() > 0 ? deviceName : "M5StickC-Tally") &&
+              tplAppend(body, sizeof(body), pos, ",\"ipAddress\":") &&
+              tplAppendString(body, sizeof(body), pos, ip) &&
+              tplAppend(body, sizeof(body), pos, ",\"macAddress\":") &&
+              tplAppendString(body, sizeof(body), pos, macAddress) &&
+              tplAppend(body, sizeof(body), pos, ",\"firmware\":\"" FIRMWARE_VERSION "\",\"model\":\"" DEVICE_MODEL "\",\"assignedSource\":") &&
+              tplAppendString(body, sizeof(body), pos, assignedSource) &&
+              tplAppend(body, sizeof(body), pos, registerTail) &&
+              tplFinishRequest(registerRequest, sizeof(registerRequest), registerRequestLength,
+                               "/api/esp32/register", host, body, pos, headerLength);
+    if (!ok) return false;
+    
+    pos = 0;
+    ok = tplAppend(body, sizeof(body), pos, "{\"id\":") &&
+         tplAppendString(body, sizeof(body), pos, deviceID) &&
+         tplAppend(body, sizeof(body), pos, ",\"status\":") &&
+         tplAppendSlot(body, sizeof(body), pos, HB_STATUS_SLOT, statusSlot) &&
+         tplAppend(body, sizeof(body), pos, ",\"uptime\":") &&
+         tplAppendSlot(body, sizeof(body), pos, HB_UPTIME_SLOT, uptimeSlot) &&
+         tplAppend(body, sizeof(body), pos, ",\"ip\":") &&
+         tplAppendString(body, sizeof(body), pos, ip) &&
+         tplAppend(body, sizeof(body), pos, ",\"assignedSource\":") &&
+         tplAppendString(body, sizeof(body), pos, assignedSource) &&
+         tplAppend(body, sizeof(body), pos, ",\"signal\":") &&
+         tplAppendSlot(body, sizeof(body), pos, HB_SIGNAL_SLOT, signalSlot) &&
+         tplAppend(body, sizeof(body), pos, ",\"version\":\"" FIRMWARE_VERSION "\",\"model\":\"" DEVICE_MODEL "\"}") &&
+         tplFinishRequest(hbRequest, sizeof(hbRequest), hbRequestLength,
+                          "/api/heartbeat", host, body, pos, headerLength);
+    if (!ok) return false;
+    
+    hbStatusOffset = headerLength + statusSlot;
+    hbUptimeOffset = headerLength + uptimeSlot;
+    hbSignalOffset = headerLength + signalSlot;
+    patchSlot(hbRequest, hbStatusOffset, HB_STATUS_SLOT, "", true);
+    patchSlot(hbRequest, hbUptimeOffset, HB_UPTIME_SLOT, "0", false);
+    patchSlot(hbRequest, hbSignalOffset, HB_SIGNAL_SLOT, "0", false);
+    
+    Serial.printf("[HEARTBEAT] Request templates built for %s (heartbeat %u bytes)\n", host, (unsigned)hbRequestLength);
+    return true;
+}
+
+// Overwrite a fixed-width slot: the value (quoted if requested), then spaces
+void patchSlot(char* buffer, size_t offset, size_t width, const char* value, bool quoted) {
+    char* slot = buffer + offset;
+    size_t pos = 0;
+    size_t limit = quoted ? width - 2 : width;
+    
+    if (quoted) slot[pos++] = '"';
+    for (size_t i = 0; value[i] && i < limit; i++) {
+        char c = value[i];
+        slot[pos++] = (c == '"' || c == '\\') ? '_' : c;
+    }
+    if (quoted) slot[pos++] = '"';
+    while (pos < width) slot[pos++] = ' ';
+}
+
+// Send a prebuilt request on the persistent client and read the response
+// body into hbResponse. Returns the HTTP status or a negative error code
+int httpTransact(const char* request, size_t length) {
+    bool reused = hbClient.connected();
+    while (true) {
+        if (reused) {
+            hbReusedConnections++;
+        } else {
+            hbClient.stop();
+            if (!hbClient.connect(hbServerIP, hbServerPort, HB_CONNECT_TIMEOUT)) return -1;
+            hbConnections++;
+            setSocketDscp(hbClient, DSCP_DEFAULT);
+        }
+        
+        int code = httpExchange(request, length, reused);
+        if (code != HB_STALE_SOCKET) return code;
+        
+        // The server closed the kept-alive socket before answering; the request
+        // never reached it, so send it once more on a fresh connection
+        hbStaleRetries++;
+        reused = false;
+    }
+}
+
+// One request/response on hbClient. A reused socket that fails before any
+// response byte arrives reports HB_STALE_SOCKET instead of an error
+static int httpExchange(const char* request, size_t length, bool reused) {
+    hbResponse[0] = 0;
+    if (hbClient.write((const uint8_t*)request, length) != length) {
+        hbClient.stop();
+        return reused ? HB_STALE_SOCKET : -2;
+    }
+    
+    char line[96];
+    size_t n = hbClient.readBytesUntil('\n', line, sizeof(line) - 1);
+    line[n] = 0;
+    if (n == 0 && reused) {
+        hbClient.stop();
+        return HB_STALE_SOCKET;
+    }
+    if (n < 12 || strncmp(line, "HTTP/1.", 7) != 0) {
+        hbClient.stop();
+        return -3;
+    }
+    int code = atoi(line + 9);
+    
+    long contentLength = -1;
+    bool closeAfter = false;
+    while (true) {
+        n = hbClient.readBytesUntil('\n', line, sizeof(line) - 1);
+        if (n == 0) {
+            hbClient.stop();
+            return -3;
+        }
+        line[n] = 0;
+        if (line[0] == '\r') break;
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            contentLength = atol(line + 15);
+        } else if (strncasecmp(line, "Connection:", 11) == 0 && strstr(line + 11, "close")) {
+            closeAfter = true;
+        }
+    }
+    
+    // Without a length the body ends when the server closes the connection
+    if (contentLength < 0) {
+        closeAfter = true;
+        contentLength = HB_RESPONSE_SIZE - 1;
+    }
+    size_t wanted = min((size_t)contentLength, (size_t)(HB_RESPONSE_SIZE - 1));
+    size_t received = hbClient.readBytes(hbResponse, wanted);
+    hbResponse[received] = 0;
+    
+    // A body larger than the buffer leaves the stream out of sync
+    if (received < (size_t)contentLength) closeAfter = true;
+    if (closeAfter) hbClient.stop();
+    
+    return code;
+}
+
+const char* httpTransactError(int code) {
+    switch (code) {
+        case -1: return "connection refused";
+        case -2: return "send failed";
+        case -3: return "no response";
+        default: return "unknown error";
+    }
+}
+
+// Bounded JSON lookups on a response buffer without building a document.
+// Returns a pointer to the value of the first "key": found, or NULL
+const char* jsonFindValue(const char* json, const char* key) {
+    size_t keyLength = strlen(key);
+    const char* p = json;
+    
+    while ((p = strstr(p, key)) != NULL) {
+        const char* v = p + keyLength;
+        if (p == json || p[-1] != '"' || *v != '"') {
+            p = v;
+            continue;
+        }
+        v++;
+        while (*v == ' ') v++;
+        if (*v != ':') {
+            p = v;
+            continue;
+        }
+        v++;
+        while (*v == ' ') v++;
+        return v;
+    }
+    return NULL;
+}
+
+// Copy a string value. If the value is an object the same key is looked up
+// inside it, which covers {"status":{"source":"Cam 1","status":"Live"}}
+bool jsonFindString(const char* json, const char* key, char* out, size_t outSize) {
+    const char* v = jsonFindValue(json, key);
+    if (v && *v == '{') v = jsonFindValue(v, key);
+    if (!v || *v != '"') return false;
+    
+    v++;
+    size_t n = 0;
+    while (*v && *v != '"' && n < outSize - 1) {
+        if (*v == '\\' && v[1]) v++;
+        out[n++] = *v++;
+    }
+    out[n] = 0;
+    return *v == '"';
+}
+
+bool jsonFindBool(const char* json, const char* key, bool& out) {
+    const char* v = jsonFindValue(json, key);
+    if (!v) return false;
+    if (strncmp(v, "true", 4) == 0) {
+        out = true;
+        return true;
+    }
+    if (strncmp(v, "false", 5) == 0) {
+        out = false;
+        return true;
+    }
+    return false;
+}
+
+// ==================== SUBSCRIPTION FUNCTIONS ====================
+
+// Keep one subscription request outstanding. Everything here is
+// non-blocking except the connect, which is bounded like the heartbeat's
+void handleSubscription() {
+    if ((!subscribeMode && negotiatedTransport != "poll") || !hbTemplatesValid || WiFi.status() != WL_CONNECTED) {
+        if (subArmed) finishSubscription(false);
+        return;
+    }
+    
+    if (!subArmed) {
+        if ((long)(millis() - subRetryAt) >= 0) armSubscription();
+        return;
+    }
+    
+    while (subClient.available() && subReceived < SUBSCRIBE_BUFFER_SIZE) {
+        int n = subClient.read((uint8_t*)subResponse + subReceived, SUBSCRIBE_BUFFER_SIZE - subReceived);
+        if (n <= 0) break;
+        subReceived += n;
+    }
+    subResponse[subReceived] = 0;
+    
+    bool closed = !subClient.connected() && !subClient.available();
+    char* bodyStart = strstr(subResponse, "\r\n\r\n");
+    
+    if (!bodyStart) {
+        if (closed && subReceived == 0 && subReused) {
+            // The server dropped the idle connection just as the request went out
+            subClient.stop();
+            subArmed = false;
+            armSubscription();
+        } else if (closed || subReceived >= SUBSCRIBE_BUFFER_SIZE ||
+                   millis() - subArmedAt > SUBSCRIBE_HOLD_TIMEOUT) {
+            subscribeErrors++;
+            finishSubscription(false);
+        }
+        return;
+    }
+    
+    // Headers are complete: status line, then the two headers that matter
+    *bodyStart = 0;
+    bodyStart += 4;
+    int code = (strncmp(subResponse, "HTTP/1.", 7) == 0) ? atoi(subResponse + 9) : 0;
+    long contentLength = (code == 204) ? 0 : -1;
+    bool closeAfter = false;
+    for (char* line = strstr(subResponse, "\r\n"); line; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            contentLength = atol(line + 15);
+        } else if (strncasecmp(line, "Connection:", 11) == 0 && strstr(line + 11, "close")) {
+            closeAfter = true;
+        }
+    }
+    
+    size_t bodyLength = subReceived - (bodyStart - subResponse);
+    if (contentLength < 0) {
+        if (!closed) return;             // Body ends when the server closes
+        closeAfter = true;
+    } else if (bodyLength < (size_t)contentLength) {
+        if (closed || subReceived >= SUBSCRIBE_BUFFER_SIZE) {
+            subscribeErrors++;
+            finishSubscription(false);
+        }
+        return;
+    } else {
+        bodyStart[contentLength] = 0;
+    }
+    
+    subscribeLastWaitMs = millis() - subArmedAt;
+    if (code == 200) {
+        if (verifyFrameMac(bodyStart, strlen(bodyStart))) {
+            String reply;
+            applyTallyUpdate(String(bodyStart), reply, TALLY_PATH_POLL);
+        }
+        subscribeUpdates++;
+    } else if (code == 204) {
+        subscribeTimeouts++;
+    } else {
+        Serial.printf("[SUB] Subscription rejected with HTTP %d\n", code);
+        subscribeErrors++;
+        finishSubscription(false);
+        return;
+    }
+    
+    if (closeAfter || closed) subClient.stop();
+    finishSubscription(true);
+}
+
+// Send the subscription request with the last sequence applied, so an
+// update that arrived while no request was held is returned at once
+bool armSubscription() {
+    subReused = subClient.connected();
+    if (!subReused) {
+        subClient.stop();
+        if (!subClient.connect(hbServerIP, hbServerPort, HB_CONNECT_TIMEOUT)) {
+            subscribeErrors++;
+            subRetryAt = millis() + SUBSCRIBE_RETRY_INTERVAL;
+            return false;
+        }
+        subscribeConnections++;
+        setSocketDscp(subClient, DSCP_TALLY);
+    }
+    
+    char request[224];
+    int length = snprintf(request, sizeof(request),
+                          "GET /api/esp32/subscribe?deviceId=%s&since=%lu&epoch=%lu HTTP/1.1\r\n"
+                          "Host: %s:%u\r\nConnection: keep-alive\r\n\r\n",
+                          deviceID.c_str(), (unsigned long)lastTallySeq, (unsigned long)tallyEpoch,
+                          hbServerHost, hbServerPort);
+    if (length <= 0 || length >= (int)sizeof(request) ||
+            subClient.write((const uint8_t*)request, length) != (size_t)length) {
+        subClient.stop();
+        subscribeErrors++;
+        subRetryAt = millis() + SUBSCRIBE_RETRY_INTERVAL;
+        return false;
+    }
+    
+    subReceived = 0;
+    subArmed = true;
+    subArmedAt = millis();
+    return true;
+}
+
+// End the current request; re-arm at once after an answer, otherwise
+// close the connection and back off
+void finishSubscription(bool rearm) {
+    subArmed = false;
+    subReceived = 0;
+    if (rearm) {
+        armSubscription();
+    } else {
+        subClient.stop();
+        subRetryAt = millis() + SUBSCRIBE_RETRY_INTERVAL;
+    }
+}
+
+// ==================== MQTT FUNCTIONS ====================
+
+// Keep the broker session up, follow source reassignments and publish
+// telemetry. PubSubClient::loop() delivers messages to mqttCallback()
+void handleMqtt() {
+    if (activeMqttBroker().length() == 0 || WiFi.status() != WL_CONNECTED) return;
+    unsigned long now = millis();
+    
+    if (!mqttClient.connected()) {
+        if (lastMqttAttempt != 0 && now - lastMqttAttempt < MQTT_RECONNECT_INTERVAL) return;
+        lastMqttAttempt = now;
+        connectMqtt();
+        return;
+    }
+    
+    mqttClient.loop();
+    
+    // The server may reassign the source in any tally message
+    if (assignedSource != mqttSubscribedSource) {
+        char topic[128];
+        if (mqttSubscribedSource.length() > 0) {
+            mqttSourceTopic(mqttSubscribedSource, topic, sizeof(topic));
+            mqttClient.unsubscribe(topic);
+        }
+        mqttSubscribedSource = assignedSource;
+        if (assignedSource.length() > 0) {
+            mqttSourceTopic(assignedSource, topic, sizeof(topic));
+            mqttClient.subscribe(topic, mqttQos);
+        }
+        publishMqttPresence(true);
+    }
+    
+    if (now - lastMqttTelemetry > MQTT_TELEMETRY_INTERVAL) {
+        publishMqttTelemetry();
+        lastMqttTelemetry = now;
+    }
+}
+
+bool connectMqtt() {
+    IPAddress brokerIP;
+    if (!resolveHost(activeMqttBroker().c_str(), brokerIP)) {
+        mqttFailures++;
+        return false;
+    }
+    
+    char clientId[48];
+    char willTopic[96];
+    snprintf(clientId, sizeof(clientId), "obs-tally-%s", deviceID.c_str());
+    mqttDeviceTopic("presence", willTopic, sizeof(willTopic));
+    
+    mqttClient.setServer(brokerIP, mqttPort);
+    mqttClient.setCallback(mqttCallback);
+    mqttClient.setBufferSize(MQTT_BUFFER_SIZE);
+    mqttClient.setKeepAlive(MQTT_KEEPALIVE);
+    if (!mqttClient.connect(clientId, willTopic, 1, true, "{\"online\":false}")) {
+        Serial.printf("[MQTT] Broker %s:%d refused connection (state %d)\n", activeMqttBroker().c_str(), mqttPort, mqttClient.state());
+        mqttFailures++;
+        return false;
+    }
+    mqttConnects++;
+    setSocketDscp(mqttNet, DSCP_TALLY);
+    
+    // Retained messages bring the current state straight after subscribing
+    char topic[128];
+    snprintf(topic, sizeof(topic), "%s/snapshot", MQTT_TOPIC_PREFIX);
+    mqttClient.subscribe(topic, mqttQos);
+    mqttSnapshotPending = true;
+    if (sceneGraphNegotiated) {
+        snprintf(topic, sizeof(topic), "%s/scene", MQTT_TOPIC_PREFIX);
+        mqttClient.subscribe(topic, mqttQos);
+    }
+    mqttSubscribedSource = assignedSource;
+    if (assignedSource.length() > 0) {
+        mqttSourceTopic(assignedSource, topic, sizeof(topic));
+        mqttClient.subscribe(topic, mqttQos);
+    }
+    
+    publishMqttPresence(true);
+    lastMqttTelemetry = 0;
+    Serial.printf("[MQTT] Connected to %s:%d (QoS %d)\n", activeMqttBroker().c_str(), mqttPort, mqttQos);
+    return true;
+}
+
+// Tally messages use the /api/tally JSON. The snapshot carries every source
+// and is only used until this device's own source topic has been seen
+void mqttCallback(char* topic, uint8_t* payload, unsigned int length) {
+    mqttMessages++;
+    if (length > PUSH_MAX_BODY) return;
+    
+    // topic and payload live in the client's buffer, which publishing reuses
+    bool snapshot = strstr(topic, "/snapshot") != NULL;
+    memcpy(pushBody, payload, length);
+    pushBody[length] = 0;
+    if (!verifyFrameMac(pushBody, length)) return;
+    
+    // Scene events are shared by every device and are not acknowledged
+    size_t topicLength = strlen(topic);
+    if (topicLength > 6 && strcmp(topic + topicLength - 6, "/scene") == 0) {
+        handleSceneEvent(pushBody);
+        return;
+    }
+    
+    String update;
+    if (snapshot) {
+        if (!mqttSnapshotPending) return;
+        JsonDocument doc;
+        if (deserializeJson(doc, pushBody)) return;
+        const char* status = doc["sources"][assignedSource.c_str()];
+        if (!status) return;
+        
+        JsonDocument single;
+        single["status"] = status;
+        single["recording"] = doc["recording"];
+        single["streaming"] = doc["streaming"];
+        single["ts"] = doc["ts"];
+        serializeJson(single, update);
+    } else {
+        update = pushBody;
+    }
+    mqttSnapshotPending = false;
+    
+    unsigned long start = micros();
+    String reply;
+    applyTallyUpdate(update, reply, TALLY_PATH_MQTT);
+    mqttLastApplyUs = micros() - start;
+    
+    // Echo the server timestamp so it can measure publish-to-display latency
+    const char* ts = jsonFindValue(pushBody, "ts");
+    if (ts) {
+        char ack[80];
+        char ackTopic[96];
+        snprintf(ack, sizeof(ack), "{\"ts\":%.*s,\"applyUs\":%lu}",
+                 (int)strspn(ts, "0123456789"), ts, mqttLastApplyUs);
+        mqttDeviceTopic("ack", ackTopic, sizeof(ackTopic));
+        mqttClient.publish(ackTopic, ack);
+    }
+}
+
+void mqttDeviceTopic(const char* kind, char* topic, size_t size) {
+    snprintf(topic, size, "%s/device/%s/%s", MQTT_TOPIC_PREFIX, deviceID.c_str(), kind);
+}
+
+// Topic levels cannot contain the separator or wildcards; the server maps
+// source names the same way
+void mqttSourceTopic(const String& source, char* topic, size_t size) {
+    int n = snprintf(topic, size, "%s/source/", MQTT_TOPIC_PREFIX);
+    size_t pos = n;
+    for (size_t i = 0; i < source.length() && pos + 7 < size; i++) {
+        char c = source[i];
+        topic[pos++] = (c == '/' || c == '+' || c == '#') ? '_' : c;
+    }
+    strcpy(topic + pos, "/tally");
+}
+
+void publishMqttPresence(bool online) {
+    JsonDocument doc;
+    doc["online"] = online;
+    doc["ip"] = WiFi.localIP().toString();
+    doc["name"] = deviceName;
+    doc["source"] = assignedSource;
+    doc["firmware"] = FIRMWARE_VERSION;
+    
+    char topic[96];
+    char payload[256];
+    mqttDeviceTopic("presence", topic, sizeof(topic));
+    size_t length = serializeJson(doc, payload, sizeof(payload));
+    mqttClient.publish(topic, (const uint8_t*)payload, length, true);
+}
+
+void publishMqttTelemetry() {
+    JsonDocument doc;
+    doc["uptime"] = millis() / 1000;
+    doc["rssi"] = WiFi.RSSI();
+    doc["heap"] = ESP.getFreeHeap();
+    doc["status"] = currentStatus;
+    doc["messages"] = mqttMessages;
+    doc["applyUs"] = mqttLastApplyUs;
+    
+    char topic[96];
+    char payload[256];
+    mqttDeviceTopic("telemetry", topic, sizeof(topic));
+    size_t length = serializeJson(doc, payload, sizeof(payload));
+    mqttClient.publish(topic, (const uint8_t*)payload, length, false);
+}
+
+// ==================== NEGOTIATION FUNCTIONS ====================
+
+// A broker set on the config page wins over one the server offered
+const String& activeMqttBroker() {
+    return mqttBroker.length() > 0 ? mqttBroker : mqttServerBroker;
+}
+
+// Read the "negotiated" object from the register response. The server
+// sends it first so it fits in hbResponse
+void applyNegotiation(const char* response) {
+    const char* v = jsonFindValue(response, "negotiated");
+    if (!v || *v != '{') {
+        negotiatedTransport = "";
+        sceneGraphNegotiated = false;
+        return;
+    }
+    
+    JsonDocument doc;
+    if (deserializeJson(doc, v)) return;
+    
+    negotiatedTransport = doc["transport"] | "push";
+    negotiatedRedundant = doc["redundant"] | false;
+    negotiatedMaxFrame = doc["maxFrame"] | PUSH_MAX_BODY;
+    
+    // The server stops per-device pushes for the source once the graph is loaded
+    sceneGraphNegotiated = (doc["sceneGraph"] | 0) > 0;
+    sceneGraphValid = false;
+    if (sceneGraphNegotiated) requestSceneGraphSync("registered");
+    
+    if (negotiatedTransport == "mqtt" && doc["mqtt"]["host"].is<const char*>()) {
+        mqttServerBroker = doc["mqtt"]["host"].as<const char*>();
+        if (mqttBroker.length() == 0) {
+            mqttPort = doc["mqtt"]["port"] | MQTT_DEFAULT_PORT;
+            mqttQos = (doc["mqtt"]["qos"] | 1) > 0 ? 1 : 0;
+        }
+    }
+    
+    // Includes the response's one-way delay, a few ms on a LAN
+    if (doc["serverTime"].is<uint64_t>()) {
+        serverClockOffset = (int64_t)doc["serverTime"].as<uint64_t>() - (int64_t)millis();
+        clockSynced = true;
+    }
+    
+    Serial.printf("[REGISTER] Negotiated transport: %s%s (max frame %d)\n", negotiatedTransport.c_str(),
+                  negotiatedRedundant ? " + multicast" : "", negotiatedMaxFrame);
+}
+
+uint64_t serverNowMs() {
+    return (uint64_t)((int64_t)millis() + serverClockOffset);
+}
+
+// ==================== BENCHMARK FUNCTIONS ====================
+
+// Reset the histograms for a new run; the clock is re-synced from the
+// loop before the first probe arrives
+void startBenchmark(uint32_t run, uint32_t count) {
+    memset(benchStats, 0, sizeof(benchStats));
+    for (int i = 0; i < BENCH_TRANSPORTS; i++) {
+        benchStats[i].minMs = INT32_MAX;
+        benchStats[i].maxMs = INT32_MIN;
+    }
+    benchRun = run;
+    benchCount = count;
+    benchStaleProbes = 0;
+    benchSyncPending = true;
+    Serial.printf("[BENCH] Benchmark run %lu started (%lu probes per transport)\n", (unsigned long)run, (unsigned long)count);
+}
+
+void recordBenchmarkProbe(JsonDocument& probe) {
+    uint32_t run = probe["run"] | 0UL;
+    const char* transport = probe["transport"] | "";
+    int index = -1;
+    for (int i = 0; i < BENCH_TRANSPORTS; i++) {
+        if (strcmp(transport, benchTransportNames[i]) == 0) index = i;
+    }
+    if (run != benchRun || index < 0) {
+        benchStaleProbes++;
+        return;
+    }
+    
+    BenchStats& stats = benchStats[index];
+    stats.received++;
+    // Without a clock there is no latency to record; the probe still counts
+    // towards loss
+    if (!clockSynced) return;
+    
+    int32_t latency = (int32_t)((int64_t)serverNowMs() - (int64_t)(probe["ts"] | 0ULL));
+    if (stats.measured > 0) stats.jitterSumMs += abs(latency - stats.lastMs);
+    stats.measured++;
+    stats.lastMs = latency;
+    stats.sumMs += latency;
+    if (latency < stats.minMs) stats.minMs = latency;
+    if (latency > stats.maxMs) stats.maxMs = latency;
+    
+    int bucket = 0;
+    while (bucket < BENCH_BUCKETS - 1 && latency >= benchBucketLimits[bucket]) bucket++;
+    stats.histogram[bucket]++;
+}
+
+// Same keys on every firmware so the server can compare devices
+void benchmarkResults(JsonDocument& doc) {
+    doc["run"] = benchRun;
+    doc["count"] = benchCount;
+    doc["model"] = DEVICE_MODEL;
+    doc["firmware"] = FIRMWARE_VERSION;
+    doc["clockSynced"] = clockSynced;
+    doc["clockSyncRttMs"] = clockSyncRttMs;
+    doc["staleProbes"] = benchStaleProbes;
+    doc["rssi"] = WiFi.RSSI();
+    
+    JsonArray limits = doc["bucketLimitsMs"].to<JsonArray>();
+    for (int i = 0; i < BENCH_BUCKETS - 1; i++) limits.add(benchBucketLimits[i]);
+    
+    JsonArray transports = doc["transports"].to<JsonArray>();
+    for (int i = 0; i < BENCH_TRANSPORTS; i++) {
+        BenchStats& stats = benchStats[i];
+        JsonObject t = transports.add<JsonObject>();
+        t["name"] = benchTransportNames[i];
+        t["received"] = stats.received;
+        t["measured"] = stats.measured;
+        if (stats.measured > 0) {
+            t["minMs"] = stats.minMs;
+            t["avgMs"] = (float)stats.sumMs / stats.measured;
+            t["maxMs"] = stats.maxMs;
+            t["jitterMs"] = stats.measured > 1 ? (float)stats.jitterSumMs / (stats.measured - 1) : 0.0f;
+        }
+        JsonArray histogram = t["histogram"].to<JsonArray>();
+        for (int b = 0; b < BENCH_BUCKETS; b++) histogram.add(stats.histogram[b]);
+    }
+}
+
+void handleBenchmark() {
+    if (!benchSyncPending) return;
+    benchSyncPending = false;
+    
+    if (syncServerClock()) {
+        Serial.printf("[BENCH] Clock synced, best round trip %lu ms\n", clockSyncRttMs);
+    } else {
+        Serial.printf("[BENCH] Clock sync failed; latencies are not measured\n");
+    }
+}
+
+// NTP-style offset from /api/time: the sample with the shortest round trip
+// has the least queueing, and its midpoint is taken as the server time
+bool syncServerClock() {
+    if (!hbTemplatesValid) return false;
+    
+    char request[160];
+    int length = snprintf(request, sizeof(request),
+                          "GET /api/time HTTP/1.1\r\nHost: %s:%u\r\nConnection: keep-alive\r\n\r\n",
+                          hbServerHost, hbServerPort);
+    if (length <= 0 || length >= (int)sizeof(request)) return false;
+    
+    uint32_t bestRtt = UINT32_MAX;
+    for (int i = 0; i < CLOCK_SYNC_SAMPLES; i++) {
+        unsigned long sent = millis();
+        int code = httpTransact(request, length);
+        unsigned long rtt = millis() - sent;
+        
+        const char* v = jsonFindValue(hbResponse, "serverTime");
+        if (code != 200 || !v || rtt >= bestRtt) continue;
+        bestRtt = rtt;
+        serverClockOffset = (int64_t)strtoull(v, NULL, 10) - (int64_t)(sent + rtt / 2);
+    }
+    if (bestRtt == UINT32_MAX) return false;
+    
+    clockSynced = true;
+    clockSyncRttMs = bestRtt;
+    return true;
+}
+
+// ==================== TSL UMD FUNCTIONS ====================
+
+// Tally of a TSL 5.0 display message. Each of the three lamps (right, text,
+// left) is off, red, green or amber: red is program, green preview, amber both
+static uint8_t tsl5Tally(uint16_t control) {
+    uint8_t tally = 0;
+    for (int shift = 0; shift <= 4; shift += 2) {
+        uint8_t lamp = (control >> shift) & 0x03;
+        if (lamp & 0x01) tally |= TSL_PROGRAM;
+        if (lamp & 0x02) tally |= TSL_PREVIEW;
+    }
+    return tally;
+}
+
+// Tally for one display from a TSL packet, or TSL_NO_MATCH/TSL_MALFORMED.
+// TSL 5.0: PBC(2) VER(1) FLAGS(1) SCREEN(2), then messages of INDEX(2)
+// CONTROL(2) LENGTH(2) TEXT, all little-endian; index 0xFFFF addresses every
+// display. TSL 3.1: 18-byte messages of 0x80 + address, control (bit 0
+// tally 1 = program, bit 1 tally 2 = preview) and 16 characters. The last
+// message for the display wins
+static int tslParse(const uint8_t* data, size_t length, uint16_t index) {
+    int tally = TSL_NO_MATCH;
+    
+    if (length >= 6 && (size_t)(data[0] | (data[1] << 8)) + 2 == length && data[2] == 0) {
+        if (data[3] & 0x02) return TSL_NO_MATCH;  // Screen control, no display messages
+        for (size_t pos = 6; pos < length; ) {
+            if (pos + 6 > length) return TSL_MALFORMED;
+            uint16_t messageIndex = data[pos] | (data[pos + 1] << 8);
+            uint16_t control = data[pos + 2] | (data[pos + 3] << 8);
+            size_t textLength = data[pos + 4] | (data[pos + 5] << 8);
+            pos += 6 + textLength;
+            if (pos > length) return TSL_MALFORMED;
+            
+            // Bit 15 marks control data instead of a display message
+            if ((control & 0x8000) || (messageIndex != index && messageIndex != 0xFFFF)) continue;
+            tally = tsl5Tally(control);
+        }
+        return tally;
+    }
+    
+    if (length == 0 || length % TSL_V31_LENGTH != 0) return TSL_MALFORMED;
+    for (size_t pos = 0; pos < length; pos += TSL_V31_LENGTH) {
+        if (!(data[pos] & 0x80) || (data[pos + 1] & 0x80)) return TSL_MALFORMED;
+        if ((data[pos] & 0x7F) != index) continue;
+        tally = ((data[pos + 1] & 0x01) ? TSL_PROGRAM : 0) | ((data[pos + 1] & 0x02) ? TSL_PREVIEW : 0);
+    }
+    return tally;
+}
+
+// Runs in the lwIP thread. Datagrams from the WiFi driver sit in a single
+// pbuf and are parsed in place; a chained one is gathered on the stack
+static void tslReceive(void* arg, struct udp_pcb* pcb, struct pbuf* p, const ip_addr_t* addr, uint16_t port) {
+    tslPackets++;
+    int tally = TSL_MALFORMED;
+    if (!tslEnabled) {
+        tally = TSL_NO_MATCH;
+    } else if (p->len == p->tot_len) {
+        tally = tslParse((const uint8_t*)p->payload, p->len, tslIndex);
+    } else if (p->tot_len <= 128) {
+        uint8_t packet[128];
+        tally = tslParse(packet, pbuf_copy_partial(p, packet, p->tot_len, 0), tslIndex);
+    }
+    pbuf_free(p);
+    
+    if (tally == TSL_MALFORMED) {
+        tslMalformed++;
+        return;
+    }
+    if (tally == TSL_NO_MATCH) return;
+    
+    tslMatched++;
+    TslTally update = { (uint8_t)tally, (uint32_t)micros() };
+    if (xQueueSend(tslQueue, &update, 0) != pdTRUE) {
+        udpQueueOverflows++;
+        return;
+    }
+    if (udpIngestWakeTask) xTaskNotifyGive(udpIngestWakeTask);
+}
+
+// Open the listeners on first use, apply the newest queued datagram tally
+// and read the TCP stream. A port change takes effect after a restart
+void handleTsl() {
+    tslEnabled = (tallyMode == TALLY_MODE_TSL || tallyMode == TALLY_MODE_MERGE) && tslPort != 0;
+    if (!tslEnabled || WiFi.status() != WL_CONNECTED) return;
+    
+    if (!tslListening) {
+        tslListening = true;
+        tslQueue = xQueueCreate(UDP_INGEST_QUEUE_LEN, sizeof(TslTally));
+        if (tslQueue) tslPcb = udpIngestOpen(tslPort, 0, tslReceive);
+        tslServer.begin(tslPort);
+        tslServer.setNoDelay(true);
+        Serial.printf("[TSL] Listening on UDP/TCP port %d for display %d\n", tslPort, tslIndex);
+    }
+    
+    if (tslQueue) {
+        TslTally update;
+        bool received = false;
+        while (xQueueReceive(tslQueue, &update, 0) == pdTRUE) received = true;
+        if (received) applyTslTally(update.tally, update.receivedUs);
+    }
+    
+    // Switchers repeat their tally; a silent one no longer counts
+    if (feeds[FEED_TSL].active && !tslClient.connected() && millis() - feeds[FEED_TSL].updatedAt > TSL_FEED_TIMEOUT) {
+        dropFeed(FEED_TSL);
+    }
+    
+    // One TCP sender at a time; a new connection replaces the old one
+    WiFiClient incoming = tslServer.available();
+    if (incoming) {
+        tslClient.stop();
+        tslClient = incoming;
+        tslRxVersion = 0;
+        tslRxEscape = false;
+    }
+    for (int budget = 512; budget > 0 && tslClient.available() > 0; budget--) {
+        feedTslByte(tslClient.read());
+    }
+}
+
+// TCP stream: TSL 5.0 packets start with DLE/STX and double any DLE in the
+// body; TSL 3.1 messages start with the only byte that has the top bit set.
+// 3.1 address 126 is 0xFE (DLE) and cannot be used over TCP
+void feedTslByte(uint8_t b) {
+    if (tslRxEscape) {
+        tslRxEscape = false;
+        if (b == TSL_STX) {
+            tslRxVersion = 5;
+            tslRxLength = 0;
+            return;
+        }
+        if (b != TSL_DLE || tslRxVersion != 5) {
+            tslRxVersion = 0;                // Lost sync: wait for the next start
+            return;
+        }
+    } else if (b == TSL_DLE && tslRxVersion != 3) {
+        tslRxEscape = true;
+        return;
+    } else if (tslRxVersion == 0) {
+        if (!(b & 0x80)) return;
+        tslRxVersion = 3;
+        tslRxLength = 0;
+    }
+    
+    tslRx[tslRxLength++] = b;
+    size_t expected = TSL_V31_LENGTH;
+    if (tslRxVersion == 5) {
+        expected = tslRxLength >= 2 ? (size_t)(tslRx[0] | (tslRx[1] << 8)) + 2 : sizeof(tslRx);
+    }
+    
+    if (tslRxLength == expected) {
+        tslTcpPackets++;
+        tslPackets++;
+        int tally = tslParse(tslRx, tslRxLength, tslIndex);
+        if (tally == TSL_MALFORMED) {
+            tslMalformed++;
+        } else if (tally != TSL_NO_MATCH) {
+            tslMatched++;
+            applyTslTally(tally, micros());
+        }
+        tslRxVersion = 0;
+    } else if (tslRxLength >= sizeof(tslRx) || expected > sizeof(tslRx)) {
+        tslMalformed++;
+        tslRxVersion = 0;
+    }
+}
+
+void applyTslTally(uint8_t tally, uint32_t receivedUs) {
+    if (!tslSeen) {
+        Serial.printf("[TSL] Following display %d\n", tslIndex);
+    }
+    tslSeen = true;
+    tslTally = tally;
+    if (applyLocalTally(FEED_TSL, tally & TSL_PROGRAM, tally & TSL_PREVIEW)) {
+        tslLastApplyUs = micros() - receivedUs;
+    }
+}
+
+// ==================== OBS DIRECT FUNCTIONS ====================
+
+// True while OBS, not the server, decides this device's tally
+bool obsTallyActive() {
+    return tallyMode == TALLY_MODE_OBS && obsIdentified;
+}
+
+// Keep the OBS session up: upgrade, Hello/Identify, keepalive pings and
+// frame dispatch. OBS sends each frame in one go on a LAN, so a started
+// frame is read to the end with a short timeout
+void handleObsDirect() {
+    if ((tallyMode != TALLY_MODE_OBS && tallyMode != TALLY_MODE_MERGE) || obsHost.length() == 0 ||
+            WiFi.status() != WL_CONNECTED) return;
+    
+    if (!obsClient.connected()) {
+        if (obsIdentified || obsUpgrading) closeObs("connection lost");
+        if (lastObsAttempt != 0 && millis() - lastObsAttempt < OBS_RECONNECT_INTERVAL) return;
+        lastObsAttempt = millis();
+        connectObs();
+        return;
+    }
+    
+    if (obsUpgrading) {
+        readObsUpgrade();
+        return;
+    }
+    
+    for (int i = 0; i < 4 && obsClient.available() >= 2; i++) {
+        if (!readObsFrame()) return;
+    }
+    
+    unsigned long now = millis();
+    if (now - lastObsFrame > OBS_IDLE_TIMEOUT) {
+        obsFailures++;
+        closeObs("no traffic");
+        return;
+    }
+    if (now - lastObsPing > OBS_PING_INTERVAL) {
+        sendObsFrame(0x9, NULL, 0);
+        lastObsPing = now;
+    }
+    
+    // A lost item list would hold the tally back for good: ask again, then
+    // give the tally back to the server
+    if ((obsProgramRequest != 0 || obsPreviewRequest != 0) && now - obsItemsRequestedAt > OBS_REQUEST_TIMEOUT) {
+        obsRequestTimeouts++;
+        if (obsItemsRetries >= OBS_REQUEST_RETRIES) {
+            obsFailures++;
+            closeObs("item list timed out");
+            return;
+        }
+        obsItemsRetries++;
+        if (obsProgramRequest != 0) requestObsSceneItems(true);
+        if (obsPreviewRequest != 0) requestObsSceneItems(false);
+    }
+    
+    // The server or the config page may reassign the source at any time
+    if (obsIdentified && assignedSource != obsTrackedSource) {
+        obsTrackedSource = assignedSource;
+        requestObsSceneItems(true);
+        requestObsSceneItems(false);
+    }
+}
+
+bool connectObs() {
+    IPAddress obsIP;
+    if (!resolveHost(obsHost.c_str(), obsIP) || !obsClient.connect(obsIP, obsPort, HB_CONNECT_TIMEOUT)) {
+        obsFailures++;
+        return false;
+    }
+    setSocketDscp(obsClient, DSCP_TALLY);
+    obsClient.setNoDelay(true);
+    
+    // Sixteen random bytes; the accept hash is not checked, OBS is a configured peer
+    uint8_t nonce[16];
+    for (size_t i = 0; i < sizeof(nonce); i += 4) {
+        uint32_t r = esp_random();
+        memcpy(nonce + i, &r, 4);
+    }
+    char key[32];
+    size_t keyLength = 0;
+    mbedtls_base64_encode((unsigned char*)key, sizeof(key), &keyLength, nonce, sizeof(nonce));
+    key[keyLength] = 0;
+    
+    char request[320];
+    int length = snprintf(request, sizeof(request),
+                          "GET / HTTP/1.1\r\nHost: %s:%u\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                          "Sec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n"
+                          "Sec-WebSocket-Protocol: obswebsocket.json\r\n\r\n",
+                          obsHost.c_str(), obsPort, key);
+    if (length <= 0 || length >= (int)sizeof(request) ||
+            obsClient.write((const uint8_t*)request, length) != (size_t)length) {
+        obsClient.stop();
+        obsFailures++;
+        return false;
+    }
+    
+    obsUpgrading = true;
+    obsUpgradeReceived = 0;
+    obsConnectedAt = millis();
+    return true;
+}
+
+// Collect the response to the upgrade request. Read byte-wise so the Hello
+// frame that follows the headers stays in the socket
+void readObsUpgrade() {
+    while (obsClient.available() > 0 && obsUpgradeReceived < OBS_UPGRADE_BUFFER) {
+        obsUpgrade[obsUpgradeReceived++] = obsClient.read();
+        obsUpgrade[obsUpgradeReceived] = 0;
+        if (obsUpgradeReceived < 4 || memcmp(obsUpgrade + obsUpgradeReceived - 4, "\r\n\r\n", 4) != 0) continue;
+        
+        if (strncmp(obsUpgrade, "HTTP/1.1 101", 12) != 0) {
+            Serial.printf("[OBS] WebSocket upgrade refused: %.*s\n", (int)strcspn(obsUpgrade, "\r"), obsUpgrade);
+            obsFailures++;
+            closeObs("upgrade refused");
+            return;
+        }
+        obsUpgrading = false;
+        lastObsFrame = millis();
+        lastObsPing = lastObsFrame;
+        return;
+    }
+    
+    if (obsUpgradeReceived >= OBS_UPGRADE_BUFFER || millis() - obsConnectedAt > OBS_HANDSHAKE_TIMEOUT) {
+        obsFailures++;
+        closeObs("upgrade timed out");
+    }
+}
+
+// Drop the session; the next server update or heartbeat sets the tally again
+void closeObs(const char* reason) {
+    if (obsIdentified) {
+        Serial.printf("[OBS] Session closed (%s), following server tally\n", reason);
+    }
+    obsClient.stop();
+    obsUpgrading = false;
+    obsIdentified = false;
+    obsProgramScene = "";
+    obsPreviewScene = "";
+    obsProgramRequest = 0;
+    obsPreviewRequest = 0;
+    obsWalkCount[0] = obsWalkCount[1] = 0;
+    obsItemsRetries = 0;
+    dropFeed(FEED_OBS);
+}
+
+// Read and dispatch one frame. Returns false once the session is closed
+bool readObsFrame() {
+    uint8_t header[2];
+    if (!obsReadExact(header, 2)) {
+        closeObs("frame timeout");
+        return false;
+    }
+    obsFrameStartUs = micros();
+    lastObsFrame = millis();
+    
+    uint8_t opcode = header[0] & 0x0F;
+    uint64_t length = header[1] & 0x7F;
+    if (header[1] & 0x80) {
+        closeObs("masked server frame");
+        return false;
+    }
+    if (length >= 126) {
+        uint8_t extended[8];
+        size_t size = length == 126 ? 2 : 8;
+        if (!obsReadExact(extended, size)) {
+            closeObs("frame timeout");
+            return false;
+        }
+        length = 0;
+        for (size_t i = 0; i < size; i++) length = (length << 8) | extended[i];
+    }
+    
+    // OBS does not fragment messages; fragments are skipped. Text frames that
+    // are too large to buffer, such as the item list of a busy scene, are
+    // parsed from the socket instead
+    bool fragment = !(header[0] & 0x80) || opcode == 0x0;
+    char* payload = (length <= OBS_MAX_FRAME && !fragment) ? (char*)malloc(length + 1) : NULL;
+    if (!payload) {
+        if (!fragment && opcode == 0x1) return streamObsMessage(length);
+        obsSkippedFrames++;
+        return skipObsPayload(length);
+    }
+    if (!obsReadExact((uint8_t*)payload, length)) {
+        free(payload);
+        closeObs("frame timeout");
+        return false;
+    }
+    payload[length] = 0;
+    
+    bool open = true;
+    if (opcode == 0x1) {
+        JsonDocument doc;
+        if (!deserializeJson(doc, payload, length, DeserializationOption::Filter(obsMessageFilter()))) {
+            handleObsMessage(doc);
+        }
+    } else if (opcode == 0x9) {
+        sendObsFrame(0xA, (const uint8_t*)payload, length);
+    } else if (opcode == 0x8) {
+        // Close: 4009 is a failed authentication, 4010 an unsupported RPC version
+        if (length >= 2) {
+            Serial.printf("[OBS] Closed by OBS with code %u %.*s\n", ((uint8_t)payload[0] << 8) | (uint8_t)payload[1],
+                          (int)(length - 2), payload + 2);
+        }
+        sendObsFrame(0x8, (const uint8_t*)payload, length >= 2 ? 2 : 0);
+        closeObs("closed by OBS");
+        open = false;
+    }
+    free(payload);
+    return open;
+}
+
+bool obsReadExact(uint8_t* buffer, size_t length) {
+    size_t received = 0;
+    unsigned long start = millis();
+    while (received < length) {
+        int n = obsClient.read(buffer + received, length - received);
+        if (n > 0) {
+            received += n;
+        } else if (!obsClient.connected() || millis() - start > OBS_FRAME_TIMEOUT) {
+            return false;
+        } else {
+            delay(1);
+        }
+    }
+    return true;
+}
+
+bool skipObsPayload(uint64_t length) {
+    uint8_t scratch[128];
+    while (length > 0) {
+        size_t chunk = length < sizeof(scratch) ? (size_t)length : sizeof(scratch);
+        if (!obsReadExact(scratch, chunk)) {
+            closeObs("frame timeout");
+            return false;
+        }
+        length -= chunk;
+    }
+    return true;
+}
+
+// Payload of the current frame as an ArduinoJson reader, read in chunks
+// with the frame timeout
+struct ObsFrameReader {
+    uint64_t remaining;
+    bool failed;
+    uint8_t buffer[128];
+    size_t length;
+    size_t position;
+    
+    int read() {
+        if (position == length) {
+            if (remaining == 0 || failed) return -1;
+            length = remaining < sizeof(buffer) ? (size_t)remaining : sizeof(buffer);
+            position = 0;
+            if (!obsReadExact(buffer, length)) {
+                failed = true;
+                length = 0;
+                return -1;
+            }
+            remaining -= length;
+        }
+        return buffer[position++];
+    }
+    
+    size_t readBytes(char* out, size_t count) {
+        size_t n = 0;
+        for (int c; n < count && (c = read()) >= 0; ) out[n++] = c;
+        return n;
+    }
+};
+
+// Parse a text frame without buffering it; the filter keeps the document
+// small whatever the frame size
+bool streamObsMessage(uint64_t length) {
+    ObsFrameReader reader = {};
+    reader.remaining = length;
+    JsonDocument doc;
+    DeserializationError error = deserializeJson(doc, reader, DeserializationOption::Filter(obsMessageFilter()));
+    if (reader.failed) {
+        closeObs("frame timeout");
+        return false;
+    }
+    // Whatever follows the document, or the rest after a parse error
+    if (!skipObsPayload(reader.remaining)) return false;
+    
+    obsStreamedFrames++;
+    if (!error) handleObsMessage(doc);
+    return true;
+}
+
+// Client frames are masked (RFC 6455 section 5.3). Payloads stay below
+// 64 KB, so the 16-bit length form is enough
+bool sendObsFrame(uint8_t opcode, const uint8_t* payload, size_t length) {
+    uint8_t header[8];
+    size_t headerLength = 2;
+    header[0] = 0x80 | opcode;
+    if (length < 126) {
+        header[1] = 0x80 | length;
+    } else {
+        header[1] = 0x80 | 126;
+        header[2] = length >> 8;
+        header[3] = length & 0xFF;
+        headerLength = 4;
+    }
+    uint32_t mask = esp_random();
+    uint8_t* key = header + headerLength;
+    memcpy(key, &mask, 4);
+    headerLength += 4;
+    if (obsClient.write(header, headerLength) != headerLength) return false;
+    
+    uint8_t chunk[128];
+    for (size_t sent = 0; sent < length; ) {
+        size_t n = length - sent < sizeof(chunk) ? length - sent : sizeof(chunk);
+        for (size_t i = 0; i < n; i++) chunk[i] = payload[sent + i] ^ key[(sent + i) & 3];
+        if (obsClient.write(chunk, n) != n) return false;
+        sent += n;
+    }
+    return true;
+}
+
+bool sendObsJson(JsonDocument& doc) {
+    char text[512];
+    size_t length = measureJson(doc);
+    if (length >= sizeof(text)) return false;
+    serializeJson(doc, text, sizeof(text));
+    return sendObsFrame(0x1, (const uint8_t*)text, length);
+}
+
+void sendObsRequest(const char* type, const char* id, const char* sceneName) {
+    JsonDocument request;
+    request["op"] = 6;
+    JsonObject d = request["d"].to<JsonObject>();
+    d["requestType"] = type;
+    d["requestId"] = id;
+    if (sceneName) d["requestData"]["sceneName"] = sceneName;
+    sendObsJson(request);
+}
+
+// Identify, answering the challenge if OBS sent one:
+// base64(sha256(base64(sha256(password + salt)) + challenge))
+void sendObsIdentify(JsonObject auth) {
+    JsonDocument identify;
+    identify["op"] = 1;
+    JsonObject d = identify["d"].to<JsonObject>();
+    d["rpcVersion"] = OBS_RPC_VERSION;
+    d["eventSubscriptions"] = OBS_EVENT_SUBSCRIPTIONS;
+    if (!auth.isNull()) {
+        char secret[48];
+        char response[48];
+        obsAuthHash(obsPassword.c_str(), auth["salt"] | "", secret);
+        obsAuthHash(secret, auth["challenge"] | "", response);
+        d["authentication"] = response;
+    }
+    sendObsJson(identify);
+}
+
+// base64(sha256(first + second)) into a buffer of at least 45 bytes
+void obsAuthHash(const char* first, const char* second, char* out) {
+    uint8_t digest[32];
+    mbedtls_md_context_t ctx;
+    mbedtls_md_init(&ctx);
+    mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 0);
+    mbedtls_md_starts(&ctx);
+    mbedtls_md_update(&ctx, (const uint8_t*)first, strlen(first));
+    mbedtls_md_update(&ctx, (const uint8_t*)second, strlen(second));
+    mbedtls_md_finish(&ctx, digest);
+    mbedtls_md_free(&ctx);
+    
+    size_t length = 0;
+    mbedtls_base64_encode((unsigned char*)out, 48, &length, digest, sizeof(digest));
+    out[length] = 0;
+}
+
+// Scene item lists carry transforms and more; keep what the tally needs
+JsonDocument& obsMessageFilter() {
+    static JsonDocument filter;
+    if (!filter.isNull()) return filter;
+    
+    filter["op"] = true;
+    JsonObject d = filter["d"].to<JsonObject>();
+    d["authentication"] = true;
+    d["negotiatedRpcVersion"] = true;
+    d["eventType"] = true;
+    d["eventData"] = true;
+    d["requestId"] = true;
+    d["requestStatus"]["result"] = true;
+    d["responseData"]["currentProgramSceneName"] = true;
+    d["responseData"]["currentPreviewSceneName"] = true;
+    d["responseData"]["outputActive"] = true;
+    d["responseData"]["sceneItems"][0]["sourceName"] = true;
+    d["responseData"]["sceneItems"][0]["sceneItemEnabled"] = true;
+    d["responseData"]["sceneItems"][0]["sourceType"] = true;
+    d["responseData"]["sceneItems"][0]["isGroup"] = true;
+    return filter;
+}
+
+void handleObsMessage(JsonDocument& doc) {
+    int op = doc["op"] | -1;
+    JsonObject data = doc["d"];
+    if (op == 0) {
+        // Hello
+        sendObsIdentify(data["authentication"]);
+    } else if (op == 2) {
+        // Identified: read the current state, events keep it up to date
+        obsIdentified = true;
+        obsConnects++;
+        obsTrackedSource = assignedSource;
+        Serial.printf("[OBS] Identified with %s:%u (RPC %d)\n", obsHost.c_str(), obsPort, data["negotiatedRpcVersion"] | 0);
+        sendObsRequest("GetCurrentProgramScene", "program", NULL);
+        sendObsRequest("GetCurrentPreviewScene", "preview", NULL);
+        sendObsRequest("GetRecordStatus", "record", NULL);
+        sendObsRequest("GetStreamStatus", "stream", NULL);
+    } else if (op == 5) {
+        obsEvents++;
+        handleObsEvent(data["eventType"] | "", data["eventData"]);
+    } else if (op == 7) {
+        handleObsResponse(data);
+    }
+}
+
+void handleObsEvent(const char* type, JsonObject data) {
+    const char* scene = data["sceneName"] | "";
+    
+    if (strcmp(type, "CurrentProgramSceneChanged") == 0) {
+        obsProgramScene = scene;
+        requestObsSceneItems(true);
+    } else if (strcmp(type, "CurrentPreviewSceneChanged") == 0) {
+        obsPreviewScene = scene;
+        requestObsSceneItems(false);
+    } else if (strcmp(type, "StudioModeStateChanged") == 0) {
+        if (data["studioModeEnabled"] | false) {
+            sendObsRequest("GetCurrentPreviewScene", "preview", NULL);
+        } else {
+            obsPreviewScene = "";
+            requestObsSceneItems(false);
+        }
+    } else if (strcmp(type, "SceneNameChanged") == 0) {
+        const char* oldName = data["oldSceneName"] | "";
+        if (obsProgramScene == oldName) obsProgramScene = scene;
+        if (obsPreviewScene == oldName) obsPreviewScene = scene;
+        for (int side = 0; side < 2; side++) {
+            for (int i = 0; i < obsWalkCount[side]; i++) {
+                if (obsWalkScenes[side][i] == oldName) obsWalkScenes[side][i] = scene;
+            }
+        }
+    } else if (strcmp(type, "SceneItemEnableStateChanged") == 0 ||
+               strcmp(type, "SceneItemCreated") == 0 || strcmp(type, "SceneItemRemoved") == 0) {
+        // Events name the item by id only; a walk that read the scene is redone
+        if (obsWalkVisited(0, scene)) requestObsSceneItems(true);
+        if (obsWalkVisited(1, scene)) requestObsSceneItems(false);
+    } else if (strcmp(type, "RecordStateChanged") == 0) {
+        applyObsOutput(true, data["outputActive"] | false);
+    } else if (strcmp(type, "StreamStateChanged") == 0) {
+        applyObsOutput(false, data["outputActive"] | false);
+    }
+}
+
+void handleObsResponse(JsonObject data) {
+    const char* id = data["requestId"] | "";
+    bool ok = data["requestStatus"]["result"] | false;
+    JsonObject response = data["responseData"];
+    
+    if (strncmp(id, "items:", 6) == 0) {
+        // items:<walk>:<depth>; answers to superseded walks are dropped
+        char* end;
+        uint32_t request = strtoul(id + 6, &end, 10);
+        int depth = (*end == ':') ? atoi(end + 1) : 0;
+        int side = (request == obsProgramRequest) ? 0 : (request == obsPreviewRequest ? 1 : -1);
+        if (request == 0 || side < 0) return;
+        
+        obsWalkPending[side]--;
+        if (ok && assignedSource.length() > 0) {
+            for (JsonObject item : response["sceneItems"].as<JsonArray>()) {
+                if (!(item["sceneItemEnabled"] | false)) continue;
+                const char* source = item["sourceName"] | "";
+                if (assignedSource == source) {
+                    obsWalkFound[side] = true;
+                    break;
+                }
+                // Scenes and groups shown through an enabled item are read as well
+                if (depth < OBS_NEST_DEPTH && obsWalkCount[side] < OBS_WALK_SCENES &&
+                    strcmp(item["sourceType"] | "", "OBS_SOURCE_TYPE_SCENE") == 0 && !obsWalkVisited(side, source)) {
+                    requestObsNestedItems(side, source, item["isGroup"] | false, depth + 1);
+                }
+            }
+        }
+        if (obsWalkFound[side] || obsWalkPending[side] == 0) {
+            (side == 0 ? obsInProgram : obsInPreview) = obsWalkFound[side];
+            (side == 0 ? obsProgramRequest : obsPreviewRequest) = 0;
+        }
+        if (obsProgramRequest == 0 && obsPreviewRequest == 0) obsItemsRetries = 0;
+        applyObsTally();
+    } else if (strcmp(id, "program") == 0) {
+        obsProgramScene = ok ? (response["currentProgramSceneName"] | "") : "";
+        requestObsSceneItems(true);
+    } else if (strcmp(id, "preview") == 0) {
+        // Fails outside studio mode, where there is no preview scene
+        obsPreviewScene = ok ? (response["currentPreviewSceneName"] | "") : "";
+        requestObsSceneItems(false);
+    } else if (ok && strcmp(id, "record") == 0) {
+        applyObsOutput(true, response["outputActive"] | false);
+    } else if (ok && strcmp(id, "stream") == 0) {
+        applyObsOutput(false, response["outputActive"] | false);
+    }
+}
+
+// Walk the program or preview scene: its item list, then those of the
+// scenes and groups it shows. Request ids tell answers to superseded
+// walks apart
+void requestObsSceneItems(bool program) {
+    const String& scene = program ? obsProgramScene : obsPreviewScene;
+    uint32_t& request = program ? obsProgramRequest : obsPreviewRequest;
+    int side = program ? 0 : 1;
+    obsWalkCount[side] = 0;
+    obsWalkPending[side] = 0;
+    obsWalkFound[side] = false;
+    if (scene.length() == 0) {
+        request = 0;
+        (program ? obsInProgram : obsInPreview) = false;
+        applyObsTally();
+        return;
+    }
+    
+    request = ++obsRequestCounter;
+    requestObsNestedItems(side, scene.c_str(), false, 0);
+}
+
+void requestObsNestedItems(int side, const char* scene, bool group, int depth) {
+    uint32_t request = (side == 0) ? obsProgramRequest : obsPreviewRequest;
+    obsWalkScenes[side][obsWalkCount[side]++] = scene;
+    obsWalkPending[side]++;
+    obsItemsRequestedAt = millis();
+    char id[32];
+    snprintf(id, sizeof(id), "items:%lu:%d", (unsigned long)request, depth);
+    sendObsRequest(group ? "GetGroupSceneItemList" : "GetSceneItemList", id, scene);
+}
+
+bool obsWalkVisited(int side, const char* scene) {
+    for (int i = 0; i < obsWalkCount[side]; i++) {
+        if (obsWalkScenes[side][i] == scene) return true;
+    }
+    return false;
+}
+
+// Same rule as the server: enabled in the program scene, directly or
+// through enabled nested scenes and groups, is Live, else the same in the
+// preview scene is Preview. Applied once both walks are done, so a studio
+// mode cut does not flash an intermediate state
+void applyObsTally() {
+    if (obsProgramRequest != 0 || obsPreviewRequest != 0) return;
+    
+    if (applyLocalTally(FEED_OBS, obsInProgram, obsInPreview)) {
+        obsLastApplyUs = micros() - obsFrameStartUs;
+        Serial.printf("[OBS] %s is %s\n", assignedSource.c_str(), currentStatus.c_str());
+    }
+}
+
+void applyObsOutput(bool recording, bool active) {
+    bool& state = recording ? isRecording : isStreaming;
+    if (state == active) return;
+    
+    state = active;
+    Serial.printf("[OBS] %s %s\n", recording ? "Recording" : "Streaming", active ? "started" : "stopped");
+    updateDisplay();
+}
+
+// Show a tally worked out on the device (OBS direct, TSL or the scene
+// graph). While merging, the feed's state is recorded and the combined
+// state shown. Returns true if the displayed state changed
+bool applyLocalTally(uint8_t feed, bool program, bool preview) {
+    if (tallyMode != TALLY_MODE_MERGE) return showTally(program, preview);
+    
+    recordFeed(feed, true, program, preview);
+    bool changed = showMergedTally();
+    if (changed) feeds[feed].changes++;
+    return changed;
+}
+
+bool showTally(bool program, bool preview) {
+    bool wasProgram = isProgram;
+    bool wasPreview = isPreview;
+    isProgram = program;
+    isPreview = !program && preview;
+    currentStatus = isProgram ? "LIVE" : (isPreview ? "PREVIEW" : "IDLE");
+    markTallyFresh();
+    
+    if (isProgram == wasProgram && isPreview == wasPreview) return false;
+    updateDisplay();
+    return true;
+}
+
+// True while OBS, a TSL source or the feed merger, not the server alone,
+// decides the tally
+bool deviceTallyActive() {
+    return tallyMode == TALLY_MODE_MERGE || obsTallyActive() || (tallyMode == TALLY_MODE_TSL && tslSeen);
+}
+
+// ==================== FRAME AUTH FUNCTIONS ====================
+
+// Prepare the HMAC key schedule; an empty key turns authentication off
+void setupFrameKey() {
+    static bool contextsReady = false;
+    frameKeyReady = false;
+    if (frameKey.length() == 0) return;
+    
+    const mbedtls_md_info_t* sha256 = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+    if (!contextsReady) {
+        mbedtls_md_context_t* contexts[] = {&frameMacInner, &frameMacOuter, &frameMacWork};
+        for (mbedtls_md_context_t* ctx : contexts) {
+            mbedtls_md_init(ctx);
+            mbedtls_md_setup(ctx, sha256, 0);
+        }
+        contextsReady = true;
+    }
+    
+    // Keys longer than a block are hashed first, shorter ones zero-padded
+    uint8_t key[64] = {0};
+    if (frameKey.length() > sizeof(key)) {
+        mbedtls_md(sha256, (const uint8_t*)frameKey.c_str(), frameKey.length(), key);
+    } else {
+        memcpy(key, frameKey.c_str(), frameKey.length());
+    }
+    
+    uint8_t pad[64];
+    for (int i = 0; i < 64; i++) pad[i] = key[i] ^ 0x36;
+    mbedtls_md_starts(&frameMacInner);
+    mbedtls_md_update(&frameMacInner, pad, sizeof(pad));
+    for (int i = 0; i < 64; i++) pad[i] = key[i] ^ 0x5C;
+    mbedtls_md_starts(&frameMacOuter);
+    mbedtls_md_update(&frameMacOuter, pad, sizeof(pad));
+    frameKeyReady = true;
+}
+
+// HMAC-SHA256 of data followed by suffix, from the cached key schedule
+void frameMac(const uint8_t* data, size_t length, const char* suffix, uint8_t* digest) {
+    mbedtls_md_clone(&frameMacWork, &frameMacInner);
+    mbedtls_md_update(&frameMacWork, data, length);
+    mbedtls_md_update(&frameMacWork, (const uint8_t*)suffix, strlen(suffix));
+    mbedtls_md_finish(&frameMacWork, digest);
+    mbedtls_md_clone(&frameMacWork, &frameMacOuter);
+    mbedtls_md_update(&frameMacWork, digest, 32);
+    mbedtls_md_finish(&frameMacWork, digest);
+}
+
+static int hexNibble(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// Replay check for frames without a sequence number: with a key set they
+// must carry a server timestamp within FRAME_MAX_AGE of the synced clock.
+// Until the clock is synced the age cannot be judged and the MAC decides
+bool frameFresh(JsonDocument& doc) {
+    if (!frameKeyReady) return true;
+    if (!doc["ts"].is<uint64_t>()) return false;
+    if (!clockSynced) return true;
+    int64_t age = (int64_t)serverNowMs() - (int64_t)doc["ts"].as<uint64_t>();
+    return age <= FRAME_MAX_AGE && age >= -FRAME_MAX_AGE;
+}
+
+// True if authentication is off or the frame ends in a valid MAC. The MAC
+// covers the frame as the server built it, i.e. with "}" for the trailer
+bool verifyFrameMac(const char* body, size_t length) {
+    if (!frameKeyReady) return true;
+    
+    unsigned long start = micros();
+    bool valid = length > FRAME_MAC_TRAILER;
+    const char* trailer = valid ? body + length - FRAME_MAC_TRAILER : body;
+    valid = valid && memcmp(trailer, ",\"mac\":\"", 8) == 0 &&
+            memcmp(body + length - 2, "\"}", 2) == 0;
+    if (valid) {
+        uint8_t digest[32];
+        frameMac((const uint8_t*)body, length - FRAME_MAC_TRAILER, "}", digest);
+        
+        // Compare every byte so the time does not depend on where they differ
+        uint8_t diff = 0;
+        for (int i = 0; i < FRAME_MAC_BYTES; i++) {
+            int high = hexNibble(trailer[8 + 2 * i]);
+            int low = hexNibble(trailer[9 + 2 * i]);
+            diff |= (high < 0 || low < 0) ? 1 : digest[i] ^ (uint8_t)(high << 4 | low);
+        }
+        valid = diff == 0;
+    }
+    
+    frameMacLastUs = micros() - start;
+    if (frameMacLastUs > frameMacMaxUs) frameMacMaxUs = frameMacLastUs;
+    if (valid) {
+        frameMacVerified++;
+    } else {
+        frameMacRejected++;
+    }
+    return valid;
+}
+
+// ==================== FEED MERGE FUNCTIONS ====================
+
+// Store a feed's state, keeping the program and preview counts current.
+// Inactive feeds count as idle
+void recordFeed(uint8_t feed, bool active, bool program, bool preview) {
+    FeedState& state = feeds[feed];
+    program = active && program;
+    preview = active && preview;
+    if (state.active != active || state.program != program || state.preview != preview) state.seq++;
+    feedProgramCount += (int)program - (int)state.program;
+    feedPreviewCount += (int)preview - (int)state.preview;
+    state.active = active;
+    state.program = program;
+    state.preview = preview;
+    state.updatedAt = millis();
+}
+
+// A feed went away: show what the others say
+void dropFeed(uint8_t feed) {
+    if (!feeds[feed].active) return;
+    recordFeed(feed, false, false, false);
+    if (tallyMode == TALLY_MODE_MERGE) showMergedTally();
+}
+
+bool showMergedTally() {
+    if (mergeRule == MERGE_RULE_PRIORITY) {
+        uint8_t feed = firstActiveFeed();
+        if (feed == FEED_COUNT) return showTally(false, false);
+        return showTally(feeds[feed].program, feeds[feed].preview);
+    }
+    return showTally(feedProgramCount > 0, feedPreviewCount > 0);
+}
+
+// FEED_COUNT if no feed is active
+uint8_t firstActiveFeed() {
+    for (uint8_t i = 0; i < FEED_COUNT; i++) {
+        if (feeds[feedOrder[i]].active) return feedOrder[i];
+    }
+    return FEED_COUNT;
+}
+
+// True if the merged state shown comes from this feed
+bool feedContributes(uint8_t feed) {
+    const FeedState& state = feeds[feed];
+    if (tallyMode != TALLY_MODE_MERGE || !state.active) return false;
+    if (mergeRule == MERGE_RULE_PRIORITY) return feed == firstActiveFeed();
+    return feedProgramCount > 0 ? state.program : state.preview;
+}
+
+void mergeServerStatus(const char* status) {
+    if (!status) return;
+    bool program = strcasecmp(status, "Live") == 0 || strcasecmp(status, "Program") == 0;
+    applyLocalTally(FEED_SERVER, program, strcasecmp(status, "Preview") == 0);
+}
+
+// Order for the priority rule from a list like "obs,tsl,server"; feeds
+// left out follow in the default order
+void parseFeedPriority() {
+    bool listed[FEED_COUNT] = {false};
+    uint8_t count = 0;
+    int start = 0;
+    while (start <= (int)feedPriority.length()) {
+        int end = feedPriority.indexOf(',', start);
+        if (end < 0) end = feedPriority.length();
+        String name = feedPriority.substring(start, end);
+        name.trim();
+        for (uint8_t i = 0; i < FEED_COUNT; i++) {
+            if (!listed[i] && name.equalsIgnoreCase(feedNames[i])) {
+                listed[i] = true;
+                feedOrder[count++] = i;
+            }
+        }
+        start = end + 1;
+    }
+    for (uint8_t i = 0; i < FEED_COUNT; i++) {
+        if (!listed[i]) feedOrder[count++] = i;
+    }
+}
+
+void resetFeeds() {
+    for (uint8_t i = 0; i < FEED_COUNT; i++) feeds[i] = FeedState();
+    feedProgramCount = 0;
+    feedPreviewCount = 0;
+}
+
+// ==================== SCENE GRAPH FUNCTIONS ====================
+
+// Keep the scene graph loaded while the server offers it. A new source or
+// a missed op means loading it again
+void handleSceneGraph() {
+    applySceneGraphFetch();
+    if (!sceneGraphNegotiated || !isRegistered || WiFi.status() != WL_CONNECTED) return;
+    if (sceneGraphValid && sceneGraphSource != assignedSource) requestSceneGraphSync("source changed");
+    if (!sceneGraphSyncPending) return;
+    if (sceneGraphFetchPending || sceneGraphFetchDone) return;
+    if (sceneGraphRetryAt != 0 && (long)(millis() - sceneGraphRetryAt) < 0) return;
+    queueSceneGraphFetch();
+}
+
+void requestSceneGraphSync(const char* reason) {
+    if (sceneGraphValid) {
+        Serial.printf("[SCENE] Scene graph out of step (%s), reloading\n", reason);
+        sceneGraphResyncs++;
+    }
+    sceneGraphValid = false;
+    sceneGraphSyncPending = true;
+    sceneGraphRetryAt = 0;
+    sceneGraphGeneration++;
+}
+
+// Ask the lookup task for the edges that can reach this device's source.
+// The URL goes through the resolver cache, which only the loop touches
+void queueSceneGraphFetch() {
+    sceneGraphFetchUrl = resolvedURL(serverURL) + "/api/esp32/scene-graph?deviceId=" + deviceID;
+    sceneGraphFetchGeneration = sceneGraphGeneration;
+    sceneGraphFetchPending = true;
+    if (!lookupQueue) {
+        fetchSceneGraph();
+        return;
+    }
+    LookupJob job = LOOKUP_SCENE_GRAPH;
+    if (xQueueSend(lookupQueue, &job, 0) != pdTRUE) {
+        sceneGraphFetchPending = false;
+        sceneGraphRetryAt = millis() + SCENE_GRAPH_RETRY;
+    }
+}
+
+// Lookup task side: the request itself
+void fetchSceneGraph() {
+    HTTPClient client;
+    client.begin(sceneGraphFetchUrl);
+    int code = client.GET();
+    if (code == 200) sceneGraphFetchBody = client.getString();
+    client.end();
+    
+    portENTER_CRITICAL(&lookupLock);
+    sceneGraphFetchCode = code;
+    sceneGraphFetchDone = true;
+    sceneGraphFetchPending = false;
+    portEXIT_CRITICAL(&lookupLock);
+}
+
+// Load a fetched snapshot. The server answers 413 when the edges do not
+// fit, and the device stays on pushes. A snapshot asked for before a newer
+// sync request is dropped and fetched again
+bool applySceneGraphFetch() {
+    portENTER_CRITICAL(&lookupLock);
+    bool done = sceneGraphFetchDone;
+    sceneGraphFetchDone = false;
+    int httpCode = sceneGraphFetchCode;
+    portEXIT_CRITICAL(&lookupLock);
+    if (!done) return false;
+    
+    if (!sceneGraphNegotiated || !sceneGraphSyncPending || sceneGraphFetchGeneration != sceneGraphGeneration) {
+        sceneGraphFetchBody = "";
+        sceneGraphHeldCount = 0;
+        return false;
+    }
+    if (httpCode != 200) {
+        sceneGraphHeldCount = 0;
+        if (httpCode == 413) {
+            sceneGraphSyncPending = false;
+        } else {
+            sceneGraphRetryAt = millis() + SCENE_GRAPH_RETRY;
+        }
+        Serial.printf("[SCENE] Scene graph request failed (%d)\n", httpCode);
+        return false;
+    }
+    
+    JsonDocument doc;
+    DeserializationError error = deserializeJson(doc, sceneGraphFetchBody);
+    sceneGraphFetchBody = "";
+    JsonArray edges = doc["edges"];
+    if (error || edges.size() > SCENE_GRAPH_MAX_EDGES) {
+        sceneGraphHeldCount = 0;
+        sceneGraphRetryAt = millis() + SCENE_GRAPH_RETRY;
+        return false;
+    }
+    
+    sceneEdgeCount = 0;
+    for (JsonVariant edge : edges) {
+        SceneEdge& e = sceneEdges[sceneEdgeCount++];
+        e.parent = edge[0] | "";
+        e.id = edge[1] | 0;
+        e.child = edge[2] | "";
+        e.enabled = edge[3] | false;
+    }
+    sceneGraphProgram = doc["program"] | "";
+    sceneGraphPreview = doc["preview"] | "";
+    sceneGraphEpoch = doc["epoch"] | 0UL;
+    sceneGraphSeq = doc["seq"] | 0UL;
+    
+    // The server's record of the source wins, as in tally updates
+    sceneGraphSource = doc["source"] | "";
+    if (sceneGraphSource != assignedSource) {
+        assignedSource = sceneGraphSource;
+        saveConfig();
+    }
+    
+    sceneGraphValid = true;
+    sceneGraphSyncPending = false;
+    sceneGraphLoads++;
+    Serial.printf("[SCENE] Scene graph for %s loaded: %d edges, seq %lu\n", sceneGraphSource.c_str(), sceneEdgeCount, (unsigned long)sceneGraphSeq);
+    applySceneGraphTally(micros());
+    
+    // Ops held while the snapshot was in flight; those it already has are
+    // skipped by their sequence numbers
+    for (int i = 0; i < sceneGraphHeldCount && sceneGraphValid; i++) applySceneOp(sceneGraphHeld[i], micros());
+    for (int i = 0; i < sceneGraphHeldCount; i++) sceneGraphHeld[i].clear();
+    sceneGraphHeldCount = 0;
+    return true;
+}
+
+static SceneEdge* findSceneEdge(const char* scene, int id) {
+    for (int i = 0; i < sceneEdgeCount; i++) {
+        if (sceneEdges[i].id == id && sceneEdges[i].parent == scene) return &sceneEdges[i];
+    }
+    return NULL;
+}
+
+// The source itself, or a scene with an edge on a path to it
+static bool sceneNodeRelevant(const char* name) {
+    if (sceneGraphSource == name) return true;
+    for (int i = 0; i < sceneEdgeCount; i++) {
+        if (sceneEdges[i].parent == name) return true;
+    }
+    return false;
+}
+
+static void renameSceneNode(const char* from, const char* to) {
+    for (int i = 0; i < sceneEdgeCount; i++) {
+        if (sceneEdges[i].parent == from) sceneEdges[i].parent = to;
+        if (sceneEdges[i].child == from) sceneEdges[i].child = to;
+    }
+    if (sceneGraphProgram == from) sceneGraphProgram = to;
+    if (sceneGraphPreview == from) sceneGraphPreview = to;
+}
+
+// Apply one broadcast op. Ops arrive by multicast and MQTT, so each sequence
+// number is applied once; a gap, a new epoch or a reset means a reload
+void handleSceneEvent(const char* body) {
+    if (!sceneGraphNegotiated) return;
+    unsigned long receivedUs = micros();
+    JsonDocument doc;
+    if (deserializeJson(doc, body)) return;
+    sceneGraphEvents++;
+    if (sceneGraphValid) {
+        applySceneOp(doc, receivedUs);
+    } else if ((sceneGraphFetchPending || sceneGraphFetchDone) && sceneGraphHeldCount < SCENE_GRAPH_HELD_OPS) {
+        // May be newer than the snapshot in flight
+        sceneGraphHeld[sceneGraphHeldCount++] = doc;
+    }
+    // Otherwise the pending reload includes this op
+}
+
+void applySceneOp(JsonDocument& doc, unsigned long receivedUs) {
+    const char* op = doc["op"] | "";
+    uint32_t seq = doc["seq"] | 0UL;
+    if ((doc["epoch"] | 0UL) != sceneGraphEpoch || strcmp(op, "reset") == 0) {
+        requestSceneGraphSync("reset");
+        return;
+    }
+    if (strcmp(op, "sync") == 0) {
+        if (seq != sceneGraphSeq) requestSceneGraphSync("missed op");
+        return;
+    }
+    if (seq <= sceneGraphSeq) return;    // Already applied from the other path
+    if (seq != sceneGraphSeq + 1) {
+        requestSceneGraphSync("missed op");
+        return;
+    }
+    sceneGraphSeq = seq;
+    
+    const char* scene = doc["scene"] | "";
+    int id = doc["id"] | 0;
+    if (strcmp(op, "program") == 0) {
+        sceneGraphProgram = scene;
+    } else if (strcmp(op, "preview") == 0) {
+        sceneGraphPreview = scene;
+    } else if (strcmp(op, "enable") == 0) {
+        SceneEdge* edge = findSceneEdge(scene, id);
+        if (!edge) return;                 // Not on a path to this source
+        edge->enabled = doc["on"] | false;
+    } else if (strcmp(op, "add") == 0) {
+        const char* child = doc["source"] | "";
+        if (!sceneNodeRelevant(child)) return;
+        
+        // Parents of a scene that did not lead here before were left out
+        if (!sceneNodeRelevant(scene) || sceneEdgeCount >= SCENE_GRAPH_MAX_EDGES) {
+            requestSceneGraphSync("new path");
+            return;
+        }
+        SceneEdge& edge = sceneEdges[sceneEdgeCount++];
+        edge.parent = scene;
+        edge.id = id;
+        edge.child = child;
+        edge.enabled = doc["on"] | true;
+    } else if (strcmp(op, "remove") == 0) {
+        SceneEdge* edge = findSceneEdge(scene, id);
+        if (!edge) return;
+        *edge = sceneEdges[--sceneEdgeCount];
+    } else if (strcmp(op, "rename") == 0) {
+        renameSceneNode(doc["from"] | "", doc["to"] | "");
+    } else {
+        return;
+    }
+    applySceneGraphTally(receivedUs);
+}
+
+// Depth-first over the few edges that can reach the source
+static bool sceneReaches(const String& scene, int depth) {
+    for (int i = 0; i < sceneEdgeCount; i++) {
+        const SceneEdge& edge = sceneEdges[i];
+        if (!edge.enabled || edge.parent != scene) continue;
+        if (edge.child == sceneGraphSource) return true;
+        if (depth > 0 && sceneReaches(edge.child, depth - 1)) return true;
+    }
+    return false;
+}
+
+void applySceneGraphTally(unsigned long receivedUs) {
+    if (!sceneGraphValid || (deviceTallyActive() && tallyMode != TALLY_MODE_MERGE)) return;
+    
+    bool program = sceneReaches(sceneGraphProgram, SCENE_GRAPH_MAX_DEPTH);
+    bool preview = sceneGraphPreview.length() > 0 && sceneReaches(sceneGraphPreview, SCENE_GRAPH_MAX_DEPTH);
+    if (applyLocalTally(FEED_SERVER, program, preview)) {
+        sceneGraphLastApplyUs = micros() - receivedUs;
     }
 }
 
@@ -10,6 +10,9 @@ const { Server } = require('socket.io');
 const fs = require('fs');
 const path = require('path');
 const OBSWebSocket = require('obs-websocket-js').default;
+const { recordObsEvents } = require('./server/obs-replay');
+const { createSceneGraph, loadSceneGraph, applySceneEvent, sourceTally, relevantEdges } = require('./server/scene-graph');
+const { signFrame, TRAILER_LENGTH } = require('./server/frame-auth');
 const net = require('net');
 const os = require('os');
 const QRCode = require('qrcode');
@@ -17,6 +20,24 @@ const dgram = require('dgram');
 const FormData = require('form-data');
 const axios = require('axios');
 
+// Optional mDNS advertisement so ESP32 devices can find the server without
+// a configured URL (npm install bonjour-service)
+let Bonjour = null;
+try {
+  ({ Bonjour } = require('bonjour-service'));
+} catch (err) {
+  console.warn('⚠️  bonjour-service not available - mDNS server advertisement disabled');
+}
+
+// Optional MQTT bridge for installations that already run a broker
+// (npm install mqtt)
+let mqtt = null;
+try {
+  mqtt = require('mqtt');
+} catch (err) {
+  console.warn('⚠️  mqtt not available - MQTT tally transport disabled');
+}
+
 // Check for fetch availability (Node.js 18+ has built-in fetch)
 let fetch;
 if (typeof globalThis.fetch === 'undefined') {
@@ -81,6 +102,8 @@ const CONFIG = {
     host: process.env.OBS_HOST || 'localhost',
     port: process.env.OBS_PORT || 4455,
     password: process.env.OBS_PASSWORD || '',
+    // Event log for server/obs-replay.js, the stand-in used to test direct-mode devices
+    recordEvents: process.env.OBS_RECORD_EVENTS || '',
     reconnectInterval: 5000, // Time between reconnection attempts in ms
     maxReconnectAttempts: 20
   },
@@ -88,6 +111,18 @@ const CONFIG = {
   // ESP32 device settings
   esp32: {
     discoveryPort: 3006,
+    mdnsServiceType: 'obs-tally',  // Advertised as _obs-tally._tcp with TXT role=server
+    // Redundant tally delivery: every push is also multicast, devices de-duplicate by sequence
+    redundantDelivery: process.env.TALLY_REDUNDANT === 'true',
+    multicastGroup: '239.255.30.6',
+    multicastPort: 3007,
+    subscribeHoldMs: 25000,      // Long-poll subscriptions are answered with 204 after this
+    maxFrame: 1024,              // Largest tally frame the server sends
+    frameKey: process.env.TALLY_FRAME_KEY || '',  // Devices with the same key only accept frames signed with it
+    sceneSyncInterval: 5000,     // Scene-graph devices compare sequence numbers this often
+    provisionRetryMs: 250,       // Fleet provisioning frames are repeated for unacknowledged devices
+    provisionTimeout: 5000,
+    pushProbeTimeout: 300,       // Reachability check of the device push port at registration
     healthCheckInterval: 30000,  // 30 seconds
     offlineThreshold: 120000,    // 2 minutes
     retryLimit: 3,               // Number of connection retries
@@ -97,6 +132,13 @@ const CONFIG = {
     }
   },
   
+  // MQTT transport: disabled unless MQTT_URL is set (e.g. mqtt://localhost:1883)
+  mqtt: {
+    url: process.env.MQTT_URL || '',
+    qos: Math.min(Math.max(Number(process.env.MQTT_QOS || 1), 0), 2),
+    topicPrefix: process.env.MQTT_PREFIX || 'obs-tally'
+  },
+  
   // Logging settings
   logging: {
     level: process.env.LOG_LEVEL || 'info', // 'debug', 'info', 'warn', 'error'
@@ -460,6 +502,11 @@ let tallySources = ['Camera 1']; // Default source list
 let tallyStatus = {};
 let currentScene = null;
 let currentPreviewScene = null;
+
+// Scene graph for tally without per-cut OBS requests. Devices in
+// sceneGraphDevices hold the relevant part and follow broadcast scene events
+const sceneGraph = createSceneGraph();
+const sceneGraphDevices = new Set(); // deviceId
 const sourcesConfigPath = path.join(__dirname, 'sources.json');
 
 // Load tally sources from file
@@ -585,6 +632,7 @@ function broadcastObsStatus() {
 function setupOBSHandlers() {
   obs.on('ConnectionClosed', () => {
     console.log('OBS WebSocket connection closed');
+    sceneGraph.loaded = false;
     obsConnectionError = 'Connection to OBS was closed';
     updateObsConnectionStatus('disconnected');
     
@@ -605,32 +653,42 @@ function setupOBSHandlers() {
 
   obs.on('CurrentProgramSceneChanged', data => {
     currentScene = data.sceneName;
+    trackSceneEvent('CurrentProgramSceneChanged', data).then(updateTallyForSourcesThrottled);
     console.log(`🎬 Program scene changed to: ${data.sceneName}`);
-    updateTallyForSourcesThrottled(); // Use throttled version
   });
    obs.on('CurrentPreviewSceneChanged', data => {
     currentPreviewScene = data.sceneName;
+    trackSceneEvent('CurrentPreviewSceneChanged', data).then(updateTallyForSourcesThrottled);
     console.log(`🎬 Preview scene changed to: ${data.sceneName}`);
-    updateTallyForSourcesThrottled(); // Use throttled version
   });
   
   // Listen for scene item visibility changes - crucial for real-time tally updates
   obs.on('SceneItemEnableStateChanged', data => {
     console.log(`🎬 Scene item visibility changed: ${data.sourceName} -> ${data.sceneItemEnabled ? 'visible' : 'hidden'}`);
-    updateTallyForSourcesThrottled(); // Use throttled version
+    trackSceneEvent('SceneItemEnableStateChanged', data).then(updateTallyForSourcesThrottled);
   });
 
   // Listen for scene item added/removed
   obs.on('SceneItemCreated', data => {
     console.log(`🎬 Scene item created: ${data.sourceName}`);
-    updateTallyForSourcesThrottled(); // Use throttled version
+    trackSceneEvent('SceneItemCreated', data).then(updateTallyForSourcesThrottled);
   });
 
   obs.on('SceneItemRemoved', data => {
     console.log(`🎬 Scene item removed: ${data.sourceName}`);
-    updateTallyForSourcesThrottled(); // Use throttled version
+    trackSceneEvent('SceneItemRemoved', data).then(updateTallyForSourcesThrottled);
   });
 
+  // Scene and group renames, additions and removals keep the graph in step
+  obs.on('SceneNameChanged', data => {
+    console.log(`🎬 Scene renamed: ${data.oldSceneName} -> ${data.sceneName}`);
+    if (currentScene === data.oldSceneName) currentScene = data.sceneName;
+    if (currentPreviewScene === data.oldSceneName) currentPreviewScene = data.sceneName;
+    trackSceneEvent('SceneNameChanged', data);
+  });
+  obs.on('SceneCreated', data => trackSceneEvent('SceneCreated', data));
+  obs.on('SceneRemoved', data => trackSceneEvent('SceneRemoved', data));
+
   // Listen for source state changes
   obs.on('SourceActiveStateChanged', data => {
     console.log(`🎬 Source active state changed: ${data.sourceName} -> ${data.videoActive ? 'active' : 'inactive'}`);
@@ -645,6 +703,7 @@ function setupOBSHandlers() {
       currentPreviewScene = currentPreviewSceneName;
       console.log(`🎬 Initial scenes - Program: ${currentScene}, Preview: ${currentPreviewScene}`);
       
+      await reloadSceneGraph();
       updateTallyForSources(); // Use direct version for initial load
       
       // Get initial recording and streaming status
@@ -735,6 +794,10 @@ function setupOBSHandlers() {
       broadcastTally(forceNotify);
     }
   });
+
+  if (CONFIG.obs.recordEvents) {
+    recordObsEvents(obs, CONFIG.obs.recordEvents);
+  }
 }
 setupOBSHandlers();
 
@@ -748,12 +811,21 @@ async function updateTallyForSources() {
   if (!currentScene) return;
   
   try {
-    // Get both program and preview scenes
-    const { sceneItems: programItems } = await obs.call('GetSceneItemList', { sceneName: currentScene });
-    let previewItems = [];
-    if (currentPreviewScene && currentPreviewScene !== currentScene) {
-      const previewRes = await obs.call('GetSceneItemList', { sceneName: currentPreviewScene });
-      previewItems = previewRes.sceneItems;
+    // The scene graph follows OBS events, including nested scenes and
+    // groups; without it both scene lists are requested from OBS
+    let statusOf = source => sourceTally(sceneGraph, source);
+    if (!sceneGraph.loaded) {
+      const { sceneItems: programItems } = await obs.call('GetSceneItemList', { sceneName: currentScene });
+      let previewItems = [];
+      if (currentPreviewScene && currentPreviewScene !== currentScene) {
+        const previewRes = await obs.call('GetSceneItemList', { sceneName: currentPreviewScene });
+        previewItems = previewRes.sceneItems;
+      }
+      statusOf = source => {
+        if (programItems.some(item => item.sourceName === source && item.sceneItemEnabled)) return 'Live';
+        if (previewItems.some(item => item.sourceName === source && item.sceneItemEnabled)) return 'Preview';
+        return 'Idle';
+      };
     }
     
     // Track changes for performance monitoring
@@ -762,19 +834,7 @@ async function updateTallyForSources() {
     
     // Update status for each source
     for (const source of tallySources) {
-      const inProgram = programItems.some(item => 
-        item.sourceName === source && item.sceneItemEnabled
-      );
-      const inPreview = previewItems.some(item => 
-        item.sourceName === source && item.sceneItemEnabled
-      );
-      
-      let newStatus = 'Idle';
-      if (inProgram) {
-        newStatus = 'Live';
-      } else if (inPreview) {
-        newStatus = 'Preview';
-      }
+      const newStatus = statusOf(source);
       
       // Create source status if it doesn't exist
       if (!tallyStatus[source]) {
@@ -821,6 +881,65 @@ function updateTallyForSourcesThrottled() {
   }, UPDATE_THROTTLE_MS);
 }
 
+// Read the whole graph again (after identify, or when an event cannot be
+// applied) and tell scene-graph devices to reload theirs
+async function reloadSceneGraph() {
+  try {
+    await loadSceneGraph(obs, sceneGraph);
+    console.log(`🕸️ Scene graph loaded: ${sceneGraph.scenes.size} scenes and groups`);
+  } catch (err) {
+    sceneGraph.loaded = false;
+    console.error('Error loading scene graph:', err.message);
+  }
+  broadcastSceneEvent({ op: 'reset' });
+}
+
+// Events are applied one at a time in OBS order, so that an event that
+// waits for OBS does not let later ones overtake it. Resolves once applied
+let sceneEventChain = Promise.resolve();
+
+function trackSceneEvent(eventType, data) {
+  sceneEventChain = sceneEventChain
+    .then(() => applyTrackedSceneEvent(eventType, data))
+    .catch(err => console.error(`Error applying ${eventType}:`, err.message));
+  return sceneEventChain;
+}
+
+async function applyTrackedSceneEvent(eventType, data) {
+  // SceneItemCreated does not say whether the new item is enabled
+  if (eventType === 'SceneItemCreated' && sceneGraph.loaded) {
+    try {
+      const { sceneItemEnabled } = await obs.call('GetSceneItemEnabled',
+        { sceneName: data.sceneName, sceneItemId: data.sceneItemId });
+      data = { ...data, sceneItemEnabled };
+    } catch (err) {
+      // Removed again already, or OBS went away: read the whole graph
+      await reloadSceneGraph();
+      return;
+    }
+  }
+  
+  const op = applySceneEvent(sceneGraph, eventType, data);
+  if (!op) return;
+  if (op.op === 'reset') {
+    await reloadSceneGraph();
+    return;
+  }
+  broadcastSceneEvent(op);
+}
+
+// One datagram and one publish for every scene-graph device, whatever
+// their number. Devices apply ops in sequence and reload on a gap
+function broadcastSceneEvent(op) {
+  if (sceneGraphDevices.size === 0) return;
+  
+  const payload = deviceFrame({ type: 'scene-event', epoch: tallyEpoch, seq: sceneGraph.seq, ...op });
+  sendTallyMulticast(payload);
+  if (mqttClient && mqttClient.connected) {
+    mqttClient.publish(`${CONFIG.mqtt.topicPrefix}/scene`, payload, { qos: CONFIG.mqtt.qos });
+  }
+}
+
 async function broadcastTally(forceNotify = null) {
   const anyEspDeviceOnline = Object.values(esp32Devices).some(device => device.status === 'online');
   
@@ -903,6 +1022,9 @@ async function broadcastTally(forceNotify = null) {
   io.emit('tally-status', statusUpdate);
   console.log('🔍 [DEBUG] Broadcasted to', io.engine.clientsCount, 'Socket.IO clients');
   
+  // Fan out through the broker before the per-device pushes
+  publishTallyMqtt(forceNotify !== null);
+  
   // Update ESP32 devices - call async function
   try {
     await notifyESP32Devices(forceNotify);
@@ -938,8 +1060,12 @@ async function notifyESP32Devices(forceNotify = null) {
       if (device.assignedSource && tallyStatus[device.assignedSource]) {
         newStatus = tallyStatus[device.assignedSource].status;
         
+        // Scene-graph devices work the change out from the scene event
+        if (sceneGraphDevices.has(deviceId) && !forceNotify) {
+          device.lastNotifiedStatus = newStatus;
+        }
         // Actual status change - always notify
-        if (device.lastNotifiedStatus !== newStatus) {
+        else if (device.lastNotifiedStatus !== newStatus) {
           shouldNotify = true;
           notifyReason = 'source status change';
           
@@ -1129,12 +1255,114 @@ async function notifyESP32Devices(forceNotify = null) {
   }
 }
 
+// Devices that advertise a push port keep one persistent connection per
+// device; the agent's idle timeout is below the device's 30s so the server
+// normally closes first
+const esp32PushAgent = new http.Agent({
+  keepAlive: true,
+  maxSockets: 1,
+  maxFreeSockets: 1,
+  timeout: 20000
+});
+
+// Server-run epoch for scene-graph ops and provisioning frames
+const tallyEpoch = Math.floor(Date.now() / 1000);
+
+// Tally updates carry a per-device sequence number under a per-record epoch.
+// A record gets its epoch when first used in this server run, so a device
+// that is deleted and registered again starts a numbering it will accept
+let lastDeviceEpoch = 0;
+function deviceTallyEpoch(device) {
+  if (!device.tallyEpoch) {
+    lastDeviceEpoch = Math.max(lastDeviceEpoch + 1, Math.floor(Date.now() / 1000));
+    device.tallyEpoch = lastDeviceEpoch;
+  }
+  return device.tallyEpoch;
+}
+
+// Delivery state that only means something within one server run. The
+// transport negotiation is redone when the device registers again
+const RUNTIME_DEVICE_FIELDS = ['tallySeq', 'tallyEpoch', 'transport', 'negotiated', 'capabilities'];
+
+function persistedDevice(device) {
+  const record = { ...device };
+  RUNTIME_DEVICE_FIELDS.forEach(field => delete record[field]);
+  return record;
+}
+
+// JSON for a device, with a MAC when a frame key is configured
+function deviceFrame(message) {
+  return signFrame(JSON.stringify(message), CONFIG.esp32.frameKey);
+}
+let tallyUdpSocket = null;
+
+// One socket for multicast and unicast tally datagrams
+function sendTallyDatagram(payload, port, address) {
+  if (!tallyUdpSocket) {
+    tallyUdpSocket = dgram.createSocket({ type: 'udp4', reuseAddr: true });
+    tallyUdpSocket.on('error', (error) => {
+      console.error('Tally UDP socket error:', error.message);
+    });
+    tallyUdpSocket.on('message', handleTallySocketMessage);
+    tallyUdpSocket.bind(() => {
+      tallyUdpSocket.setMulticastTTL(1);
+      tallyUdpSocket.setBroadcast(true);  // Provisioning also goes to the discovery port
+    });
+  }
+  tallyUdpSocket.send(payload, port, address, (error) => {
+    if (error) {
+      console.warn(`⚠️ Tally datagram to ${address}:${port} failed: ${error.message}`);
+    }
+  });
+}
+
+function sendTallyMulticast(payload) {
+  sendTallyDatagram(payload, CONFIG.esp32.multicastPort, CONFIG.esp32.multicastGroup);
+}
+
+// Long-poll subscriptions for devices the server cannot connect to (guest or
+// client-isolated WLANs). Each device holds at most one pending request; the
+// latest update is kept so a device that re-arms late gets it at once
+const esp32Subscriptions = new Map(); // deviceId -> { res, timer, lastSeenAt }
+const esp32LatestTally = new Map();   // deviceId -> last tally-update payload
+
+function isSubscribed(device) {
+  // A device that negotiated poll collects every update itself
+  if (device.negotiated && device.negotiated.transport === 'poll') return true;
+  const subscription = esp32Subscriptions.get(device.deviceId);
+  if (!subscription) return false;
+  return subscription.res !== null || Date.now() - subscription.lastSeenAt < CONFIG.esp32.subscribeHoldMs + 10000;
+}
+
+// Answer the device's pending subscription; returns false if none is held
+function deliverToSubscriber(deviceId, payload) {
+  const subscription = esp32Subscriptions.get(deviceId);
+  if (!subscription || !subscription.res) return false;
+  
+  clearTimeout(subscription.timer);
+  subscription.res.type('application/json').send(payload);
+  subscription.res = null;
+  subscription.timer = null;
+  return true;
+}
+
 // Send tally update to ESP32 device via HTTP POST with enhanced error handling and performance
-async function sendTallyUpdateToESP32(device, tallyStatus) {
+async function sendTallyUpdateToESP32(device, tallyStatus, isRetry = false) {
   return new Promise((resolve, reject) => {
     const now = new Date();
+    // Negotiated devices get the multicast copy only if they asked for it
+    const redundant = device.negotiated ? device.negotiated.redundant : CONFIG.esp32.redundantDelivery;
     
-    const postData = JSON.stringify({
+    // A retry repeats the same update, so it keeps its sequence number
+    if (!isRetry) {
+      device.tallySeq = (device.tallySeq || 0) + 1;
+    }
+    
+    const postData = deviceFrame({
+      type: 'tally-update',
+      seq: device.tallySeq,
+      epoch: deviceTallyEpoch(device),
+      redundant: redundant,
       deviceId: device.deviceId,
       status: tallyStatus,
       assignedSource: device.assignedSource,
@@ -1150,23 +1378,56 @@ async function sendTallyUpdateToESP32(device, tallyStatus) {
       isPeriodicUpdate: false, // Always false since periodic updates are disabled
       lastStateChange: device.lastStateChangeTimestamp ? (now.getTime() - device.lastStateChangeTimestamp) : 0,
       optimizedUpdateFrequency: 0, // Disabled
-      timestamp: now.toISOString()
+      timestamp: now.toISOString(),
+      ts: now.getTime() // Clock-synced devices measure delivery latency from this
     });
     
+    const maxFrame = device.negotiated ? device.negotiated.maxFrame : CONFIG.esp32.maxFrame;
+    if (Buffer.byteLength(postData) > maxFrame) {
+      console.warn(`⚠️ Tally frame for ESP32 ${device.deviceId} is ${Buffer.byteLength(postData)} bytes, above its ${maxFrame} byte limit`);
+    }
+    
+    // Second, independent path: the same frame by multicast
+    if (redundant && !isRetry) {
+      sendTallyMulticast(postData);
+    }
+    
+    // MQTT devices already got the update from their source topic
+    if (isMqttDevice(device)) {
+      resolve({ success: true, mqtt: true });
+      return;
+    }
+    
+    // Subscribed devices collect the update themselves; if no request is
+    // held right now the device gets it when it re-arms
+    esp32LatestTally.set(device.deviceId, postData);
+    if (isSubscribed(device)) {
+      const delivered = deliverToSubscriber(device.deviceId, postData);
+      console.log(`⚡ Tally update for subscribed ESP32 ${device.deviceId}: ${tallyStatus} (${delivered ? 'delivered' : 'queued for re-arm'})`);
+      resolve({ success: true, subscribed: true, delivered: delivered });
+      return;
+    }
+    
+    const usePushChannel = device.pushPort > 0;
     const options = {
       hostname: device.ipAddress,
-      port: 80,
+      port: usePushChannel ? device.pushPort : 80,
       path: '/api/tally',
       method: 'POST',
       headers: {
         'Content-Type': 'application/json',
         'Content-Length': Buffer.byteLength(postData),
-        'Connection': 'close', // Force connection close for ESP32 compatibility
         'User-Agent': 'OBS-Tally-Server/2.0'
       },
       timeout: 1000 // Reduced to 1 second for ultra-fast response
     };
     
+    if (usePushChannel) {
+      options.agent = esp32PushAgent;
+    } else {
+      options.headers['Connection'] = 'close'; // The stock ESP32 web server closes after each response
+    }
+    
     const startTime = performance.now();
     const req = http.request(options, (res) => {
       let responseData = '';
@@ -1179,8 +1440,9 @@ async function sendTallyUpdateToESP32(device, tallyStatus) {
         const duration = performance.now() - startTime;
         
         if (res.statusCode === 200) {
-          console.log(`⚡ ULTRA-FAST tally update sent to ESP32 ${device.deviceId}: ${tallyStatus} (${duration.toFixed(1)}ms)`);
-          resolve({ success: true, response: responseData, duration: duration });
+          const connection = req.reusedSocket ? 'reused' : 'new';
+          console.log(`⚡ ULTRA-FAST tally update sent to ESP32 ${device.deviceId}: ${tallyStatus} (${duration.toFixed(1)}ms, ${connection} connection)`);
+          resolve({ success: true, response: responseData, duration: duration, reusedSocket: req.reusedSocket });
         } else {
           console.warn(`⚠️ ESP32 ${device.deviceId} responded with status ${res.statusCode}: ${responseData} (${duration.toFixed(1)}ms)`);
           resolve({ success: false, status: res.statusCode, response: responseData, duration: duration });
@@ -1189,6 +1451,11 @@ async function sendTallyUpdateToESP32(device, tallyStatus) {
     });
     
     req.on('error', (error) => {
+      // The device may have dropped an idle keep-alive socket just as it was reused
+      if (req.reusedSocket && !isRetry && error.code === 'ECONNRESET') {
+        resolve(sendTallyUpdateToESP32(device, tallyStatus, true));
+        return;
+      }
       const duration = performance.now() - startTime;
       console.error(`❌ Failed to send tally update to ESP32 ${device.deviceId} (${duration.toFixed(1)}ms):`, error.message);
       reject(error);
@@ -1219,13 +1486,19 @@ const ESP32_HEALTH_CHECK_INTERVAL = 30000; // Check every 30 seconds
 let esp32HealthTimer = null;
 
 // Function to monitor ESP32 device health and performance
+// ETag of each device's last /api/device-info, sent back as If-None-Match so
+// an unchanged device answers 304 from its snapshot cache
+const deviceInfoEtags = new Map();
+
 async function monitorESP32Health() {
   const healthStartTime = performance.now();
   const healthChecks = [];
   
   for (const deviceId of Object.keys(esp32Devices)) {
     const device = esp32Devices[deviceId];
-    if (device.ipAddress) {
+    // A live subscription already proves the device is reachable, and the
+    // probe would fail on networks that block inbound connections
+    if (device.ipAddress && !isSubscribed(device) && !isMqttDevice(device)) {
       const healthCheck = checkESP32DeviceHealth(device);
       healthChecks.push(healthCheck);
     }
@@ -1236,9 +1509,10 @@ async function monitorESP32Health() {
       const results = await Promise.allSettled(healthChecks);
       const healthy = results.filter(r => r.status === 'fulfilled' && r.value.healthy).length;
       const unhealthy = results.length - healthy;
+      const unchanged = results.filter(r => r.status === 'fulfilled' && r.value.status === 304).length;
       
       const healthDuration = performance.now() - healthStartTime;
-      console.log(`🏥 HEALTH CHECK: ${healthy} healthy, ${unhealthy} unhealthy ESP32 devices (${healthDuration.toFixed(1)}ms)`);
+      console.log(`🏥 HEALTH CHECK: ${healthy} healthy (${unchanged} unchanged), ${unhealthy} unhealthy ESP32 devices (${healthDuration.toFixed(1)}ms)`);
       
       // Broadcast health status to Socket.IO clients
       const healthStatus = {
@@ -1270,7 +1544,8 @@ async function checkESP32DeviceHealth(device) {
       timeout: 2000,
       headers: {
         'Connection': 'close',
-        'User-Agent': 'OBS-Tally-Health-Check/2.0'
+        'User-Agent': 'OBS-Tally-Health-Check/2.0',
+        ...(deviceInfoEtags.has(device.deviceId) && { 'If-None-Match': deviceInfoEtags.get(device.deviceId) })
       }
     }, (res) => {
       let responseData = '';
@@ -1281,7 +1556,10 @@ async function checkESP32DeviceHealth(device) {
       
       res.on('end', () => {
         const duration = performance.now() - startTime;
-        const healthy = res.statusCode === 200;
+        const healthy = res.statusCode === 200 || res.statusCode === 304;
+        if (res.statusCode === 200 && res.headers.etag) {
+          deviceInfoEtags.set(device.deviceId, res.headers.etag);
+        }
         
         const previousStatus = device.status;
         if (healthy) {
@@ -1636,6 +1914,8 @@ function loadESP32Devices() {
       let migrationPerformed = false;
       Object.keys(esp32Devices).forEach(deviceId => {
         const device = esp32Devices[deviceId];
+        // Files written by older builds persisted sequence state
+        RUNTIME_DEVICE_FIELDS.forEach(field => delete device[field]);
         if (device.hasOwnProperty('showRecordingStatus') || device.hasOwnProperty('showStreamingStatus')) {
           console.log(`🔧 Migrating device ${device.deviceName || deviceId}: removing legacy status properties`);
           delete device.showRecordingStatus;
@@ -1678,7 +1958,11 @@ function saveESP32Devices() {
     }
     
     // Validate JSON serialization
-    const jsonData = JSON.stringify(esp32Devices, null, 2);
+    const records = {};
+    Object.keys(esp32Devices).forEach(deviceId => {
+      records[deviceId] = persistedDevice(esp32Devices[deviceId]);
+    });
+    const jsonData = JSON.stringify(records, null, 2);
     if (!jsonData || jsonData === '{}') {
       console.warn('[SAVE] Warning: Serialized data is empty or invalid');
     }
@@ -1865,6 +2149,12 @@ app.post('/api/esp32/update-device/:deviceId', (req, res) => {
       lastUpdate: new Date().toISOString()
     };
     
+    // The device reloads its scene graph for the new source; pushes cover
+    // the time until then
+    if (esp32Devices[deviceId].assignedSource !== originalDevice.assignedSource) {
+      sceneGraphDevices.delete(deviceId);
+    }
+    
     // If a source is assigned and it's not already in tallySources, add it
     // This ensures that any source assigned to a device from the device manager
     // will be properly monitored, even if it was fetched directly from OBS
@@ -1963,9 +2253,68 @@ app.delete('/api/esp32/devices/:deviceId', (req, res) => {
 });
 
 // Register ESP32 device endpoint (expected by ESP32 firmware)
-app.post('/api/esp32/register', (req, res) => {
+// True if a TCP connection to the device can be opened in time; fails on
+// guest or client-isolated networks
+function probeDevicePort(ipAddress, port, timeout) {
+  return new Promise((resolve) => {
+    const socket = net.connect({ host: ipAddress, port: port });
+    const finish = (reachable) => {
+      socket.destroy();
+      resolve(reachable);
+    };
+    socket.setTimeout(timeout, () => finish(false));
+    socket.once('connect', () => finish(true));
+    socket.once('error', () => finish(false));
+  });
+}
+
+function mqttBrokerForDevices() {
+  if (!CONFIG.mqtt.url) return null;
   try {
-    const { deviceId, deviceName, ipAddress, macAddress, firmware, model, assignedSource } = req.body;
+    const url = new URL(CONFIG.mqtt.url);
+    const local = url.hostname === 'localhost' || url.hostname === '127.0.0.1';
+    return { host: local ? getLocalNetworkIP() : url.hostname, port: Number(url.port) || 1883, qos: CONFIG.mqtt.qos };
+  } catch (err) {
+    return null;
+  }
+}
+
+// Pick the fastest transport both sides support. Older firmware sends no
+// capabilities and stays on HTTP push to port 80 (or its push port)
+async function negotiateTransport(device, capabilities) {
+  const transports = Array.isArray(capabilities.transports) ? capabilities.transports : [];
+  const negotiated = {
+    transport: 'push',
+    redundant: CONFIG.esp32.redundantDelivery && transports.includes('multicast'),
+    pushPort: device.pushPort,
+    maxFrame: Math.min(Number(capabilities.maxFrame) || CONFIG.esp32.maxFrame, CONFIG.esp32.maxFrame),
+    epoch: deviceTallyEpoch(device)
+  };
+  
+  const broker = mqttBrokerForDevices();
+  if (transports.includes('mqtt') && broker && mqttClient && mqttClient.connected) {
+    negotiated.transport = 'mqtt';
+    negotiated.mqtt = broker;
+  } else if (transports.includes('poll') && !(device.ipAddress && device.pushPort > 0 &&
+             await probeDevicePort(device.ipAddress, device.pushPort, CONFIG.esp32.pushProbeTimeout))) {
+    negotiated.transport = 'poll';
+    negotiated.holdMs = CONFIG.esp32.subscribeHoldMs;
+  }
+  
+  if (capabilities.clockSync) {
+    negotiated.serverTime = Date.now();
+  }
+  
+  // Scene events are broadcast, so the device must hear multicast or MQTT
+  if (Number(capabilities.sceneGraph) > 0 && (transports.includes('multicast') || negotiated.transport === 'mqtt')) {
+    negotiated.sceneGraph = Number(capabilities.sceneGraph);
+  }
+  return negotiated;
+}
+
+app.post('/api/esp32/register', async (req, res) => {
+  try {
+    const { deviceId, deviceName, ipAddress, macAddress, firmware, model, assignedSource, pushPort, capabilities } = req.body;
     
     if (!deviceId) {
       return res.status(400).json({
@@ -1986,13 +2335,17 @@ app.post('/api/esp32/register', (req, res) => {
       firmware: firmware || 'unknown',
       model: model || '',
       assignedSource: assignedSource || esp32Devices[deviceId]?.assignedSource || '',
+      pushPort: Number(pushPort) || 0, // Keep-alive push listener, 0 for older firmware
+      capabilities: capabilities || null,
       status: 'online',
       lastSeen: new Date().toISOString(),
       createdAt: esp32Devices[deviceId]?.createdAt || new Date().toISOString(),
       lastUpdate: new Date().toISOString()
     };
     
+    delete device.transport; // Set again by its MQTT presence, if it uses the broker
     esp32Devices[deviceId] = device;
+    sceneGraphDevices.delete(deviceId); // Until it loads the graph again
     
     // Save to file
     saveESP32Devices();
@@ -2002,10 +2355,21 @@ app.post('/api/esp32/register', (req, res) => {
     
     console.log(`✅ ESP32 device registered: ${deviceName} (${deviceId})`);
     
+    if (!capabilities) {
+      return res.json({
+        success: true,
+        message: 'Device registered successfully',
+        device: device
+      });
+    }
+    
+    // Negotiating firmware reads a small response buffer, so the device
+    // record is left out
+    device.negotiated = await negotiateTransport(device, capabilities);
+    console.log(`🤝 ESP32 ${deviceId} negotiated ${device.negotiated.transport}${device.negotiated.redundant ? ' + multicast' : ''}`);
     res.json({
       success: true,
-      message: 'Device registered successfully',
-      device: device
+      negotiated: device.negotiated
     });
   } catch (error) {
     console.error('Error registering ESP32 device:', error);
@@ -2016,6 +2380,413 @@ app.post('/api/esp32/register', (req, res) => {
   }
 });
 
+// Lightweight session resume after a WiFi reconnect. Known devices get the
+// current tally state back immediately; unknown devices get 404 and re-register
+app.post('/api/esp32/resume', (req, res) => {
+  try {
+    const { deviceId, ipAddress, assignedSource } = req.body;
+
+    if (!deviceId) {
+      return res.status(400).json({
+        success: false,
+        error: 'Device ID is required'
+      });
+    }
+
+    const device = esp32Devices[deviceId];
+    if (!device) {
+      console.log(`⚠️ ESP32 resume from unknown device: ${deviceId}`);
+      return res.status(404).json({
+        success: false,
+        error: 'Device not registered',
+        message: 'Please register the device first'
+      });
+    }
+
+    if (ipAddress && device.ipAddress !== ipAddress) {
+      console.log(`📍 ESP32 ${deviceId} IP updated: ${device.ipAddress} -> ${ipAddress}`);
+      device.ipAddress = ipAddress;
+      saveESP32Devices();
+    }
+    if (!device.assignedSource && assignedSource) {
+      device.assignedSource = assignedSource;
+    }
+
+    device.status = 'online';
+    device.lastSeen = new Date().toISOString();
+    device.resumeCount = (device.resumeCount || 0) + 1;
+
+    broadcastDeviceUpdate(device, 'device-resumed');
+    console.log(`🔄 ESP32 session resumed: ${device.deviceName} (${deviceId})`);
+
+    const sourceStatus = device.assignedSource && tallyStatus[device.assignedSource]
+      ? tallyStatus[device.assignedSource].status
+      : 'Idle';
+
+    res.json({
+      success: true,
+      status: sourceStatus,
+      assignedSource: device.assignedSource,
+      deviceName: device.deviceName,
+      recording: recordingStatus.active,
+      streaming: streamingStatus.active,
+      timestamp: new Date().toISOString()
+    });
+  } catch (error) {
+    console.error('Error resuming ESP32 session:', error);
+    res.status(500).json({
+      success: false,
+      error: error.message
+    });
+  }
+});
+
+// Server clock for device clock sync; devices take the sample with the
+// shortest round trip
+app.get('/api/time', (req, res) => {
+  res.json({ serverTime: Date.now() });
+});
+
+// The part of the scene graph that can reach the device's source, as
+// [scene, itemId, child, enabled] edges. Once loaded, the device gets scene
+// events instead of per-device pushes for its source
+app.get('/api/esp32/scene-graph', (req, res) => {
+  const device = esp32Devices[req.query.deviceId];
+  if (!device || !device.negotiated || !device.negotiated.sceneGraph) {
+    return res.status(404).json({ success: false, error: 'Device has not negotiated scene graph tally' });
+  }
+  if (!sceneGraph.loaded) {
+    sceneGraphDevices.delete(device.deviceId);
+    return res.status(503).json({ success: false, error: 'Scene graph not loaded' });
+  }
+  
+  const edges = relevantEdges(sceneGraph, device.assignedSource);
+  if (edges.length > device.negotiated.sceneGraph) {
+    sceneGraphDevices.delete(device.deviceId);
+    console.warn(`⚠️ Scene graph for ESP32 ${device.deviceId} has ${edges.length} edges, above its ${device.negotiated.sceneGraph}; staying on pushes`);
+    return res.status(413).json({ success: false, error: 'Scene graph too large for device' });
+  }
+  
+  sceneGraphDevices.add(device.deviceId);
+  res.json({
+    source: device.assignedSource,
+    epoch: tallyEpoch,
+    seq: sceneGraph.seq,
+    program: sceneGraph.program,
+    preview: sceneGraph.preview,
+    edges: edges
+  });
+});
+
+// Fleet provisioning: per-MAC config rows (name, source, server, display
+// flags) for many devices at once. Rows are packed into frames of at most
+// maxFrame bytes, multicast and broadcast on the discovery port, and sent
+// again for devices that have not acknowledged until the deadline
+const PROVISION_FIELDS = ['name', 'source', 'server', 'showRecording', 'showStreaming', 'led'];
+let provisionSeq = 0;
+const pendingProvisions = new Map(); // id -> { pending: Map(mac -> row), acks }
+
+function provisionFrames(id, pending) {
+  const budget = CONFIG.esp32.maxFrame - (CONFIG.esp32.frameKey ? TRAILER_LENGTH : 0);
+  const frames = [];
+  let rows = {};
+  const frameFor = (frameRows) => ({ type: 'fleet-provision', epoch: tallyEpoch, id: id, ts: Date.now(), rows: frameRows });
+  
+  for (const [mac, row] of pending) {
+    const candidate = { ...rows, [mac]: row };
+    if (Object.keys(rows).length > 0 && Buffer.byteLength(JSON.stringify(frameFor(candidate))) > budget) {
+      frames.push(deviceFrame(frameFor(rows)));
+      rows = { [mac]: row };
+    } else {
+      rows = candidate;
+    }
+  }
+  if (Object.keys(rows).length > 0) frames.push(deviceFrame(frameFor(rows)));
+  return frames;
+}
+
+function handleTallySocketMessage(message, rinfo) {
+  let ack;
+  try {
+    ack = JSON.parse(message.toString());
+  } catch (error) {
+    return;
+  }
+  if (ack.type !== 'provision-ack' || ack.epoch !== tallyEpoch) return;
+  
+  const provision = pendingProvisions.get(ack.id);
+  const mac = String(ack.macAddress || '').toUpperCase();
+  if (!provision || !provision.pending.has(mac)) return;
+  provision.pending.delete(mac);
+  provision.acks[mac] = {
+    deviceId: ack.deviceId,
+    ipAddress: rinfo.address,
+    changed: ack.changed ? String(ack.changed).split(',') : []
+  };
+}
+
+async function provisionFleet(rows) {
+  const id = ++provisionSeq;
+  const provision = { pending: new Map(Object.entries(rows)), acks: {} };
+  pendingProvisions.set(id, provision);
+  
+  const started = Date.now();
+  let framesSent = 0;
+  while (provision.pending.size > 0 && Date.now() - started < CONFIG.esp32.provisionTimeout) {
+    for (const frame of provisionFrames(id, provision.pending)) {
+      sendTallyMulticast(frame);
+      sendTallyDatagram(frame, CONFIG.esp32.discoveryPort, '255.255.255.255');
+      framesSent++;
+    }
+    await new Promise(resolve => setTimeout(resolve, CONFIG.esp32.provisionRetryMs));
+  }
+  pendingProvisions.delete(id);
+  
+  return {
+    id: id,
+    acked: provision.acks,
+    missing: [...provision.pending.keys()],
+    framesSent: framesSent,
+    durationMs: Date.now() - started
+  };
+}
+
+// Body: { devices: [{ mac or deviceId, name, source, server, showRecording, showStreaming, led }] }
+app.post('/api/esp32/provision', async (req, res) => {
+  const entries = Array.isArray(req.body && req.body.devices) ? req.body.devices : [];
+  const rows = {};
+  const unknown = [];
+  for (const entry of entries) {
+    const device = entry.deviceId ? esp32Devices[entry.deviceId] : null;
+    const mac = String(entry.mac || (device && device.macAddress) || '').toUpperCase();
+    if (!/^([0-9A-F]{2}:){5}[0-9A-F]{2}$/.test(mac)) {
+      unknown.push(entry.deviceId || entry.mac || null);
+      continue;
+    }
+    const row = {};
+    PROVISION_FIELDS.forEach(field => {
+      if (entry[field] !== undefined) row[field] = entry[field];
+    });
+    rows[mac] = row;
+  }
+  if (Object.keys(rows).length === 0) {
+    return res.status(400).json({ success: false, error: 'No devices with a MAC address', unknown: unknown });
+  }
+  
+  const result = await provisionFleet(rows);
+  console.log(`📋 Provisioning ${result.id}: ${Object.keys(result.acked).length}/${Object.keys(rows).length} devices ` +
+    `acknowledged in ${result.durationMs}ms (${result.framesSent} frames)`);
+  
+  // Keep the registry in step with what the devices applied
+  const resourced = [];
+  for (const [mac, ack] of Object.entries(result.acked)) {
+    const device = esp32Devices[ack.deviceId];
+    if (!device) continue;
+    const row = rows[mac];
+    if (row.name) device.deviceName = row.name;
+    if (row.source !== undefined && row.source !== device.assignedSource) {
+      device.assignedSource = row.source;
+      sceneGraphDevices.delete(device.deviceId);
+      resourced.push(device);
+      if (row.source && !tallySources.includes(row.source)) {
+        tallySources.push(row.source);
+        initTallyStatus();
+        saveTallySources();
+      }
+    }
+    device.lastUpdate = new Date().toISOString();
+    broadcastDeviceUpdate(device, 'device-updated');
+  }
+  if (Object.keys(result.acked).length > 0) saveESP32Devices();
+  
+  // Devices on a new source get its tally now rather than at the next heartbeat
+  for (const device of resourced) {
+    const status = tallyStatus[device.assignedSource] ? tallyStatus[device.assignedSource].status : 'Idle';
+    sendTallyUpdateToESP32(device, status).catch(() => {});
+  }
+  
+  res.json({ success: result.missing.length === 0, ...result, unknown: unknown });
+});
+
+// A/B transport benchmark. Probe frames carry the server time; the device
+// measures each against its synchronised clock and keeps per-transport
+// histograms with fixed buckets, so results compare across devices and venues
+const esp32BenchmarkResults = new Map(); // deviceId -> last result
+
+function sendBenchmarkHttp(device, port, payload, agent) {
+  return new Promise((resolve) => {
+    const req = http.request({
+      hostname: device.ipAddress,
+      port: port,
+      path: '/api/tally',
+      method: 'POST',
+      agent: agent,
+      headers: {
+        'Content-Type': 'application/json',
+        'Content-Length': Buffer.byteLength(payload),
+        'Connection': agent ? 'keep-alive' : 'close'
+      },
+      timeout: 1000
+    }, (res) => {
+      res.resume();
+      res.on('end', () => resolve(res.statusCode === 200));
+    });
+    req.on('error', () => resolve(false));
+    req.on('timeout', () => {
+      req.destroy();
+      resolve(false);
+    });
+    req.end(payload);
+  });
+}
+
+async function runBenchmark(device, count, intervalMs) {
+  const run = Date.now() % 1000000000;
+  const base = `http://${device.ipAddress}`;
+  
+  const start = await fetch(`${base}/api/benchmark/start`, {
+    method: 'POST',
+    headers: { 'Content-Type': 'application/json' },
+    body: deviceFrame({ run: run, count: count, ts: Date.now() })
+  });
+  if (!start.ok) {
+    throw new Error(`Device refused benchmark: HTTP ${start.status}`);
+  }
+  
+  // The device re-syncs its clock against /api/time before the first probe
+  await new Promise(resolve => setTimeout(resolve, 1000));
+  
+  const transports = ['http', 'udp', 'multicast'];
+  if (device.pushPort > 0) transports.splice(1, 0, 'socket');
+  const sent = {};
+  transports.forEach(name => { sent[name] = 0; });
+  
+  for (let n = 0; n < count; n++) {
+    // Rotate the order so no transport always goes first
+    for (let i = 0; i < transports.length; i++) {
+      const transport = transports[(n + i) % transports.length];
+      const payload = deviceFrame({ type: 'bench-probe', deviceId: device.deviceId, run: run, transport: transport, n: n, ts: Date.now() });
+      sent[transport]++;
+      if (transport === 'http') {
+        sendBenchmarkHttp(device, 80, payload, false);
+      } else if (transport === 'socket') {
+        sendBenchmarkHttp(device, device.pushPort, payload, esp32PushAgent);
+      } else if (transport === 'udp') {
+        sendTallyDatagram(payload, CONFIG.esp32.discoveryPort, device.ipAddress);
+      } else {
+        sendTallyMulticast(payload);
+      }
+    }
+    await new Promise(resolve => setTimeout(resolve, intervalMs));
+  }
+  
+  // Let stragglers arrive before reading the histograms
+  await new Promise(resolve => setTimeout(resolve, 1500));
+  const response = await fetch(`${base}/api/benchmark`);
+  const result = await response.json();
+  for (const transport of result.transports || []) {
+    transport.sent = sent[transport.name] || 0;
+    transport.lost = Math.max(transport.sent - transport.received, 0);
+    transport.lossPct = transport.sent > 0 ? (100 * transport.lost / transport.sent) : 0;
+  }
+  result.deviceId = device.deviceId;
+  result.deviceName = device.deviceName;
+  result.intervalMs = intervalMs;
+  result.finishedAt = new Date().toISOString();
+  // Probes that arrived before the device's clock synced carry no latency
+  result.latencyValid = result.clockSynced === true &&
+    (result.transports || []).every(t => (t.measured ?? t.received) === t.received);
+  return result;
+}
+
+app.post('/api/benchmark', async (req, res) => {
+  const { deviceId } = req.body || {};
+  const count = Math.min(Math.max(Number(req.body?.count) || 50, 1), 1000);
+  const intervalMs = Math.max(Number(req.body?.intervalMs) || 50, 5);
+  
+  const device = esp32Devices[deviceId];
+  if (!device || !device.ipAddress) {
+    return res.status(404).json({ success: false, error: 'Unknown device or no IP address' });
+  }
+  
+  try {
+    console.log(`⏱️ Benchmark: ${device.deviceName} (${deviceId}), ${count} probes per transport every ${intervalMs}ms`);
+    const result = await runBenchmark(device, count, intervalMs);
+    esp32BenchmarkResults.set(deviceId, result);
+    res.json({ success: true, result: result });
+  } catch (error) {
+    console.error(`❌ Benchmark failed for ${deviceId}:`, error.message);
+    res.status(502).json({ success: false, error: error.message });
+  }
+});
+
+app.get('/api/benchmark/:deviceId', (req, res) => {
+  const result = esp32BenchmarkResults.get(req.params.deviceId);
+  if (!result) {
+    return res.status(404).json({ success: false, error: 'No benchmark result for this device' });
+  }
+  res.json({ success: true, result: result });
+});
+
+// Long-poll tally subscription. The device passes the last sequence number
+// and epoch it applied; a newer update is returned at once, otherwise the
+// request is held until the next update or answered with 204 on timeout
+app.get('/api/esp32/subscribe', (req, res) => {
+  const deviceId = req.query.deviceId;
+  const since = Number(req.query.since) || 0;
+  const epoch = Number(req.query.epoch) || 0;
+  
+  const device = esp32Devices[deviceId];
+  if (!device) {
+    return res.status(404).json({
+      success: false,
+      error: 'Device not registered',
+      message: 'Please register the device first'
+    });
+  }
+  
+  if (device.status !== 'online') {
+    device.status = 'online';
+    broadcastDeviceUpdate(device, 'device-status-update');
+  }
+  device.lastSeen = new Date().toISOString();
+  
+  let subscription = esp32Subscriptions.get(deviceId);
+  if (!subscription) {
+    subscription = { res: null, timer: null, lastSeenAt: 0 };
+    esp32Subscriptions.set(deviceId, subscription);
+  }
+  subscription.lastSeenAt = Date.now();
+  
+  // A newer request replaces one the device has given up on
+  if (subscription.res) {
+    clearTimeout(subscription.timer);
+    subscription.res.status(204).end();
+    subscription.res = null;
+  }
+  
+  const latest = esp32LatestTally.get(deviceId);
+  if (latest && (epoch !== deviceTallyEpoch(device) || since < (device.tallySeq || 0))) {
+    return res.type('application/json').send(latest);
+  }
+  
+  subscription.res = res;
+  subscription.timer = setTimeout(() => {
+    if (subscription.res === res) {
+      subscription.res = null;
+      res.status(204).end();
+    }
+  }, CONFIG.esp32.subscribeHoldMs);
+  
+  // Connection dropped while held
+  res.on('close', () => {
+    if (subscription.res === res) {
+      clearTimeout(subscription.timer);
+      subscription.res = null;
+    }
+  });
+});
+
 // API endpoint to discover ESP32 devices on the network
 app.post('/api/esp32/discover', async (req, res) => {
   try {
@@ -2177,7 +2948,7 @@ app.post('/api/esp32/reset-device/:deviceId', async (req, res) => {
           headers: {
             'Content-Type': 'application/json'
           },
-          body: JSON.stringify({ reset: true }),
+          body: deviceFrame({ reset: true, ts: Date.now() }),
           timeout: 5000
         });
         
@@ -2399,8 +3170,10 @@ app.post('/api/esp32/discover', async (req, res) => {
     
     // Step 1: Send UDP broadcast for immediate discovery
     if (discoveryServer) {
+      // Devices reply by unicast and answer each requestId only once
       const broadcast = JSON.stringify({
         type: 'discover-request',
+        requestId: `${Date.now().toString(36)}-${Math.random().toString(36).slice(2, 8)}`,
         timestamp: new Date().toISOString()
       });
       
@@ -2639,6 +3412,189 @@ function createNewUDPServer() {
   discoveryServer.bind(3006);
 }
 
+// MQTT bridge. Each source has a retained tally topic and the snapshot topic
+// holds every source; devices subscribe to their source plus the snapshot and
+// publish presence (last will "offline"), telemetry and an ack per tally
+// message. To try it on Linux:
+//   mosquitto -v &
+//   MQTT_URL=mqtt://localhost:1883 node index.js
+//   mosquitto_sub -v -t 'obs-tally/#'
+// A device (or mosquitto_pub) answering on obs-tally/device/<id>/ack with
+// the message's "ts" shows up as publish-to-display latency on the device
+let mqttClient = null;
+const mqttPublishedStatus = new Map(); // source -> status last published
+
+function mqttTopicSegment(name) {
+  return String(name).replace(/[\/+#]/g, '_');
+}
+
+// The handshake decides; devices that did not negotiate fall back to their
+// MQTT presence
+function isMqttDevice(device) {
+  const transport = device.negotiated ? device.negotiated.transport : device.transport;
+  return transport === 'mqtt' && mqttClient !== null && mqttClient.connected;
+}
+
+function sourceTallyPayload(source) {
+  return deviceFrame({
+    type: 'tally-update',
+    assignedSource: source,
+    status: tallyStatus[source] ? tallyStatus[source].status : 'Idle',
+    obsConnected: obsConnectionStatus === 'connected',
+    recording: recordingStatus.active,
+    streaming: streamingStatus.active,
+    ts: Date.now()
+  });
+}
+
+// Publish the sources whose status changed (all of them when recording or
+// streaming changed), then the snapshot
+function publishTallyMqtt(all = false) {
+  if (!mqttClient || !mqttClient.connected) return;
+  
+  const prefix = CONFIG.mqtt.topicPrefix;
+  const options = { qos: CONFIG.mqtt.qos, retain: true };
+  const sources = {};
+  let published = 0;
+  
+  for (const source of tallySources) {
+    const status = tallyStatus[source] ? tallyStatus[source].status : 'Idle';
+    sources[source] = status;
+    if (!all && mqttPublishedStatus.get(source) === status) continue;
+    
+    mqttPublishedStatus.set(source, status);
+    mqttClient.publish(`${prefix}/source/${mqttTopicSegment(source)}/tally`, sourceTallyPayload(source), options);
+    published++;
+  }
+  
+  if (published > 0) {
+    mqttClient.publish(`${prefix}/snapshot`, deviceFrame({
+      sources: sources,
+      obsConnected: obsConnectionStatus === 'connected',
+      recording: recordingStatus.active,
+      streaming: streamingStatus.active,
+      ts: Date.now()
+    }), options);
+  }
+}
+
+function handleMqttMessage(topic, message) {
+  // <prefix>/device/<deviceId>/<kind>
+  const parts = topic.split('/');
+  const kind = parts.pop();
+  const deviceId = parts.pop();
+  const device = esp32Devices[deviceId];
+  if (!device) return;
+  
+  let data = {};
+  try {
+    data = JSON.parse(message.toString());
+  } catch (err) {
+    return;
+  }
+  
+  if (kind === 'presence') {
+    const previousStatus = device.status;
+    // Only a device that is online on the broker takes tally from it
+    if (data.online) {
+      device.transport = 'mqtt';
+    } else {
+      delete device.transport;
+    }
+    device.status = data.online ? 'online' : 'offline';
+    device.lastSeen = new Date().toISOString();
+    if (previousStatus !== device.status) {
+      console.log(`📶 MQTT presence: ${device.deviceName} (${deviceId}) ${device.status}`);
+      broadcastDeviceUpdate(device, 'device-status-update');
+      // Signed devices drop retained frames older than their replay window;
+      // fresh copies give them the current tally
+      if (data.online && CONFIG.esp32.frameKey) publishTallyMqtt(true);
+    }
+  } else if (kind === 'telemetry') {
+    device.telemetry = data;
+    device.lastSeen = new Date().toISOString();
+  } else if (kind === 'ack' && data.ts) {
+    // Server publish to device display, including the ack's return trip
+    const latency = Date.now() - Number(data.ts);
+    const stats = device.mqttLatency || { samples: 0, avgMs: 0, maxMs: 0, lastMs: 0 };
+    stats.samples++;
+    stats.lastMs = latency;
+    stats.maxMs = Math.max(stats.maxMs, latency);
+    stats.avgMs += (latency - stats.avgMs) / stats.samples;
+    device.mqttLatency = stats;
+    logger.debug(`MQTT publish-to-display ${device.deviceName} (${deviceId}): ${latency}ms`, {
+      applyUs: data.applyUs,
+      avgMs: stats.avgMs.toFixed(1)
+    });
+  }
+}
+
+function startMQTTBridge() {
+  if (!mqtt || !CONFIG.mqtt.url) return;
+  
+  const prefix = CONFIG.mqtt.topicPrefix;
+  const qos = CONFIG.mqtt.qos;
+  mqttClient = mqtt.connect(CONFIG.mqtt.url, {
+    clientId: `obs-tally-server-${os.hostname()}`,
+    will: { topic: `${prefix}/server/presence`, payload: JSON.stringify({ online: false }), qos: qos, retain: true }
+  });
+  
+  mqttClient.on('connect', () => {
+    console.log(`📡 MQTT: connected to ${CONFIG.mqtt.url} (QoS ${qos})`);
+    mqttClient.publish(`${prefix}/server/presence`, JSON.stringify({ online: true }), { qos: qos, retain: true });
+    mqttClient.subscribe([`${prefix}/device/+/presence`, `${prefix}/device/+/telemetry`, `${prefix}/device/+/ack`], { qos: qos });
+    publishTallyMqtt(true);
+  });
+  mqttClient.on('message', handleMqttMessage);
+  mqttClient.on('error', (err) => {
+    console.warn('⚠️  MQTT error:', err.message);
+  });
+}
+
+function stopMQTTBridge() {
+  if (!mqttClient) return;
+  
+  const client = mqttClient;
+  mqttClient = null;
+  client.publish(`${CONFIG.mqtt.topicPrefix}/server/presence`, JSON.stringify({ online: false }), { qos: CONFIG.mqtt.qos, retain: true });
+  client.end();
+}
+
+// Advertise the server over mDNS. Devices advertise the same service type,
+// so the TXT role field tells them apart
+let mdnsAdvertiser = null;
+
+function startMDNSAdvertisement() {
+  if (!Bonjour) return;
+  
+  try {
+    mdnsAdvertiser = new Bonjour();
+    mdnsAdvertiser.publish({
+      name: `OBS Tally Server (${os.hostname()})`,
+      type: CONFIG.esp32.mdnsServiceType,
+      protocol: 'tcp',
+      port: Number(PORT),
+      txt: { role: 'server', api: '1' }
+    });
+    console.log(`📡 mDNS: advertising _${CONFIG.esp32.mdnsServiceType}._tcp on port ${PORT}`);
+  } catch (err) {
+    console.warn('⚠️  mDNS advertisement failed:', err.message);
+    mdnsAdvertiser = null;
+  }
+}
+
+function stopMDNSAdvertisement() {
+  if (!mdnsAdvertiser) return;
+  
+  const advertiser = mdnsAdvertiser;
+  mdnsAdvertiser = null;
+  try {
+    advertiser.unpublishAll(() => advertiser.destroy());
+  } catch (err) {
+    console.warn('Error stopping mDNS advertisement:', err.message);
+  }
+}
+
 // Start the server
 async function startServer() {
   try {
@@ -2676,9 +3632,22 @@ async function startServer() {
       // Initialize UDP discovery for ESP32 devices
       initUDPDiscovery();
       
+      // Let devices find this server via mDNS
+      startMDNSAdvertisement();
+      
+      // Fan tally out through the MQTT broker if one is configured
+      startMQTTBridge();
+      
       // Start ESP32 health monitoring
       startESP32HealthMonitoring();
       
+      // Scene-graph devices that missed an event notice at the next sync
+      setInterval(() => {
+        if (sceneGraph.loaded) {
+          broadcastSceneEvent({ op: 'sync', program: sceneGraph.program, preview: sceneGraph.preview });
+        }
+      }, CONFIG.esp32.sceneSyncInterval);
+      
       // Connect to OBS
       connectOBS();
     });
@@ -2717,6 +3686,12 @@ process.on('SIGINT', () => {
   // Stop ESP32 health monitoring
   stopESP32HealthMonitoring();
   
+  // Withdraw the mDNS advertisement
+  stopMDNSAdvertisement();
+  
+  // Publish offline presence and disconnect from the broker
+  stopMQTTBridge();
+  
   // Close UDP discovery server with proper error handling
   if (discoveryServer) {
     try {
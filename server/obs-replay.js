@@ -0,0 +1,286 @@
+/**
+ * OBS WebSocket v5 stand-in for devices in direct OBS mode
+ *
+ * Replays an event stream recorded by the server (OBS_RECORD_EVENTS=<file>)
+ * to any obs-websocket client. It answers the requests a tally device makes
+ * (current program/preview scene, scene item lists, record/stream status)
+ * from a scene model that the replayed events keep up to date.
+ *
+ * Usage: node server/obs-replay.js <recording.jsonl> [--port 4455]
+ *        [--password <secret>] [--speed <factor>] [--loop]
+ *
+ * Recording format: one JSON object per line, each with "time" (epoch ms)
+ * and either "snapshot" (state when the server identified with OBS) or
+ * "eventType" and "eventData" as received from OBS.
+ */
+
+const fs = require('fs');
+const crypto = require('crypto');
+
+// Event categories (obs-websocket EventSubscription bits) of recorded events
+const EVENT_CATEGORIES = {
+  CurrentProgramSceneChanged: 1 << 2,
+  CurrentPreviewSceneChanged: 1 << 2,
+  SceneNameChanged: 1 << 2,
+  RecordStateChanged: 1 << 6,
+  StreamStateChanged: 1 << 6,
+  SceneItemEnableStateChanged: 1 << 7,
+  SceneItemCreated: 1 << 7,
+  SceneItemRemoved: 1 << 7,
+  StudioModeStateChanged: 1 << 10
+};
+const SUBSCRIBE_ALL = 0x7FF;  // EventSubscription.All, without high-volume events
+
+// Capture the state OBS is in, so a replay starts from the same scenes
+async function captureSnapshot(obs) {
+  const sceneList = await obs.call('GetSceneList');
+  const { studioModeEnabled } = await obs.call('GetStudioModeEnabled');
+  const { outputActive: recording } = await obs.call('GetRecordStatus');
+  const { outputActive: streaming } = await obs.call('GetStreamStatus');
+
+  const scenes = {};
+  for (const { sceneName } of sceneList.scenes) {
+    const { sceneItems } = await obs.call('GetSceneItemList', { sceneName });
+    scenes[sceneName] = sceneItems.map(({ sceneItemId, sourceName, sceneItemEnabled }) =>
+      ({ sceneItemId, sourceName, sceneItemEnabled }));
+  }
+
+  return {
+    programScene: sceneList.currentProgramSceneName,
+    previewScene: studioModeEnabled ? sceneList.currentPreviewSceneName : null,
+    studioMode: studioModeEnabled,
+    recording,
+    streaming,
+    scenes
+  };
+}
+
+// Append a snapshot on every identify and each tally-relevant event to file
+function recordObsEvents(obs, file) {
+  const write = entry => fs.appendFile(file, JSON.stringify({ time: Date.now(), ...entry }) + '\n', err => {
+    if (err) console.error('Error recording OBS event:', err.message);
+  });
+
+  obs.on('Identified', async () => {
+    try {
+      write({ snapshot: await captureSnapshot(obs) });
+    } catch (err) {
+      console.error('Error recording OBS snapshot:', err.message);
+    }
+  });
+  for (const eventType of Object.keys(EVENT_CATEGORIES)) {
+    obs.on(eventType, eventData => write({ eventType, eventData }));
+  }
+  console.log(`Recording OBS events to ${file}`);
+}
+
+// Apply a recorded event to the scene model
+function applyEvent(model, eventType, data) {
+  const items = model.scenes[data.sceneName];
+  switch (eventType) {
+    case 'CurrentProgramSceneChanged':
+      model.programScene = data.sceneName;
+      break;
+    case 'CurrentPreviewSceneChanged':
+      model.previewScene = data.sceneName;
+      break;
+    case 'StudioModeStateChanged':
+      model.studioMode = data.studioModeEnabled;
+      model.previewScene = data.studioModeEnabled ? model.programScene : null;
+      break;
+    case 'SceneNameChanged':
+      model.scenes[data.sceneName] = model.scenes[data.oldSceneName] || [];
+      delete model.scenes[data.oldSceneName];
+      if (model.programScene === data.oldSceneName) model.programScene = data.sceneName;
+      if (model.previewScene === data.oldSceneName) model.previewScene = data.sceneName;
+      break;
+    case 'SceneItemEnableStateChanged': {
+      const item = items && items.find(i => i.sceneItemId === data.sceneItemId);
+      if (item) item.sceneItemEnabled = data.sceneItemEnabled;
+      break;
+    }
+    case 'SceneItemCreated':
+      if (items) items.push({ sceneItemId: data.sceneItemId, sourceName: data.sourceName, sceneItemEnabled: true });
+      break;
+    case 'SceneItemRemoved':
+      if (items) model.scenes[data.sceneName] = items.filter(i => i.sceneItemId !== data.sceneItemId);
+      break;
+    case 'RecordStateChanged':
+      model.recording = data.outputActive;
+      break;
+    case 'StreamStateChanged':
+      model.streaming = data.outputActive;
+      break;
+  }
+}
+
+// Answer a request from the model: [result, code, responseData]
+function answerRequest(model, requestType, requestData = {}) {
+  switch (requestType) {
+    case 'GetCurrentProgramScene':
+      return [true, 100, { currentProgramSceneName: model.programScene, sceneName: model.programScene }];
+    case 'GetCurrentPreviewScene':
+      if (!model.studioMode) return [false, 506];  // StudioModeNotActive
+      return [true, 100, { currentPreviewSceneName: model.previewScene, sceneName: model.previewScene }];
+    case 'GetStudioModeEnabled':
+      return [true, 100, { studioModeEnabled: model.studioMode }];
+    case 'GetSceneList':
+      return [true, 100, {
+        currentProgramSceneName: model.programScene,
+        currentPreviewSceneName: model.studioMode ? model.previewScene : null,
+        scenes: Object.keys(model.scenes).map((sceneName, i) => ({ sceneName, sceneIndex: i }))
+      }];
+    case 'GetGroupList':
+      return [true, 100, { groups: [] }];  // Snapshots do not record groups
+    case 'GetSceneItemList': {
+      const items = model.scenes[requestData.sceneName];
+      if (!items) return [false, 600];  // ResourceNotFound
+      // Items that show another scene are nested scenes, as in OBS
+      return [true, 100, { sceneItems: items.map((item, i) => ({
+        ...item,
+        sceneItemIndex: i,
+        sourceType: model.scenes[item.sourceName] ? 'OBS_SOURCE_TYPE_SCENE' : 'OBS_SOURCE_TYPE_INPUT',
+        isGroup: model.scenes[item.sourceName] ? false : null
+      })) }];
+    }
+    case 'GetRecordStatus':
+      return [true, 100, { outputActive: model.recording }];
+    case 'GetStreamStatus':
+      return [true, 100, { outputActive: model.streaming }];
+    default:
+      return [false, 204];  // UnknownRequestType
+  }
+}
+
+function authResponse(password, salt, challenge) {
+  const sha256 = text => crypto.createHash('sha256').update(text).digest('base64');
+  return sha256(sha256(password + salt) + challenge);
+}
+
+function parseArgs(argv) {
+  const options = { file: null, port: 4455, password: '', speed: 1, loop: false };
+  for (let i = 0; i < argv.length; i++) {
+    const arg = argv[i];
+    if (arg === '--port') options.port = Number(argv[++i]);
+    else if (arg === '--password') options.password = argv[++i];
+    else if (arg === '--speed') options.speed = Number(argv[++i]) || 1;
+    else if (arg === '--loop') options.loop = true;
+    else options.file = arg;
+  }
+  return options;
+}
+
+function main() {
+  const { WebSocketServer } = require('ws');
+  const options = parseArgs(process.argv.slice(2));
+  if (!options.file) {
+    console.error('Usage: node server/obs-replay.js <recording.jsonl> [--port 4455] [--password <secret>] [--speed <factor>] [--loop]');
+    process.exit(1);
+  }
+
+  const entries = fs.readFileSync(options.file, 'utf8').split('\n').filter(line => line.trim()).map(line => JSON.parse(line));
+  const first = entries.findIndex(entry => entry.snapshot);
+  if (first < 0) {
+    console.error('Recording has no snapshot line');
+    process.exit(1);
+  }
+  const recording = entries.slice(first);
+  let model = JSON.parse(JSON.stringify(recording[0].snapshot));
+  let replayTimer = null;
+  const clients = new Set();
+
+  const broadcast = (eventType, eventData) => {
+    const category = EVENT_CATEGORIES[eventType] || 1;
+    const message = JSON.stringify({ op: 5, d: { eventType, eventIntent: category, eventData } });
+    for (const client of clients) {
+      if (client.identified && (client.subscriptions & category)) client.ws.send(message);
+    }
+  };
+
+  // Events are sent with their recorded spacing, divided by --speed
+  const replayFrom = index => {
+    replayTimer = null;
+    const entry = recording[index];
+    if (!entry) {
+      console.log('Replay finished');
+      if (options.loop) {
+        model = JSON.parse(JSON.stringify(recording[0].snapshot));
+        replayTimer = setTimeout(() => replayFrom(1), 1000);
+      }
+      return;
+    }
+
+    if (entry.snapshot) {
+      model = JSON.parse(JSON.stringify(entry.snapshot));
+      console.log(`[${new Date().toISOString()}] snapshot: program "${model.programScene}", preview "${model.previewScene}"`);
+    } else {
+      applyEvent(model, entry.eventType, entry.eventData);
+      broadcast(entry.eventType, entry.eventData);
+      console.log(`[${new Date().toISOString()}] ${entry.eventType} ${JSON.stringify(entry.eventData)}`);
+    }
+
+    const next = recording[index + 1];
+    const delay = next ? Math.max(next.time - entry.time, 0) / options.speed : 0;
+    replayTimer = setTimeout(() => replayFrom(index + 1), delay);
+  };
+
+  const wss = new WebSocketServer({
+    port: options.port,
+    handleProtocols: protocols => (protocols.has('obswebsocket.json') ? 'obswebsocket.json' : false)
+  });
+
+  wss.on('connection', (ws, req) => {
+    const client = { ws, identified: false, subscriptions: SUBSCRIBE_ALL };
+    const salt = crypto.randomBytes(16).toString('base64');
+    const challenge = crypto.randomBytes(16).toString('base64');
+    clients.add(client);
+    console.log(`Client connected from ${req.socket.remoteAddress}`);
+
+    const hello = { obsWebSocketVersion: '5.0.0-replay', rpcVersion: 1 };
+    if (options.password) hello.authentication = { challenge, salt };
+    ws.send(JSON.stringify({ op: 0, d: hello }));
+
+    ws.on('message', raw => {
+      let message;
+      try {
+        message = JSON.parse(raw.toString());
+      } catch (err) {
+        ws.close(4002, 'Message decode error');
+        return;
+      }
+
+      const d = message.d || {};
+      if (message.op === 1) {
+        if (options.password && d.authentication !== authResponse(options.password, salt, challenge)) {
+          ws.close(4009, 'Authentication failed');
+          return;
+        }
+        client.identified = true;
+        client.subscriptions = d.eventSubscriptions !== undefined ? d.eventSubscriptions : SUBSCRIBE_ALL;
+        ws.send(JSON.stringify({ op: 2, d: { negotiatedRpcVersion: 1 } }));
+        console.log(`Client identified (subscriptions ${client.subscriptions})`);
+
+        // The first identified client starts the replay
+        if (!replayTimer) replayTimer = setTimeout(() => replayFrom(1), 1000);
+      } else if (message.op === 6 && client.identified) {
+        const [result, code, responseData] = answerRequest(model, d.requestType, d.requestData);
+        const response = { requestType: d.requestType, requestId: d.requestId, requestStatus: { result, code } };
+        if (responseData) response.responseData = responseData;
+        ws.send(JSON.stringify({ op: 7, d: response }));
+      }
+    });
+
+    ws.on('close', () => {
+      clients.delete(client);
+      console.log('Client disconnected');
+    });
+  });
+
+  console.log(`OBS stand-in listening on ws://0.0.0.0:${options.port} (${recording.length - 1} events, speed x${options.speed})`);
+}
+
+if (require.main === module) {
+  main();
+}
+
+module.exports = { recordObsEvents, captureSnapshot };
@@ -0,0 +1,158 @@
+/**
+ * OBS scene graph kept in step with OBS events
+ *
+ * Scenes (and groups) map to their items; an item whose source is itself a
+ * scene or group is an edge to a nested node. Tally follows enabled edges
+ * from the program or preview scene, so a cut needs no OBS requests.
+ *
+ * Devices that negotiate "sceneGraph" load the part of the graph that can
+ * reach their source and apply the compact ops returned by applySceneEvent,
+ * which the server broadcasts once for all devices.
+ */
+
+const MAX_DEPTH = 8;  // Nesting followed when computing tally, same as the firmware
+
+function createSceneGraph() {
+  return { loaded: false, seq: 0, program: null, preview: null, scenes: new Map() };
+}
+
+function itemsOf(sceneItems) {
+  return sceneItems.map(({ sceneItemId, sourceName, sceneItemEnabled }) =>
+    ({ id: sceneItemId, source: sourceName, enabled: sceneItemEnabled }));
+}
+
+// Read every scene and group from OBS
+async function loadSceneGraph(obs, graph) {
+  const sceneList = await obs.call('GetSceneList');
+  const scenes = new Map();
+  for (const { sceneName } of sceneList.scenes) {
+    const { sceneItems } = await obs.call('GetSceneItemList', { sceneName });
+    scenes.set(sceneName, itemsOf(sceneItems));
+  }
+
+  const { groups } = await obs.call('GetGroupList');
+  for (const groupName of groups) {
+    const { sceneItems } = await obs.call('GetGroupSceneItemList', { sceneName: groupName });
+    scenes.set(groupName, itemsOf(sceneItems));
+  }
+
+  graph.scenes = scenes;
+  graph.program = sceneList.currentProgramSceneName;
+  graph.preview = sceneList.currentPreviewSceneName || null;
+  graph.loaded = true;
+  graph.seq++;
+}
+
+// Update the graph from an OBS event. Returns the op to broadcast (graph.seq
+// is its sequence number), { op: 'reset' } when the graph has to be read
+// again, or null when devices are not affected
+function applySceneEvent(graph, eventType, data) {
+  if (!graph.loaded) return null;
+
+  let op = null;
+  const items = graph.scenes.get(data.sceneName);
+  switch (eventType) {
+    case 'CurrentProgramSceneChanged':
+      graph.program = data.sceneName;
+      op = { op: 'program', scene: data.sceneName };
+      break;
+    case 'CurrentPreviewSceneChanged':
+      graph.preview = data.sceneName;
+      op = { op: 'preview', scene: data.sceneName };
+      break;
+    case 'SceneItemEnableStateChanged': {
+      const item = items && items.find(i => i.id === data.sceneItemId);
+      if (!item || item.enabled === data.sceneItemEnabled) return null;
+      item.enabled = data.sceneItemEnabled;
+      op = { op: 'enable', scene: data.sceneName, id: data.sceneItemId, on: data.sceneItemEnabled };
+      break;
+    }
+    case 'SceneItemCreated':
+      // OBS sends no enabled flag with the event; the caller reads it first
+      if (!items || typeof data.sceneItemEnabled !== 'boolean') return { op: 'reset' };
+      items.push({ id: data.sceneItemId, source: data.sourceName, enabled: data.sceneItemEnabled });
+      op = { op: 'add', scene: data.sceneName, id: data.sceneItemId, source: data.sourceName, on: data.sceneItemEnabled };
+      break;
+    case 'SceneItemRemoved':
+      if (!items || !items.some(i => i.id === data.sceneItemId)) return null;
+      graph.scenes.set(data.sceneName, items.filter(i => i.id !== data.sceneItemId));
+      op = { op: 'remove', scene: data.sceneName, id: data.sceneItemId };
+      break;
+    case 'SceneNameChanged':
+      renameNode(graph, data.oldSceneName, data.sceneName);
+      op = { op: 'rename', from: data.oldSceneName, to: data.sceneName };
+      break;
+    case 'SceneRemoved':
+      // Items that pointed at it are removed by their own events
+      graph.scenes.delete(data.sceneName);
+      return null;
+    case 'SceneCreated':
+      // Groups are scenes too; their items arrive as SceneItemCreated
+      if (!graph.scenes.has(data.sceneName)) graph.scenes.set(data.sceneName, []);
+      return null;
+    default:
+      return null;
+  }
+
+  graph.seq++;
+  return op;
+}
+
+function renameNode(graph, from, to) {
+  if (graph.scenes.has(from)) {
+    graph.scenes.set(to, graph.scenes.get(from));
+    graph.scenes.delete(from);
+  }
+  for (const items of graph.scenes.values()) {
+    for (const item of items) {
+      if (item.source === from) item.source = to;
+    }
+  }
+  if (graph.program === from) graph.program = to;
+  if (graph.preview === from) graph.preview = to;
+}
+
+// True if source is shown in scene through enabled items, nested or not
+function sceneContains(graph, scene, source, depth = MAX_DEPTH) {
+  const items = graph.scenes.get(scene);
+  if (!items) return false;
+  for (const item of items) {
+    if (!item.enabled) continue;
+    if (item.source === source) return true;
+    if (depth > 0 && graph.scenes.has(item.source) && sceneContains(graph, item.source, source, depth - 1)) return true;
+  }
+  return false;
+}
+
+function sourceTally(graph, source) {
+  if (graph.program && sceneContains(graph, graph.program, source)) return 'Live';
+  if (graph.preview && sceneContains(graph, graph.preview, source)) return 'Preview';
+  return 'Idle';
+}
+
+// Edges [scene, itemId, child, enabled] of every scene that can reach source,
+// enabled or not, so that enable ops only flip a flag on the device
+function relevantEdges(graph, source) {
+  const relevant = new Set([source]);
+  let grown = true;
+  while (grown) {
+    grown = false;
+    for (const [scene, items] of graph.scenes) {
+      if (!relevant.has(scene) && items.some(item => relevant.has(item.source))) {
+        relevant.add(scene);
+        grown = true;
+      }
+    }
+  }
+
+  const edges = [];
+  for (const [scene, items] of graph.scenes) {
+    if (scene === source || !relevant.has(scene)) continue;
+    for (const item of items) {
+      if (relevant.has(item.source)) edges.push([scene, item.id, item.source, item.enabled]);
+    }
+  }
+  return edges;
+}
+
+module.exports = { createSceneGraph, loadSceneGraph, applySceneEvent, sourceTally, relevantEdges };
@@ -0,0 +1,249 @@
+/**
+ * Synthetic TSL UMD source for devices in TSL mode
+ *
+ * Sends TSL 3.1 or 5.0 tally packets over UDP or TCP, either as a stream
+ * that cycles the display through program, preview and idle (throughput) or
+ * as a fixed set of edge cases with known outcomes (--conformance). With
+ * --device the run is checked against the counters in /api/device-info.
+ *
+ * Usage: node server/tsl-generator.js <host> [--port 40001] [--index 0]
+ *        [--version 5|3.1] [--tcp] [--rate <packets/s>] [--count <n>]
+ *        [--conformance] [--device http://<device-ip>]
+ */
+
+const dgram = require('dgram');
+const net = require('net');
+const http = require('http');
+
+const DLE = 0xFE;
+const STX = 0x02;
+const TALLY_NAMES = ['idle', 'program', 'preview', 'program+preview'];
+
+// TSL 5.0 lamp values: 1 red (program), 2 green (preview), 3 amber (both)
+function lampControl(tally, brightness = 3) {
+  return (tally & 0x03) << 2 | (brightness << 6);  // Text tally only
+}
+
+// One TSL 5.0 display message: INDEX CONTROL LENGTH TEXT, little-endian
+function tsl5Message(index, control, text = '') {
+  const body = Buffer.from(text, 'ascii');
+  const message = Buffer.alloc(6 + body.length);
+  message.writeUInt16LE(index, 0);
+  message.writeUInt16LE(control, 2);
+  message.writeUInt16LE(body.length, 4);
+  body.copy(message, 6);
+  return message;
+}
+
+// A TSL 5.0 packet: PBC VER FLAGS SCREEN, then the display messages
+function tsl5Packet(messages, { flags = 0, screen = 0, pbcDelta = 0 } = {}) {
+  const body = Buffer.concat(messages);
+  const header = Buffer.alloc(6);
+  header.writeUInt16LE(body.length + 4 + pbcDelta, 0);
+  header.writeUInt8(0, 2);
+  header.writeUInt8(flags, 3);
+  header.writeUInt16LE(screen, 4);
+  return Buffer.concat([header, body]);
+}
+
+// A TSL 3.1 message: 0x80 + address, control (bit 0 program, bit 1 preview), 16 characters
+function tsl31Message(address, tally, text = '') {
+  const message = Buffer.alloc(18, 0x20);
+  message[0] = 0x80 | (address & 0x7F);
+  message[1] = (tally & 0x03) | 0x30;  // Brightness 3
+  message.write(text.slice(0, 16), 2, 'ascii');
+  return message;
+}
+
+// TSL 5.0 over TCP: DLE/STX, then the packet with every DLE doubled
+function tcpFrame(packet, version) {
+  if (version !== '5') return packet;
+  const bytes = [DLE, STX];
+  for (const b of packet) {
+    bytes.push(b);
+    if (b === DLE) bytes.push(DLE);
+  }
+  return Buffer.from(bytes);
+}
+
+function tallyPacket(options, tally, text) {
+  if (options.version === '5') return tsl5Packet([tsl5Message(options.index, lampControl(tally), text)]);
+  return tsl31Message(options.index, tally, text);
+}
+
+// Cases with the expected effect on the device counters: matched when the
+// display must take the tally, malformed when the packet must be rejected
+function conformanceCases(index) {
+  const other = index === 0 ? 1 : 0;
+  return [
+    { name: '5.0 program', packet: tsl5Packet([tsl5Message(index, lampControl(1), 'CAM')]), matched: 1, tally: 1 },
+    { name: '5.0 broadcast index 0xFFFF', packet: tsl5Packet([tsl5Message(0xFFFF, lampControl(2))]), matched: 1, tally: 2 },
+    { name: '5.0 amber lamp', packet: tsl5Packet([tsl5Message(index, lampControl(3))]), matched: 1, tally: 3 },
+    { name: '5.0 left and right lamps', packet: tsl5Packet([tsl5Message(index, 0x01 | 0x20)]), matched: 1, tally: 3 },
+    { name: '5.0 several messages, last wins', packet: tsl5Packet([tsl5Message(index, lampControl(1)), tsl5Message(other, lampControl(1)), tsl5Message(index, lampControl(2))]), matched: 1, tally: 2 },
+    { name: '5.0 unicode text flag', packet: tsl5Packet([tsl5Message(index, lampControl(1), 'C\0A\0M\0')], { flags: 0x01 }), matched: 1, tally: 1 },
+    { name: '5.0 control data message', packet: tsl5Packet([tsl5Message(index, 0x8000 | lampControl(2))]), matched: 0 },
+    { name: '5.0 screen control packet', packet: tsl5Packet([tsl5Message(index, lampControl(2))], { flags: 0x02 }), matched: 0 },
+    { name: '5.0 other display', packet: tsl5Packet([tsl5Message(other, lampControl(1))]), matched: 0 },
+    { name: '5.0 byte count too long', packet: tsl5Packet([tsl5Message(index, lampControl(1))], { pbcDelta: 2 }), malformed: 1 },
+    { name: '5.0 truncated message', packet: tsl5Packet([tsl5Message(index, lampControl(1), 'CAM')]).subarray(0, 13), malformed: 1 },
+    { name: '3.1 program', packet: tsl31Message(index, 1, 'CAM'), matched: 1, tally: 1, tcp31: true },
+    { name: '3.1 several messages', packet: Buffer.concat([tsl31Message(other, 1), tsl31Message(index, 2)]), matched: 1, tally: 2, tcp31: true },
+    { name: '3.1 other address', packet: tsl31Message(other, 1), matched: 0, tcp31: true },
+    { name: '3.1 short message', packet: tsl31Message(index, 1).subarray(0, 10), malformed: 1 },
+    { name: 'final idle', packet: tsl5Packet([tsl5Message(index, 0)]), matched: 1, tally: 0 }
+  ];
+}
+
+function getDeviceInfo(device) {
+  return new Promise((resolve, reject) => {
+    http.get(`${device.replace(/\/$/, '')}/api/device-info`, res => {
+      let body = '';
+      res.on('data', chunk => { body += chunk; });
+      res.on('end', () => {
+        try {
+          resolve(JSON.parse(body).tsl || {});
+        } catch (err) {
+          reject(err);
+        }
+      });
+    }).on('error', reject);
+  });
+}
+
+// Packet sink for UDP or TCP; TCP frames 5.0 packets with DLE/STX
+async function openSender(options) {
+  if (!options.tcp) {
+    const socket = dgram.createSocket('udp4');
+    return {
+      send: packet => new Promise((resolve, reject) =>
+        socket.send(packet, options.port, options.host, err => (err ? reject(err) : resolve()))),
+      close: () => socket.close()
+    };
+  }
+
+  const socket = await new Promise((resolve, reject) => {
+    const s = net.connect(options.port, options.host, () => resolve(s));
+    s.once('error', reject);
+  });
+  socket.setNoDelay(true);
+  return {
+    send: (packet, version = options.version) => new Promise(resolve => {
+      if (socket.write(tcpFrame(packet, version))) resolve();
+      else socket.once('drain', resolve);
+    }),
+    close: () => socket.end()
+  };
+}
+
+const sleep = ms => new Promise(resolve => setTimeout(resolve, ms));
+
+async function runConformance(options) {
+  const sender = await openSender(options);
+  const before = options.device ? await getDeviceInfo(options.device) : null;
+  let expectMatched = 0;
+  let expectMalformed = 0;
+  let failures = 0;
+
+  for (const testCase of conformanceCases(options.index)) {
+    // Over TCP a broken packet only costs sync until the next start
+    if (options.tcp && testCase.malformed) continue;
+
+    const caseBefore = options.device ? await getDeviceInfo(options.device) : null;
+    await sender.send(testCase.packet, testCase.tcp31 ? '3.1' : '5');
+    await sleep(options.device ? 300 : 50);
+    expectMatched += testCase.matched || 0;
+    expectMalformed += testCase.malformed || 0;
+
+    let verdict = 'sent';
+    if (caseBefore) {
+      const after = await getDeviceInfo(options.device);
+      const matched = after.matched - caseBefore.matched;
+      const malformed = after.malformed - caseBefore.malformed;
+      const ok = matched === (testCase.matched || 0) && malformed === (testCase.malformed || 0) &&
+        (testCase.tally === undefined || after.tally === testCase.tally);
+      verdict = ok ? 'ok' : `FAIL (matched +${matched}, malformed +${malformed}, tally ${TALLY_NAMES[after.tally]})`;
+      if (!ok) failures++;
+    }
+    console.log(`${testCase.name.padEnd(36)} ${verdict}`);
+  }
+  sender.close();
+
+  if (before) {
+    const after = await getDeviceInfo(options.device);
+    console.log(`Device counted ${after.matched - before.matched}/${expectMatched} matched, ` +
+      `${after.malformed - before.malformed}/${expectMalformed} malformed; ${failures} failed`);
+  }
+  return failures;
+}
+
+async function runThroughput(options) {
+  const sender = await openSender(options);
+  const before = options.device ? await getDeviceInfo(options.device) : null;
+  const interval = 1000 / options.rate;
+  const started = Date.now();
+
+  for (let i = 0; i < options.count; i++) {
+    const tally = [1, 2, 0][i % 3];
+    await sender.send(tallyPacket(options, tally, `CAM ${options.index}`));
+    const due = started + (i + 1) * interval;
+    if (due > Date.now()) await sleep(due - Date.now());
+  }
+  const seconds = (Date.now() - started) / 1000;
+  sender.close();
+  console.log(`Sent ${options.count} TSL ${options.version} packets over ${options.tcp ? 'TCP' : 'UDP'} ` +
+    `in ${seconds.toFixed(2)} s (${(options.count / seconds).toFixed(0)}/s)`);
+
+  if (before) {
+    await sleep(1000);
+    const after = await getDeviceInfo(options.device);
+    const matched = after.matched - before.matched;
+    console.log(`Device matched ${matched}/${options.count} (${(100 * matched / options.count).toFixed(1)}%), ` +
+      `malformed ${after.malformed - before.malformed}, last apply ${after.lastApplyUs ?? after.last_apply_us} us`);
+  }
+}
+
+function parseArgs(argv) {
+  const options = { host: null, port: 40001, index: 0, version: '5', tcp: false, rate: 50, count: 500, conformance: false, device: null };
+  for (let i = 0; i < argv.length; i++) {
+    const arg = argv[i];
+    if (arg === '--port') options.port = Number(argv[++i]);
+    else if (arg === '--index') options.index = Number(argv[++i]);
+    else if (arg === '--version') options.version = argv[++i] === '3.1' ? '3.1' : '5';
+    else if (arg === '--tcp') options.tcp = true;
+    else if (arg === '--rate') options.rate = Number(argv[++i]) || 50;
+    else if (arg === '--count') options.count = Number(argv[++i]) || 500;
+    else if (arg === '--conformance') options.conformance = true;
+    else if (arg === '--device') options.device = argv[++i];
+    else options.host = arg;
+  }
+  return options;
+}
+
+async function main() {
+  const options = parseArgs(process.argv.slice(2));
+  if (!options.host) {
+    console.error('Usage: node server/tsl-generator.js <host> [--port 40001] [--index 0] [--version 5|3.1] [--tcp] ' +
+      '[--rate <packets/s>] [--count <n>] [--conformance] [--device http://<device-ip>]');
+    process.exit(1);
+  }
+  if (options.version === '3.1' && options.index > 126) {
+    console.error('TSL 3.1 addresses are 0-126');
+    process.exit(1);
+  }
+
+  if (options.conformance) {
+    process.exitCode = (await runConformance(options)) > 0 ? 1 : 0;
+  } else {
+    await runThroughput(options);
+  }
+}
+
+if (require.main === module) {
+  main().catch(err => {
+    console.error('TSL generator error:', err.message);
+    process.exit(1);
+  });
+}
+
+module.exports = { tsl5Packet, tsl5Message, tsl31Message, tcpFrame, conformanceCases };